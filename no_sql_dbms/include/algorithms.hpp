@@ -1,4 +1,8 @@
 #pragma once
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
 #include "vector.hpp"
 
 template<typename T>
@@ -54,3 +58,72 @@ void custom_sort(Vector<T>& vec) {
         }
     }
 }
+
+// Intersection of two sorted vectors without duplicates. Each element of the
+// shorter one is looked up in the longer one by doubling the step from the
+// previous match and then bisecting, so a small list against a large one
+// costs O(m log(n / m)) instead of O(n + m).
+template<typename T>
+Vector<T> gallop_intersect(const Vector<T>& a, const Vector<T>& b) {
+    const Vector<T>& small = a.size() <= b.size() ? a : b;
+    const Vector<T>& large = a.size() <= b.size() ? b : a;
+    Vector<T> result;
+    size_t pos = 0;
+    for (size_t i = 0; i < small.size() && pos < large.size(); ++i) {
+        const T& x = small[i];
+        size_t hi = pos, step = 1;
+        while (hi < large.size() && large[hi] < x) {
+            pos = hi + 1;
+            hi += step;
+            step *= 2;
+        }
+        size_t end = hi < large.size() ? hi : large.size();
+        while (pos < end) {
+            size_t mid = pos + (end - pos) / 2;
+            if (large[mid] < x) pos = mid + 1;
+            else end = mid;
+        }
+        if (pos < large.size() && !(x < large[pos])) {
+            result.push_back(x);
+            ++pos;
+        }
+    }
+    return result;
+}
+
+// std::sort on one slice per hardware thread, then pairwise merges of
+// neighbouring slices, each round in parallel. Small inputs, or machines
+// with a single core, are sorted on the calling thread.
+template<typename Iterator, typename Compare = std::less<>>
+void parallel_sort(Iterator first, Iterator last, Compare comp = Compare()) {
+    size_t n = last - first;
+    size_t threads = std::thread::hardware_concurrency();
+    if (threads > 16) threads = 16;
+    if (n < (1u << 16) || threads < 2) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (size_t t = 0; t <= threads; ++t) bounds.push_back(n * t / threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([=] { std::sort(first + bounds[t], first + bounds[t + 1], comp); });
+    }
+    for (auto &w : workers) w.join();
+
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged;
+        workers.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+            if (i + 2 < bounds.size()) {
+                size_t lo = bounds[i], mid = bounds[i + 1], hi = bounds[i + 2];
+                workers.emplace_back([=] { std::inplace_merge(first + lo, first + mid, first + hi, comp); });
+            }
+        }
+        merged.push_back(bounds.back());
+        for (auto &w : workers) w.join();
+        bounds = merged;
+    }
+}
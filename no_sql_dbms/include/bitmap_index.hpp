@@ -0,0 +1,68 @@
+#pragma once
+#include <map>
+#include <string>
+#include <unordered_map>
+#include "vector.hpp"
+#include "hash_map.hpp"
+#include "roaring_bitmap.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Bitmap indexes for low-cardinality fields of one collection. Every
+// document gets a row number shared by all indexed fields, so conditions on
+// different fields combine as bitmap AND / OR / AND NOT. Equality, $in, $ne
+// and $nin are answered exactly, which lets counts skip the documents.
+class BitmapIndex {
+public:
+    bool empty() const;
+    bool has_field(const std::string &field) const;
+    const Vector<std::string>& indexed_fields() const;
+    // Indexed fields joined by commas.
+    std::string spec() const;
+
+    void add_field(const std::string &field);
+    // Adds one document to a newly added field's bitmaps.
+    void index_field(const std::string &field, const json &doc, const std::string &id);
+    void insert(const json &doc, const std::string &id);
+    void remove(const json &doc, const std::string &id);
+
+    // Rows matching the query; false when some condition is not on an
+    // indexed field or uses another operator.
+    bool rows_for(const json &query, RoaringBitmap &rows) const;
+    bool field_rows(const std::string &field, const json &cond, RoaringBitmap &rows) const;
+    Vector<std::string> ids_of(const RoaringBitmap &rows) const;
+    // Grouped count as Collection::count computes it; false when the query
+    // or the group_by field is not covered.
+    bool count(const json &query, const std::string &group_by, const std::string &bucket,
+               HashMap<uint64_t> &counts) const;
+
+    json to_json() const;
+    void from_json(const json &j);
+
+private:
+    struct ValueRows {
+        json value;
+        RoaringBitmap rows;
+    };
+    struct FieldBitmaps {
+        std::map<std::string, ValueRows> values;
+        // Documents whose value is an array or object; they only take part
+        // in $ne and $nin.
+        RoaringBitmap structured;
+    };
+
+    Vector<std::string> fields;
+    std::unordered_map<std::string, FieldBitmaps> bitmaps;
+    Vector<std::string> ids;
+    std::unordered_map<std::string, uint32_t> rows_by_id;
+    RoaringBitmap alive;
+    size_t dead_count = 0;
+
+    uint32_t row_of(const std::string &id);
+    void set(FieldBitmaps &field, const json &value, uint32_t row);
+    void unset(FieldBitmaps &field, const json &value, uint32_t row);
+    static bool value_key(const json &value, std::string &key);
+    bool value_rows(const FieldBitmaps &field, const json &value, RoaringBitmap &rows) const;
+    void compact();
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "vector.hpp"
+#include "bloom_filter.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Scan pruning for fields without a full index. Documents get row numbers
+// in insertion order and every BLOCK_ROWS rows form a block that keeps the
+// min/max of its "zonemap:<field>" fields and a bloom filter of the values
+// of its "bloom:<field>" fields, so a scan can skip the blocks that cannot
+// hold a match. Deletes leave the summaries as they are: they only ever
+// cover more than the block holds, never less.
+class BlockIndex {
+public:
+    static const size_t BLOCK_ROWS = 1024;
+
+    bool empty() const;
+    // Names are "zonemap:<field>" or "bloom:<field>".
+    bool has(const std::string &name) const;
+    Vector<std::string> names() const;
+    // Names joined by commas.
+    std::string spec() const;
+
+    void add(const std::string &name);
+    // Gives the id the next row without summarizing a document yet, so that
+    // a build can lay rows out in its own order.
+    void reserve_row(const std::string &id);
+    void insert(const json &doc, const std::string &id);
+    void remove(const std::string &id);
+
+    // Ids of the documents in the blocks that may hold matches of the
+    // query; false when no block can be skipped, so a plain scan is cheaper.
+    bool candidates(const json &query, Vector<std::string> &ids) const;
+
+    json stats() const;
+    json to_json() const;
+    void from_json(const json &j);
+
+private:
+    // Range of the values one block holds in a field, kept apart for
+    // numbers and strings as evaluate_query only compares like with like.
+    struct Zone {
+        bool numbers = false, strings = false, others = false;
+        double min_num = 0, max_num = 0;
+        std::string min_str, max_str;
+    };
+    struct Block {
+        uint32_t live = 0;
+        std::unordered_map<std::string, Zone> zones;
+        std::unordered_map<std::string, BloomFilter> blooms;
+    };
+
+    Vector<std::string> zone_fields;
+    Vector<std::string> bloom_fields;
+    Vector<Block> blocks;
+    Vector<std::string> ids;
+    std::unordered_map<std::string, uint32_t> rows_by_id;
+
+    uint32_t row_of(const std::string &id);
+    static bool bloom_key(const json &value, std::string &key);
+    static void widen(Zone &zone, const json &value);
+    bool block_may_match(const Block &block, const json &query) const;
+    bool field_may_match(const Block &block, const std::string &field, const json &cond) const;
+    bool value_may_match(const Block &block, const std::string &field, const json &value) const;
+};
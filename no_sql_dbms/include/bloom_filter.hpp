@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Bloom filter over 64-bit key hashes. Probes use double hashing
+// (h1 + i * h2), so one hash per key is enough. The bit array can be
+// written out and probed in place from a mapped file with probe().
+class BloomFilter {
+public:
+    BloomFilter(size_t keys, size_t bits_per_key = 10);
+    // Takes over a bit array written out with data().
+    BloomFilter(const std::string &data, uint32_t hashes);
+
+    static uint64_t hash(const std::string &key);
+    static bool probe(const uint8_t *bits, size_t bit_count, uint32_t hashes, uint64_t h);
+
+    void add(uint64_t h);
+    bool may_contain(uint64_t h) const;
+
+    const std::string& data() const;
+    size_t bit_count() const;
+    uint32_t hash_count() const;
+
+private:
+    std::string bits;
+    size_t nbits;
+    uint32_t k;
+};
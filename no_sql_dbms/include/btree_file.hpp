@@ -0,0 +1,84 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "vector.hpp"
+
+// Paged B-tree index file (version 1), built bottom-up from sorted keys:
+//   page 0  header "NSQLBTR1" u32 version u32 page_size u64 page_count
+//           u64 root_page u64 key_count u64 ids_offset u32 height u32 reserved
+//   pages   [u16 leaf][u16 count][u32 reserved][u64 next_leaf] + count entries
+//           [f64 key][u64 value]; value is a child page number in inner pages
+//           and an offset into the id area in leaves. Inner keys are the
+//           smallest key of the child.
+//   ids     per key [u32 n] then n x [u32 len][id]
+struct BTreeFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t page_count;
+    uint64_t root_page;
+    uint64_t key_count;
+    uint64_t ids_offset;
+    uint32_t height;
+    uint32_t reserved;
+};
+
+struct BTreePageHeader {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t reserved;
+    uint64_t next;
+};
+
+struct BTreePageEntry {
+    double key;
+    uint64_t value;
+};
+
+// Read-only, memory-mapped B-tree. Lookups touch only the pages on the
+// path from the root, so only those are faulted in.
+class BTreeFile {
+public:
+    explicit BTreeFile(const std::string &path);
+    ~BTreeFile();
+    BTreeFile(const BTreeFile&) = delete;
+    BTreeFile& operator=(const BTreeFile&) = delete;
+
+    size_t key_count() const;
+    void search(double key, Vector<std::string> &out) const;
+    void range(double low, double high, bool includeLow, bool includeHigh,
+               Vector<std::pair<double, std::string>> &out) const;
+
+private:
+    std::string path;
+    const uint8_t *base;
+    size_t length;
+    const BTreeFileHeader *header;
+
+    const BTreePageHeader* page(uint64_t no) const;
+    const BTreePageEntry* entries(const BTreePageHeader *p) const;
+    uint64_t find_leaf(double key) const;
+    void read_ids(uint64_t offset, double key, Vector<std::pair<double, std::string>> *pairs, Vector<std::string> *ids) const;
+};
+
+// Keys must be added in strictly ascending order.
+class BTreeFileWriter {
+public:
+    explicit BTreeFileWriter(const std::string &path);
+
+    void add(double key, const Vector<std::string> &ids);
+    void finish();
+
+private:
+    std::string path;
+    std::string pages;
+    std::string ids_data;
+    std::string leaf;
+    Vector<BTreePageEntry> level;
+    uint64_t key_count;
+
+    uint64_t append_page(bool is_leaf, const std::string &body, uint16_t count, uint64_t next);
+    void flush_leaf(bool has_next);
+};
@@ -1,35 +1,83 @@
 #pragma once
 #include <memory>
+#include <cstdint>
 #include "vector.hpp"
 #include <string>
+#include <utility>
+#include <vector>
+#include <set>
+#include "btree_file.hpp"
 #include "../parcer/json.hpp"
 
 using json = nlohmann::json;
 
-struct BTreeNode {
-    bool leaf;
-    Vector<double> keys;
-    Vector<Vector<std::string>> ids;
-    Vector<std::shared_ptr<BTreeNode>> children;
-    BTreeNode(bool isLeaf = true);
-};
-
+// In-memory B+tree over an optional read-only paged base file; lookups
+// merge both, inserts go to the in-memory tree only. Range scans descend
+// once to the lower bound and then follow the leaf chain.
+//
+// Nodes hold up to `fanout` keys and live in flat arrays indexed by node
+// number, so a node's keys are contiguous (fanout / 8 cache lines) and a
+// lookup follows node numbers instead of heap pointers. Inner separators
+// are the smallest key of the right child. A leaf's id lists sit in `ids`
+// next to its keys, and its last ref slot holds the next leaf.
+//
+// Removal deletes from the in-memory tree, refilling a node that drops
+// below half of the fanout from a sibling or merging it into one; freed
+// nodes are reused, and the arrays are packed again once half of the
+// nodes are free. Entries of the base file get a tombstone instead; once
+// tombstones cover half of the base, the live entries are loaded into
+// memory and the base dropped (the next checkpoint writes a compact file
+// again).
 class BTreeIndex {
 public:
-    explicit BTreeIndex(int t = 3);
+    static const int DEFAULT_FANOUT = 64;
+    static const int MIN_FANOUT = 4;
+    static const int MAX_FANOUT = 4096;
+
+    explicit BTreeIndex(int fanout = DEFAULT_FANOUT);
+    int fanout() const;
     void insert(double key, const std::string &id);
+    // Replaces the in-memory tree with one built bottom-up from pairs
+    // sorted by key, moving the ids out of `pairs`. Nodes are packed full.
+    void bulk_load(std::vector<std::pair<double, std::string>> &pairs);
+    bool remove(double key, const std::string &id);
     Vector<std::string> search(double key) const;
     Vector<std::string> rangeSearch(double low, double high, bool includeLow = false, bool includeHigh = false) const;
-    json to_json(std::shared_ptr<BTreeNode> node = nullptr) const;
+    json to_json() const;
     void from_json(const json &j);
+    void set_base(std::shared_ptr<const BTreeFile> file);
+    json stats() const;
 
 private:
-    int t;
-    std::shared_ptr<BTreeNode> root;
+    static const uint32_t NO_NODE = 0xffffffffu;
+
+    int max_keys;
+    uint32_t root;
+    Vector<double> keys;
+    // fanout + 1 per node: the children of an inner node.
+    Vector<uint32_t> refs;
+    Vector<uint16_t> counts;
+    Vector<uint8_t> leaves;
+    // fanout per node, used by leaves only.
+    Vector<Vector<std::string>> ids;
+    Vector<uint32_t> free_nodes;
+    std::shared_ptr<const BTreeFile> base;
+    std::set<std::pair<double, std::string>> tombstones;
 
-    void splitChild(std::shared_ptr<BTreeNode> x, int i, std::shared_ptr<BTreeNode> y);
-    void insertNonFull(std::shared_ptr<BTreeNode> x, double k, const std::string &id);
-    Vector<std::string> searchNode(std::shared_ptr<BTreeNode> x, double k) const;
-    void rangeSearchNode(std::shared_ptr<BTreeNode> x, double low, double high, bool includeLow, bool includeHigh, Vector<std::string> &result) const;
-    std::shared_ptr<BTreeNode> load_node(const json &j) const;
+    uint32_t new_node(bool leaf);
+    double* node_keys(uint32_t node) { return keys.data() + (size_t)node * max_keys; }
+    const double* node_keys(uint32_t node) const { return keys.data() + (size_t)node * max_keys; }
+    uint32_t* node_refs(uint32_t node) { return refs.data() + (size_t)node * (max_keys + 1); }
+    const uint32_t* node_refs(uint32_t node) const { return refs.data() + (size_t)node * (max_keys + 1); }
+    Vector<std::string>* node_ids(uint32_t node) { return ids.data() + (size_t)node * max_keys; }
+    const Vector<std::string>* node_ids(uint32_t node) const { return ids.data() + (size_t)node * max_keys; }
+    void split_child(uint32_t parent, int i);
+    bool remove_from_tree(double key, const std::string &id);
+    void borrow_from_left(uint32_t parent, int i);
+    void borrow_from_right(uint32_t parent, int i);
+    void merge_children(uint32_t parent, int i);
+    void compact();
+    std::vector<std::pair<double, std::string>> tree_pairs() const;
+    uint32_t find_leaf(double k) const;
+    static void load_entries(const json &j, Vector<std::pair<double, Vector<std::string>>> &out);
 };
@@ -1,28 +1,229 @@
 #pragma once
 #include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include "hash_map.hpp"
+#include "doc_store.hpp"
+#include "column_store.hpp"
+#include "paged_store.hpp"
+#include "lsm_store.hpp"
 #include "btree_index.hpp"
+#include "ordered_index.hpp"
+#include "trigram_index.hpp"
+#include "text_index.hpp"
+#include "bitmap_index.hpp"
+#include "ttl_index.hpp"
+#include "block_index.hpp"
 #include "query_evaluator.hpp"
+#include "wal.hpp"
+#include "partition_set.hpp"
+
+struct CheckpointStats {
+    uint64_t count = 0;
+    uint64_t last_lsn = 0;
+    double last_lock_us = 0;
+    double max_lock_us = 0;
+    double last_duration_ms = 0;
+    uint64_t indexes_written = 0;
+    uint64_t deltas_written = 0;
+};
+
+// Passes of the TTL reaper over one collection.
+struct TtlStats {
+    uint64_t passes = 0;
+    uint64_t deleted = 0;
+    uint64_t last_deleted = 0;
+    double last_pass_ms = 0;
+    double max_pass_ms = 0;
+};
+
+// Per-collection settings, stored in <name>.meta.json when the collection
+// is created with non-default options. Stored settings win over the ones
+// passed to the constructor.
+struct CollectionOptions {
+    std::string engine = "document";
+    Vector<ColumnSpec> columns;
+    std::string partition_field;
+    std::string partition_granularity = "day";
+    int retention_days = 0;
+    // Buffer pool size of the paged engine; a runtime setting, not stored.
+    size_t cache_bytes = 64 * 1024 * 1024;
+
+    json to_json() const;
+    static CollectionOptions from_json(const json &j);
+};
+
+// One index file referenced by the catalog of the last checkpoint.
+struct IndexFileEntry {
+    std::string field = "";
+    std::string type = "";
+    std::string file = "";
+    // Node fanout of a B-tree index, 0 for the default.
+    int fanout = 0;
+    // Query selecting the documents of a partial index, null for all.
+    json filter = nullptr;
+    // Seconds after which a TTL index expires documents.
+    int64_t expire_after = 0;
+    // Files of hash and B-tree index changes made since `file` was
+    // written, oldest first; loading applies them on top of it.
+    Vector<std::string> deltas = {};
+};
+
+// One key gained or lost an id in a hash or B-tree index. Keys are the
+// index_key_for_value string of a hash index or the number of a B-tree.
+struct IndexChange {
+    bool added;
+    json key;
+    std::string id;
+};
+
+// An index being built from a snapshot while writes go on. Every document
+// written after the snapshot is kept here as it was in the snapshot (null
+// when it did not exist) so the index can be brought up to date on publish.
+struct IndexBuild {
+    std::string spec;
+    std::string type;
+    std::string field;
+    int fanout = BTreeIndex::DEFAULT_FANOUT;
+    int64_t expire_after = 0;
+    json filter;
+    std::shared_ptr<StorageSnapshot> snap;
+    HashMap<json> before;
+    HashMap<Vector<std::string>> hash;
+    BTreeIndex btree;
+    OrderedIndex ordered;
+    TrigramIndex trigram;
+    TextIndex text;
+    BitmapIndex bitmap;
+    TtlIndex ttl;
+    BlockIndex blocks;
+};
 
 class Collection {
 public:
-    Collection(const std::string &db_path, const std::string &name);
+    Collection(const std::string &db_path, const std::string &name,
+               const CollectionOptions &options = CollectionOptions());
     ~Collection();
 
     std::string insert(json doc);
+    void restore(const json &doc);
     Vector<json> find(const json &query);
+    json count(const json &query, const std::string &group_by, const std::string &bucket);
     int remove(const json &query);
-    void create_index(const std::string &field);
+    // A non-null filter makes a partial index holding only the documents
+    // that match it; queries use it only when they imply the filter.
+    void create_index(const std::string &field, const json &filter = json());
+    // Online index creation: start and finish run under the write lock,
+    // run_index_build without any lock while inserts continue.
+    std::shared_ptr<IndexBuild> start_index_build(const std::string &spec, const json &filter = json());
+    static void run_index_build(IndexBuild &build);
+    void finish_index_build(const std::shared_ptr<IndexBuild> &build);
+    void abort_index_build(const std::shared_ptr<IndexBuild> &build);
+    // Partitioned collections: records the index for the partitions created
+    // from now on and returns the existing ones, which each still need it
+    // built, online or with create_index.
+    Vector<std::shared_ptr<Collection>> add_partition_index(const std::string &spec, const json &filter = json());
+    // TTL expiry, driven by the server's reaper: remove_expired deletes at
+    // most `limit` documents whose TTL index says they expired by `now`
+    // (seconds since the epoch) and returns how many it deleted.
+    bool expires_documents() const;
+    size_t remove_expired(int64_t now, size_t limit);
+    void record_ttl_pass(uint64_t deleted, double ms);
+    Vector<std::string> index_fields() const;
+    // Filter of a partial index named as in index_fields(), null otherwise.
+    json index_filter(const std::string &name) const;
+    void commit();
+    uint64_t last_lsn() const;
+    void wait_durable(uint64_t lsn);
+    void checkpoint_if_needed();
+    void set_commit_delay(std::chrono::microseconds delay);
+    void set_checkpoint_wal_bytes(size_t bytes);
+    WalStats wal_stats() const;
+    json stats() const;
     void save();
     void load();
+    void discard();
+    bool is_discarded() const;
+    bool partitioned() const;
 
 private:
-    std::string dbpath, collname, collfile, indexdir;
-    HashMap<json> store;
+    std::string dbpath, collname, collfile, segfile, indexdir, walfile, catalogfile, metafile;
+    CollectionOptions options;
+    std::unique_ptr<PartitionSet> partitions;
+    bool discarded = false;
+    std::unique_ptr<StorageEngine> store;
+    std::unique_ptr<WriteAheadLog> wal;
+    size_t checkpoint_wal_bytes;
+
+    std::thread checkpoint_thread;
+    std::atomic<bool> checkpoint_running{false};
+    mutable std::mutex checkpoint_mutex;
+    CheckpointStats checkpoint_stats;
+    TtlStats ttl_stats;
+    Vector<IndexFileEntry> index_files;
+    // Changes to the hash ("hash:<field>") and B-tree ("btree:<field>")
+    // indexes since the last checkpoint, written out as its delta files.
+    HashMap<Vector<IndexChange>> index_changes;
+    // Pre-catalog index files read at load, deleted by the first checkpoint.
+    Vector<std::string> legacy_index_files;
+    bool rewrite_all_indexes = false;
+    HashMap<bool> dirty_indexes;
 
     HashMap<HashMap<Vector<std::string>>> indexes;
     HashMap<BTreeIndex> btree_indexes;
+    HashMap<OrderedIndex> ordered_indexes;
+    HashMap<TrigramIndex> trigram_indexes;
+    HashMap<TextIndex> text_indexes;
+    BitmapIndex bitmaps;
+    HashMap<TtlIndex> ttl_indexes;
+    BlockIndex blocks;
+    // The block index a checkpoint rebuilt densely from its snapshot, to be
+    // swapped in under the write lock (guarded by checkpoint_mutex), and the
+    // documents written since that snapshot, which it has yet to catch up on.
+    std::shared_ptr<BlockIndex> rebuilt_blocks;
+    HashMap<bool> blocks_changed;
+    bool tracking_block_changes = false;
+    // Filters of the partial indexes, keyed by "<type>:<field or spec>".
+    HashMap<json> index_filters;
+    std::shared_ptr<IndexBuild> pending_build;
 
     static std::string index_key_for_value(const json &v);
-    void save_index(const std::string &field);
+    void apply_insert(const std::string &id, const json &doc);
+    bool apply_delete(const std::string &id);
+    void index_document(const std::string &id, const json &doc);
+    void unindex_document(const std::string &id, const json &doc);
+    bool indexed_by(const std::string &type, const std::string &name, const json &doc) const;
+    bool filter_implied(const std::string &type, const std::string &name, const json &context) const;
+    bool field_candidates(const std::string &field, const json &cond, Vector<std::string> &ids,
+                          const json &context);
+    bool index_candidates(const json &query, Vector<std::string> &ids, const json &context);
+    std::function<void()> prepare_checkpoint();
+    void wait_for_checkpoint();
+    void build_index(const std::string &spec, const json &filter = json());
+    void record_for_build(const std::string &id, const json &before);
+    void publish_index_build(IndexBuild &build);
+    void rebuild_index(const IndexFileEntry &entry);
+    static HashMap<Vector<std::string>> build_hash_index(const std::string &field, const StorageSnapshot &snap);
+    static BTreeIndex build_btree_index(const std::string &field, const StorageSnapshot &snap, int fanout = 0);
+    static OrderedIndex build_ordered_index(const std::string &spec, const StorageSnapshot &snap);
+    static TrigramIndex build_trigram_index(const std::string &field, const StorageSnapshot &snap);
+    static TextIndex build_text_index(const std::string &field, const StorageSnapshot &snap);
+    static BitmapIndex build_bitmap_index(const std::string &spec, const StorageSnapshot &snap);
+    static TtlIndex build_ttl_index(const std::string &field, int64_t expire_after, const StorageSnapshot &snap);
+    static BlockIndex build_block_index(const std::string &spec, const StorageSnapshot &snap);
+    void write_index_file(const IndexFileEntry &entry, const StorageSnapshot &snap,
+                          std::shared_ptr<BlockIndex> *rebuilt = nullptr) const;
+    void install_rebuilt_blocks();
+    void read_index_file(const IndexFileEntry &entry);
+    void write_index_delta(const std::string &file, const Vector<IndexChange> &changes) const;
+    void read_index_delta(const IndexFileEntry &entry, const std::string &file);
+    void write_catalog(uint64_t lsn, const Vector<IndexFileEntry> &entries) const;
+    void remove_index_files(const Vector<std::string> &files) const;
+    void load_indexes();
+    void convert_legacy_file();
+    void load_options(const CollectionOptions &requested);
+    std::unique_ptr<StorageEngine> make_engine() const;
 };
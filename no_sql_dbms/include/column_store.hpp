@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <memory>
+#include "hash_map.hpp"
+#include "storage_engine.hpp"
+
+struct ColumnSpec {
+    std::string name;
+    std::string type;
+};
+
+// Column layout for event-style collections. Each field of the schema is
+// stored in its own array: "dict" fields as codes into a per-column
+// dictionary, "number" fields as 64-bit values and "blob" fields as raw
+// strings, so counts and filters read only the columns they reference.
+// Fields outside the schema, or values of another type, are kept per row
+// as msgpack.
+//
+// Rows live in fixed-size chunks held by shared_ptr, as in DocStore: a
+// snapshot copies the chunk list and a later write clones only the chunk
+// (or dictionary) it touches.
+//
+// File format (version 1), all sections in row order over live rows:
+//   header  "NSQLCOL1" u32 version u32 column_count u64 rows u64 lsn
+//   schema  column_count x [u32 len][name][u8 type]
+//   ids     rows x [u32 len][id]
+//   columns dict:   u32 size, size x [u32 len][value], rows x u8 present, rows x u32 code
+//           number: rows x u8 kind, rows x u64 value
+//           blob:   rows x u8 present, rows x [u32 len][value]
+//   extras  rows x [u32 len][msgpack]
+class ColumnStore : public StorageEngine {
+public:
+    explicit ColumnStore(const Vector<ColumnSpec> &schema);
+
+    void put(const std::string &id, const json &doc) override;
+    bool get(const std::string &id, json &out) const override;
+    bool contains(const std::string &id) const override;
+    bool remove(const std::string &id) override;
+    void for_each(const Visitor &fn) const override;
+    size_t size() const override;
+
+    std::shared_ptr<StorageSnapshot> snapshot() const override;
+    void load(const std::string &path) override;
+    uint64_t checkpoint_lsn() const override;
+    std::string file_extension() const override;
+
+    bool count_by(const json &query, const std::string &field, const std::string &bucket,
+                  HashMap<uint64_t> &counts) const override;
+    json stats() const override;
+
+    static bool valid_type(const std::string &type);
+    // Parses "field=type,field=type,...".
+    static Vector<ColumnSpec> parse_schema(const std::string &spec);
+
+private:
+    static const size_t CHUNK_ROWS = 4096;
+
+    enum NumberKind : uint8_t { NUM_MISSING = 0, NUM_FLOAT = 1, NUM_INT = 2, NUM_UINT = 3 };
+
+    struct Column {
+        Vector<uint8_t> present;
+        Vector<uint32_t> codes;
+        Vector<uint64_t> bits;
+        std::string arena;
+        Vector<uint64_t> ends;
+    };
+
+    struct Chunk {
+        Vector<std::string> ids;
+        Vector<uint8_t> live;
+        Vector<Column> columns;
+        Vector<std::string> extras;
+    };
+
+    struct Dictionary {
+        Vector<std::string> values;
+        HashMap<uint32_t> codes;
+    };
+
+    struct State {
+        Vector<ColumnSpec> schema;
+        Vector<std::shared_ptr<Chunk>> chunks;
+        Vector<std::shared_ptr<Dictionary>> dictionaries;
+        size_t live_rows = 0;
+    };
+
+    class Snapshot : public StorageSnapshot {
+    public:
+        size_t size() const override;
+        void for_each(const Visitor &fn) const override;
+        void write(const std::string &path, uint64_t lsn) const override;
+
+    private:
+        friend class ColumnStore;
+        std::shared_ptr<const State> state;
+    };
+
+    std::shared_ptr<State> state;
+    HashMap<uint64_t> rows;
+    uint64_t loaded_lsn;
+
+    int column_index(const std::string &name) const;
+    Chunk& writable_chunk(size_t idx);
+    Dictionary& writable_dictionary(size_t col);
+    static json value(const State &st, const Chunk &chunk, size_t col, size_t row);
+    static json extra_fields(const Chunk &chunk, size_t row);
+    static json decode(const State &st, const Chunk &chunk, size_t row);
+    static void visit(const State &st, const Visitor &fn);
+};
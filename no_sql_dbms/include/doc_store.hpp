@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include "hash_map.hpp"
+#include "segment.hpp"
+#include "storage_engine.hpp"
+
+// id -> document map. Documents loaded from a segment stay in the mapped
+// file and are decoded on access; new and updated documents live in memory
+// as shared immutable nodes.
+//
+// The bucket table is split into chunks held by shared_ptr, so snapshot()
+// only copies one pointer. A write after a snapshot copies the chunk
+// directory and then each chunk it touches (copy-on-write), leaving the
+// snapshot's view unchanged.
+class DocStore : public StorageEngine {
+public:
+    using Pair = std::pair<std::string, json>;
+    using DocPtr = std::shared_ptr<const json>;
+
+private:
+    struct Entry {
+        std::string id;
+        int64_t slot = -1;
+        DocPtr doc;
+    };
+
+    static const size_t CHUNK_BUCKETS = 256;
+
+    struct Chunk {
+        Vector<Entry> buckets[CHUNK_BUCKETS];
+    };
+
+    struct Table {
+        Vector<std::shared_ptr<Chunk>> chunks;
+        size_t size = 0;
+    };
+
+public:
+    class Snapshot : public StorageSnapshot {
+    public:
+        size_t size() const override;
+        void for_each(const Visitor &fn) const override;
+        void write(const std::string &path, uint64_t lsn) const override;
+
+    private:
+        friend class DocStore;
+        std::shared_ptr<const Table> table;
+        std::shared_ptr<Segment> segment;
+    };
+
+    DocStore();
+
+    void put(const std::string &id, const json &doc) override;
+    bool get(const std::string &id, json &out) const override;
+    bool contains(const std::string &id) const override;
+    bool remove(const std::string &id) override;
+    Vector<Pair> items() const;
+    void for_each(const Visitor &fn) const override;
+    size_t size() const override;
+    void clear();
+
+    std::shared_ptr<StorageSnapshot> snapshot() const override;
+    void load(const std::string &path) override;
+    uint64_t checkpoint_lsn() const override;
+    std::string file_extension() const override;
+    void load_segment(const std::string &path);
+    void write_segment(const std::string &path, uint64_t lsn) const;
+
+private:
+    std::shared_ptr<Table> table;
+    std::shared_ptr<Segment> segment;
+
+    static size_t bucket_count(const Table &t);
+    static size_t bucket_index(const Table &t, const std::string &id);
+    static const Vector<Entry>& bucket(const Table &t, size_t idx);
+    static void visit(const Table &t, const Segment *seg, const Visitor &fn);
+    const Entry* find(const std::string &id) const;
+    Vector<Entry>& writable_bucket(size_t idx);
+    void insert_entry(Entry e);
+    void rehash(size_t chunk_count);
+};
@@ -16,7 +16,14 @@ public:
     void put(const std::string &key, const V &value);
     bool get(const std::string &key, V &out) const;
     bool remove(const std::string &key);
+    // Pointers and references stay valid until the next insertion of a
+    // new key or removal.
+    V* find(const std::string &key);
+    const V* find(const std::string &key) const;
+    V& find_or_insert(const std::string &key);
+    template<typename Fn> void for_each(Fn fn);
     Vector<Pair> items() const;
+    Vector<std::string> keys() const;
     size_t size() const;
     json to_json() const;
     void from_json(const json &j);
@@ -60,6 +67,42 @@ bool HashMap<V>::get(const std::string &key, V &out) const {
     return false;
 }
 
+template<typename V>
+V* HashMap<V>::find(const std::string &key) {
+    if (buckets.size() == 0) return nullptr;
+    for (auto &p : buckets[bucket_index(key)]) {
+        if (p.first == key) return &p.second;
+    }
+    return nullptr;
+}
+
+template<typename V>
+const V* HashMap<V>::find(const std::string &key) const {
+    return const_cast<HashMap<V>*>(this)->find(key);
+}
+
+template<typename V>
+V& HashMap<V>::find_or_insert(const std::string &key) {
+    V *found = find(key);
+    if (found) return *found;
+    if (buckets.size() == 0 || (double)(size_ + 1) / buckets.size() > max_load_factor) {
+        rehash(buckets.size() == 0 ? 16 : buckets.size() * 2);
+    }
+    auto &chain = buckets[bucket_index(key)];
+    chain.emplace_back(key, V());
+    ++size_;
+    return chain.back().second;
+}
+
+// Calls fn(key, value) for every entry; values may be modified in place.
+template<typename V>
+template<typename Fn>
+void HashMap<V>::for_each(Fn fn) {
+    for (auto &chain : buckets) {
+        for (auto &p : chain) fn(p.first, p.second);
+    }
+}
+
 template<typename V>
 bool HashMap<V>::remove(const std::string &key) {
     if (buckets.size() == 0) return false;
@@ -70,7 +113,7 @@ bool HashMap<V>::remove(const std::string &key) {
     for (size_t i = 0; i < chain.size(); ++i) {
         if (chain[i].first == key) {
             for (size_t j = i; j < chain.size() - 1; ++j) {
-                chain[j] = chain[j + 1];
+                chain[j] = std::move(chain[j + 1]);
             }
             chain.pop_back();
             --size_;
@@ -91,6 +134,15 @@ Vector<typename HashMap<V>::Pair> HashMap<V>::items() const {
     return res;
 }
 
+template<typename V>
+Vector<std::string> HashMap<V>::keys() const {
+    Vector<std::string> res;
+    for (const auto &chain : buckets) {
+        for (const auto &p : chain) res.push_back(p.first);
+    }
+    return res;
+}
+
 template<typename V>
 size_t HashMap<V>::size() const { return size_; }
 
@@ -137,12 +189,12 @@ size_t HashMap<V>::bucket_index(const std::string &key) const {
 template<typename V>
 void HashMap<V>::rehash(size_t new_buckets) {
     Vector<Vector<Pair>> new_table(new_buckets);
-    for (const auto &chain : buckets) {
-        for (const auto &p : chain) {
+    for (auto &chain : buckets) {
+        for (auto &p : chain) {
             uint64_t h = str_hash(p.first);
             size_t idx = (size_t)(h % new_buckets);
-            new_table[idx].push_back(p);
+            new_table[idx].push_back(std::move(p));
         }
     }
-    buckets = new_table;
+    buckets = std::move(new_table);
 }
@@ -0,0 +1,118 @@
+#pragma once
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include "vector.hpp"
+#include "sorted_run.hpp"
+#include "storage_engine.hpp"
+
+// Log-structured document store for insert-heavy collections. Writes go to
+// a sorted in-memory memtable; snapshot() freezes it and the checkpoint
+// writes the frozen memtables as one sorted run (<name>.<seq>.run) into
+// level 0, then replaces the manifest <name>.lsm. A background thread
+// merges level 0 into level 1 and each level into the next once it grows
+// past its size budget (leveled compaction), so levels 1+ hold runs with
+// disjoint id ranges. Every run carries a bloom filter, which keeps the
+// existence check done on each insert from reading the runs.
+//
+// Manifest: {"lsn", "count", "next_run", "levels": [[seq, ...], ...]}.
+// Run files not listed in it are leftovers of an interrupted flush or
+// compaction and are removed on open.
+class LsmStore : public StorageEngine {
+public:
+    explicit LsmStore(const std::string &base_path);
+    ~LsmStore();
+    LsmStore(const LsmStore&) = delete;
+    LsmStore& operator=(const LsmStore&) = delete;
+
+    void put(const std::string &id, const json &doc) override;
+    bool get(const std::string &id, json &out) const override;
+    bool contains(const std::string &id) const override;
+    bool remove(const std::string &id) override;
+    void for_each(const Visitor &fn) const override;
+    size_t size() const override;
+
+    std::shared_ptr<StorageSnapshot> snapshot() const override;
+    void load(const std::string &path) override;
+    uint64_t checkpoint_lsn() const override;
+    std::string file_extension() const override;
+    json stats() const override;
+
+private:
+    static const size_t LEVELS = 7;
+
+    struct Value {
+        bool deleted = false;
+        std::string body;
+    };
+    using Memtable = std::map<std::string, Value>;
+    using RunPtr = std::shared_ptr<SortedRun>;
+
+    struct Version {
+        Vector<RunPtr> levels[LEVELS];
+    };
+
+    // State shared with snapshots and the compaction thread. `mtx` guards
+    // the frozen memtables and the current version; `manifest_mtx`
+    // serializes installing a new version with writing its manifest.
+    struct Tree {
+        std::string base;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stop = false;
+        bool work = false;
+        Vector<std::shared_ptr<const Memtable>> frozen;
+        std::shared_ptr<const Version> version;
+        uint64_t next_run = 1;
+        std::string compact_pointer[LEVELS];
+
+        std::mutex manifest_mtx;
+        uint64_t durable_lsn = 0;
+        uint64_t durable_count = 0;
+
+        uint64_t flushes = 0, compactions = 0;
+        uint64_t bytes_flushed = 0, bytes_compacted = 0;
+
+        std::string run_path(uint64_t seq) const;
+        void write_manifest(const std::string &path, const Version &v, uint64_t next) const;
+    };
+
+    class Snapshot : public StorageSnapshot {
+    public:
+        size_t size() const override;
+        void for_each(const Visitor &fn) const override;
+        void write(const std::string &path, uint64_t lsn) const override;
+
+    private:
+        friend class LsmStore;
+        std::shared_ptr<Tree> tree;
+        Vector<std::shared_ptr<const Memtable>> frozen;
+        std::shared_ptr<const Version> version;
+        size_t count = 0;
+    };
+
+    using RecordFn = std::function<void(const std::string&, bool, const uint8_t*, size_t)>;
+
+    std::shared_ptr<Tree> tree;
+    // Written only under the collection's exclusive lock; snapshot()
+    // swaps it for an empty one.
+    mutable std::shared_ptr<Memtable> active;
+    size_t count;
+    mutable size_t active_bytes;
+    uint64_t loaded_lsn;
+    std::thread compactor;
+
+    bool lookup(const std::string &id, Value &out) const;
+    // Sources are ordered newest first: memtables, then run groups whose
+    // runs are disjoint and sorted (one per level 0 run, one per level).
+    static void merge(const Vector<const Memtable*> &memtables, const Vector<Vector<RunPtr>> &groups,
+                      bool keep_deleted, const RecordFn &fn);
+    static Vector<Vector<RunPtr>> groups_of(const Version &v);
+    static void remove_unlisted(const std::string &base, const Vector<uint64_t> &keep);
+    static void compaction_loop(std::shared_ptr<Tree> tree);
+    static bool compact_once(Tree &tree);
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <map>
+#include <string>
+#include "vector.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Ordered index over one or more fields, e.g. "event_type,timestamp". The
+// key of a document is its field values encoded so that byte order matches
+// value order (null < booleans < numbers < strings), concatenated in field
+// order. Equality on a prefix of the fields, optionally followed by a range
+// ($gt, $gte, $lt, $lte, $prefix) on the next field, is then one contiguous
+// key range; $in on that field is one range per value.
+class OrderedIndex {
+public:
+    OrderedIndex();
+    explicit OrderedIndex(const std::string &spec);
+
+    const std::string& spec() const;
+    void insert(const json &doc, const std::string &id);
+    void remove(const json &doc, const std::string &id);
+
+    // Number of leading fields the query constrains in a way the index can
+    // serve; 0 when it cannot be used.
+    size_t usable_fields(const json &query) const;
+    // Ids of the documents in the key range the query selects. Conditions
+    // the index does not cover still have to be checked on the documents.
+    Vector<std::string> lookup(const json &query) const;
+
+    size_t size() const;
+    json to_json() const;
+    void from_json(const json &j);
+
+private:
+    std::string fields_spec;
+    Vector<std::string> fields;
+    std::map<std::string, Vector<std::string>> entries;
+
+    bool key_for(const json &doc, std::string &key) const;
+    size_t plan(const json &query, std::string &prefix, const json *&range) const;
+    void scan(const std::string &scan_prefix, const std::string &start,
+              const std::string *low, bool include_low,
+              const std::string *high, bool include_high, Vector<std::string> &ids) const;
+    static void encode(const json &value, std::string &out);
+};
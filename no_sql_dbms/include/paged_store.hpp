@@ -0,0 +1,140 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "hash_map.hpp"
+#include "vector.hpp"
+#include "storage_engine.hpp"
+
+// Disk-resident document store for collections larger than memory.
+// Documents live in PAGE_SIZE slotted pages of <name>.pdata and are read
+// through a fixed pool of frames with clock eviction; only the id -> slot
+// directory stays in memory. Documents that do not fit a quarter page are
+// moved to a chain of overflow pages.
+//
+// Pages are addressed by logical number. A dirty page is written back to a
+// physical page that no checkpoint references (shadow paging), and a
+// checkpoint flushes the pool and atomically replaces <name>.pmap, the
+// logical -> physical map. After a crash the store therefore reopens
+// exactly as of the last checkpoint and the WAL is replayed on top.
+// Physical pages superseded since the previous map are reused only once
+// the next map is durable.
+//
+// Page layout: 24-byte header (crc32, type, overflow link, slot count,
+// start of record area, deleted bytes, overflow payload size), then u16
+// offset/length slots growing up and records growing down from the end.
+// Record: [u8 flags][u16 id_len][id][msgpack], or [u32 first][u32 size]
+// in place of the msgpack when it is stored in overflow pages.
+//
+// Map file (version 1):
+//   header  "NSQLPGM1" u32 version u32 page_size u64 lsn u64 count u32 pages
+//   pages   pages x u32 physical page, pages x u8 page type
+//   crc     u32 crc32 of everything before it
+class PagedStore : public StorageEngine {
+public:
+    static const size_t PAGE_SIZE = 16384;
+
+    PagedStore(const std::string &base_path, size_t cache_bytes);
+    ~PagedStore();
+    PagedStore(const PagedStore&) = delete;
+    PagedStore& operator=(const PagedStore&) = delete;
+
+    void put(const std::string &id, const json &doc) override;
+    bool get(const std::string &id, json &out) const override;
+    bool contains(const std::string &id) const override;
+    bool remove(const std::string &id) override;
+    void for_each(const Visitor &fn) const override;
+    size_t size() const override;
+
+    std::shared_ptr<StorageSnapshot> snapshot() const override;
+    void load(const std::string &path) override;
+    uint64_t checkpoint_lsn() const override;
+    std::string file_extension() const override;
+    json stats() const override;
+
+private:
+    static const uint32_t NO_PAGE = 0xFFFFFFFF;
+
+    struct Frame {
+        uint32_t page = NO_PAGE;
+        uint32_t pins = 0;
+        bool dirty = false;
+        bool referenced = false;
+    };
+
+    // Physical space of the data file, shared with snapshots that are
+    // written after the store's lock is released.
+    struct DataFile {
+        int fd = -1;
+        std::mutex mtx;
+        uint32_t end_page = 0;
+        Vector<uint32_t> free_pages;
+        Vector<std::pair<uint64_t, uint32_t>> retired;
+        uint64_t retire_seq = 0;
+
+        ~DataFile();
+        uint32_t allocate();
+        void release(uint32_t phys);
+        void retire(uint32_t phys);
+        uint64_t mark();
+        void release_retired(uint64_t upto);
+    };
+
+    class Snapshot : public StorageSnapshot {
+    public:
+        size_t size() const override;
+        void for_each(const Visitor &fn) const override;
+        void write(const std::string &path, uint64_t lsn) const override;
+
+    private:
+        friend class PagedStore;
+        std::shared_ptr<DataFile> file;
+        Vector<uint32_t> map;
+        Vector<uint8_t> kinds;
+        size_t count = 0;
+        uint64_t release_upto = 0;
+
+        std::string read_overflow(uint32_t first, uint32_t total) const;
+    };
+
+    std::string data_path;
+    std::shared_ptr<DataFile> file;
+    uint64_t loaded_lsn;
+
+    // Buffer pool. get() and for_each() run concurrently under the
+    // collection's shared lock, so every pool access takes `mtx`; a page
+    // evicted by a read may be written back, which also moves it in
+    // page_map.
+    mutable std::mutex mtx;
+    mutable Vector<Frame> frames;
+    std::unique_ptr<uint8_t[]> memory;
+    mutable Vector<uint32_t> frame_of;
+    mutable size_t hand;
+    mutable Vector<uint32_t> page_map;
+    mutable Vector<uint32_t> page_epoch;
+    mutable uint32_t epoch;
+    mutable uint64_t hits, misses, evictions, writebacks;
+
+    Vector<uint8_t> page_kind;
+    Vector<uint16_t> free_space;
+    Vector<uint32_t> free_logical;
+    Vector<uint32_t> candidates;
+    uint32_t fill_page;
+    HashMap<uint64_t> directory;
+
+    uint8_t* frame_data(size_t f) const;
+    size_t pin(uint32_t page, bool fresh = false) const;
+    void unpin(size_t f, bool dirty) const;
+    size_t victim() const;
+    void write_back(size_t f) const;
+    void flush_all() const;
+
+    uint32_t new_page(uint8_t kind);
+    void free_page(uint32_t page);
+    void update_free_space(uint32_t page, const uint8_t *p);
+    uint32_t page_for(size_t len);
+    std::string read_body(const uint8_t *rec, size_t len) const;
+    void erase_locked(uint64_t loc);
+    void reset_pool();
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include "hash_map.hpp"
+#include "vector.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+class Collection;
+struct CollectionOptions;
+
+// Time-partitioned storage for one collection. Every partition is a plain
+// Collection in <db>/<name>.parts/<key>/, where the key is the ISO-8601
+// prefix of the partition field ("2026-10-16" for daily partitions).
+// Partitions are opened on first use; queries with a range on the
+// partition field only open the partitions that can match. Documents
+// without a usable timestamp go to the UNDATED partition, which every
+// query reads and retention never drops.
+class PartitionSet {
+public:
+    PartitionSet(const std::string &db_path, const std::string &name, const CollectionOptions &options);
+    ~PartitionSet();
+
+    std::string insert(json doc);
+    void restore(const json &doc);
+    Vector<json> find(const json &query);
+    json count(const json &query, const std::string &group_by, const std::string &bucket);
+    int remove(const json &query);
+    Vector<std::shared_ptr<Collection>> add_index(const std::string &field, const json &filter = json());
+    Vector<std::string> index_fields() const;
+    json index_filter(const std::string &field) const;
+    void commit();
+    void wait_durable();
+    void checkpoint_if_needed();
+    void set_commit_delay(std::chrono::microseconds delay);
+    void set_checkpoint_wal_bytes(size_t bytes);
+    json stats() const;
+    void save();
+
+    static bool valid_granularity(const std::string &granularity);
+    static const char *const UNDATED;
+
+private:
+    std::string dbpath, collname, partsdir, indexfile;
+    std::string field, granularity;
+    std::unique_ptr<CollectionOptions> child_options;
+    int retention_days;
+    std::chrono::microseconds commit_delay{0};
+    size_t checkpoint_wal_bytes;
+    std::chrono::steady_clock::time_point last_retention;
+
+    mutable std::mutex mtx;
+    Vector<std::string> keys;
+    HashMap<std::shared_ptr<Collection>> open_partitions;
+    Vector<std::string> indexed_fields;
+    // Filters of the partial indexes among indexed_fields.
+    HashMap<json> index_filters;
+
+    size_t key_length() const;
+    std::string key_for_time(std::time_t t) const;
+    std::string key_for(const json &doc) const;
+    Vector<std::string> keys_for_query(const json &query) const;
+    std::shared_ptr<Collection> partition(const std::string &key, bool create);
+    Vector<std::shared_ptr<Collection>> opened() const;
+    size_t drop_expired_locked();
+    void save_index_fields() const;
+};
@@ -6,6 +6,12 @@
 using json = nlohmann::json;
 
 bool match_like(const std::string &value, const std::string &pattern);
+void text_tokens(const std::string &text, Vector<std::string> &tokens);
+bool match_text(const std::string &value, const json &terms);
 bool value_eq(const json &a, const json &b);
 bool evaluate_condition_on_field(const json &doc, const std::string &field, const json &cond);
 bool evaluate_query(const json &doc, const json &query);
+// True when every document matching `query` is known to match `filter`.
+// Conservative: false means "not proven", not "does not imply".
+bool query_implies(const json &query, const json &filter);
+std::string group_key(const json &value, const std::string &bucket);
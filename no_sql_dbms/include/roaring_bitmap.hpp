@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "vector.hpp"
+
+// Compressed set of 32-bit row numbers. Rows are grouped by their high 16
+// bits; a group with up to 4096 members is a sorted array of the low bits,
+// a fuller one a 65536-bit bitset. Bitset operations work on 64-bit words
+// and counts use popcount, so combining dense sets costs 1024 word
+// operations per 65536 rows.
+class RoaringBitmap {
+public:
+    void add(uint32_t row);
+    void remove(uint32_t row);
+    bool contains(uint32_t row) const;
+    bool empty() const;
+    uint64_t cardinality() const;
+    // Size of the intersection, without building it.
+    uint64_t and_cardinality(const RoaringBitmap &other) const;
+
+    RoaringBitmap& operator&=(const RoaringBitmap &other);
+    RoaringBitmap& operator|=(const RoaringBitmap &other);
+    RoaringBitmap& operator-=(const RoaringBitmap &other);
+
+    template<typename Fn>
+    void for_each(Fn fn) const {
+        for (const auto &c : containers) {
+            uint32_t high = (uint32_t)c.key << 16;
+            if (c.bits.empty()) {
+                for (uint16_t low : c.array) fn(high | low);
+                continue;
+            }
+            for (size_t w = 0; w < c.bits.size(); ++w) {
+                uint64_t word = c.bits[w];
+                while (word) {
+                    fn(high | (uint32_t)(w * 64 + __builtin_ctzll(word)));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    void serialize(std::string &out) const;
+    void deserialize(const std::string &in);
+
+private:
+    struct Container {
+        uint16_t key = 0;
+        uint32_t card = 0;
+        Vector<uint16_t> array;
+        Vector<uint64_t> bits;
+    };
+
+    Vector<Container> containers;
+
+    size_t find_container(uint16_t key) const;
+    static void to_bitset(Container &c);
+    static void normalize(Container &c);
+    static bool test(const Container &c, uint16_t low);
+    static uint32_t and_count(const Container &a, const Container &b);
+    static Container and_of(const Container &a, const Container &b);
+    static Container or_of(const Container &a, const Container &b);
+    static Container andnot_of(const Container &a, const Container &b);
+};
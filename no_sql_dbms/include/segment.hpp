@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Binary collection snapshot (version 1):
+//   header  "NSQLSEG1" u32 version u32 reserved u64 count u64 lsn u64 table_offset
+//   records [u32 id_len][id][u32 body_len][msgpack document]...
+//   table   count x u64 record offsets, followed by u32 crc32 of the table
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t lsn;
+    uint64_t table_offset;
+};
+
+// Read-only, memory-mapped segment. Documents are decoded on access.
+class Segment {
+public:
+    explicit Segment(const std::string &path);
+    ~Segment();
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    size_t count() const;
+    uint64_t lsn() const;
+    std::string id(size_t slot) const;
+    json document(size_t slot) const;
+    const uint8_t* raw_document(size_t slot, size_t &len) const;
+
+private:
+    std::string path;
+    const uint8_t *base;
+    size_t length;
+    const SegmentHeader *header;
+    const uint64_t *table;
+
+    const uint8_t* record(size_t slot) const;
+};
+
+class SegmentWriter {
+public:
+    SegmentWriter(const std::string &path, uint64_t lsn);
+    ~SegmentWriter();
+
+    void add(const std::string &id, const json &doc);
+    void add_raw(const std::string &id, const uint8_t *body, size_t len);
+    void finish();
+
+private:
+    std::string path, tmp_path;
+    int fd;
+    uint64_t lsn;
+    uint64_t offset;
+    std::string buffer;
+    std::string table;
+    uint64_t count;
+
+    void flush_buffer();
+};
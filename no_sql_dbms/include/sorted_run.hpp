@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "vector.hpp"
+
+// Immutable sorted run of the LSM engine (version 1):
+//   header  "NSQLRUN1" u32 version u32 bloom_hashes u64 count u64 index_offset
+//           u64 bloom_offset u64 bloom_bits
+//   records [u32 id_len][id][u8 flags][u32 body_len][msgpack]... in id order,
+//           flags bit 0 marks a deletion
+//   index   every RUN_INDEX_INTERVAL-th record: [u32 id_len][id][u64 offset]
+//   bloom   bit array over every id, followed by u32 crc32 of index and bloom
+struct RunHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bloom_hashes;
+    uint64_t count;
+    uint64_t index_offset;
+    uint64_t bloom_offset;
+    uint64_t bloom_bits;
+};
+
+// Read-only, memory-mapped run. A run marked obsolete by compaction removes
+// its file once the last reader drops it.
+class SortedRun {
+public:
+    SortedRun(const std::string &path, uint64_t seq);
+    ~SortedRun();
+    SortedRun(const SortedRun&) = delete;
+    SortedRun& operator=(const SortedRun&) = delete;
+
+    // Positioned on a record; walks the run in id order.
+    class Cursor {
+    public:
+        explicit Cursor(const SortedRun &run, uint64_t start = 0);
+        bool valid() const;
+        void next();
+        const std::string& id() const;
+        bool deleted() const;
+        const uint8_t* body() const;
+        size_t body_len() const;
+
+    private:
+        const SortedRun *run;
+        uint64_t offset;
+        std::string cur_id;
+        bool cur_deleted;
+        const uint8_t *cur_body;
+        size_t cur_len;
+
+        void read();
+    };
+
+    // Returns false when the id is not in this run; a deletion is found
+    // with deleted set.
+    bool get(const std::string &id, uint64_t hash, bool &deleted, std::string &body) const;
+
+    uint64_t seq() const;
+    uint64_t count() const;
+    size_t bytes() const;
+    const std::string& min_key() const;
+    const std::string& max_key() const;
+    void mark_obsolete();
+
+private:
+    std::string path;
+    uint64_t run_seq;
+    const uint8_t *base;
+    size_t length;
+    const RunHeader *header;
+    Vector<std::pair<std::string, uint64_t>> index;
+    std::string first, last;
+    std::atomic<bool> obsolete;
+};
+
+class SortedRunWriter {
+public:
+    explicit SortedRunWriter(const std::string &path);
+    ~SortedRunWriter();
+
+    void add(const std::string &id, bool deleted, const uint8_t *body, size_t len);
+    void finish();
+    size_t bytes() const;
+    uint64_t count() const;
+
+private:
+    std::string path, tmp_path;
+    int fd;
+    uint64_t offset;
+    uint64_t records;
+    std::string buffer;
+    std::string index;
+    Vector<uint64_t> hashes;
+
+    void flush_buffer();
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "hash_map.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Point-in-time view of an engine, taken under the collection's write lock
+// and then read by the background checkpoint without any lock.
+class StorageSnapshot {
+public:
+    using Visitor = std::function<void(const std::string&, const json&)>;
+
+    virtual ~StorageSnapshot() = default;
+    virtual size_t size() const = 0;
+    virtual void for_each(const Visitor &fn) const = 0;
+    virtual void write(const std::string &path, uint64_t lsn) const = 0;
+};
+
+// Document storage behind a Collection. Engines own their checkpoint file
+// format; indexes and the WAL stay in Collection.
+class StorageEngine {
+public:
+    using Visitor = StorageSnapshot::Visitor;
+
+    virtual ~StorageEngine() = default;
+
+    virtual void put(const std::string &id, const json &doc) = 0;
+    virtual bool get(const std::string &id, json &out) const = 0;
+    virtual bool contains(const std::string &id) const = 0;
+    virtual bool remove(const std::string &id) = 0;
+    virtual void for_each(const Visitor &fn) const = 0;
+    virtual size_t size() const = 0;
+
+    virtual std::shared_ptr<StorageSnapshot> snapshot() const = 0;
+    virtual void load(const std::string &path) = 0;
+    virtual uint64_t checkpoint_lsn() const = 0;
+    virtual std::string file_extension() const = 0;
+
+    // Counts documents matching `query` grouped by group_key(field, bucket).
+    // Returns false when the engine cannot do better than decoding every
+    // matching document, in which case the collection does it.
+    virtual bool count_by(const json &query, const std::string &field, const std::string &bucket,
+                          HashMap<uint64_t> &counts) const {
+        (void)query; (void)field; (void)bucket; (void)counts;
+        return false;
+    }
+
+    virtual json stats() const { return json::object(); }
+};
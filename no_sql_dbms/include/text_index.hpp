@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "vector.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Inverted index over the tokens of one string field (see text_tokens).
+// Documents get increasing slot numbers, so each term's posting list is
+// appended in order and stored as varint-encoded gaps. Removed slots are
+// only marked; the lists are rewritten without them once they make up half
+// of the slots.
+class TextIndex {
+public:
+    TextIndex();
+    explicit TextIndex(const std::string &field);
+
+    const std::string& field() const;
+    void insert(const json &doc, const std::string &id);
+    void remove(const json &doc, const std::string &id);
+
+    bool usable(const json &query) const;
+    // Ids of the documents matching the $text condition of the query.
+    Vector<std::string> lookup(const json &query) const;
+
+    size_t size() const;
+    size_t posting_bytes() const;
+    json to_json() const;
+    void from_json(const json &j);
+
+private:
+    struct Posting {
+        std::string bytes;
+        uint32_t last = 0;
+        uint32_t count = 0;
+    };
+
+    std::string field_name;
+    Vector<std::string> ids;
+    Vector<char> dead;
+    size_t dead_count = 0;
+    std::unordered_map<std::string, uint32_t> slots;
+    std::unordered_map<std::string, Posting> postings;
+
+    static void append(Posting &posting, uint32_t slot);
+    static void decode(const Posting &posting, Vector<uint32_t> &out);
+    void match_all(const std::string &terms, Vector<uint32_t> &out) const;
+    void compact();
+};
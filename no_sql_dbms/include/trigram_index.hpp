@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "vector.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Substring index over one string field. Every document gets a slot number
+// and each trigram of the lower-cased value maps to the sorted list of slots
+// containing it. A $like pattern needs all trigrams of its literal runs, so
+// intersecting their lists yields a superset of the matches that is then
+// verified with match_like.
+class TrigramIndex {
+public:
+    TrigramIndex();
+    explicit TrigramIndex(const std::string &field);
+
+    const std::string& field() const;
+    void insert(const json &doc, const std::string &id);
+    void remove(const json &doc, const std::string &id);
+
+    // True when the query has a $like on the field with at least one
+    // trigram in it.
+    bool usable(const json &query) const;
+    // Candidate ids for the $like condition of the query.
+    Vector<std::string> lookup(const json &query) const;
+
+    size_t size() const;
+    json to_json() const;
+    void from_json(const json &j);
+
+private:
+    std::string field_name;
+    // Removed documents leave an empty id behind until the next compaction.
+    Vector<std::string> ids;
+    size_t dead_count = 0;
+    std::unordered_map<std::string, uint32_t> slots;
+    std::unordered_map<uint32_t, Vector<uint32_t>> postings;
+
+    const std::string* pattern_of(const json &query) const;
+    void compact();
+    static void trigrams_of(const std::string &value, Vector<uint32_t> &out);
+    static void pattern_trigrams(const std::string &pattern, Vector<uint32_t> &out);
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+#include "vector.hpp"
+#include "../parcer/json.hpp"
+
+using json = nlohmann::json;
+
+// Expiry times of a collection's documents, ordered so the TTL reaper finds
+// the expired ones without a scan. A document expires `expire_after`
+// seconds after the time in its field: an ISO-8601 string (UTC unless it
+// carries an offset) or a number of seconds since the epoch. Documents
+// without a readable time never expire.
+class TtlIndex {
+public:
+    TtlIndex();
+    TtlIndex(const std::string &field, int64_t expire_after);
+
+    const std::string& field() const;
+    int64_t expire_after() const;
+    void insert(const json &doc, const std::string &id);
+    void remove(const json &doc, const std::string &id);
+
+    // Up to `limit` ids whose expiry time is at or before `now`, oldest first.
+    Vector<std::string> expired(int64_t now, size_t limit) const;
+    size_t size() const;
+    json stats() const;
+    json to_json() const;
+    void from_json(const json &j);
+
+    static bool parse_time(const json &value, int64_t &seconds);
+
+private:
+    std::string field_name;
+    int64_t expire_after_s = 0;
+    std::set<std::pair<int64_t, std::string>> entries;
+
+    bool expiry_of(const json &doc, int64_t &at) const;
+};
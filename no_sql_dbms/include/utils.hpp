@@ -1,4 +1,9 @@
 #pragma once
 #include <string>
+#include <cstdint>
+#include <cstddef>
 
 std::string gen_id();
+uint32_t crc32(const void *data, size_t len);
+void write_file_atomic(const std::string &path, const std::string &data);
+void fsync_directory(const std::string &dir);
@@ -44,6 +44,26 @@ public:
         return *this;
     }
 
+    Vector(Vector&& other) noexcept : data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    Vector& operator=(Vector&& other) noexcept {
+        if (this != &other) {
+            clear();
+            free(data_);
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+            other.capacity_ = 0;
+        }
+        return *this;
+    }
+
     void push_back(const T& value) {
         if (size_ >= capacity_) {
             reserve(capacity_ == 0 ? 4 : capacity_ * 2);
@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "vector.hpp"
+
+enum WalRecordType : uint8_t {
+    WAL_INSERT = 1,
+    WAL_DELETE = 2,
+    WAL_CREATE_INDEX = 3
+};
+
+struct WalRecord {
+    uint64_t lsn;
+    uint8_t type;
+    std::string payload;
+};
+
+struct WalStats {
+    uint64_t commits;
+    uint64_t records;
+    uint64_t bytes;
+};
+
+// Append-only log of collection mutations.
+// File: "NSQLWAL1" + u64 base_lsn, then records [u32 len][u32 crc32][u64 lsn][u8 type][payload].
+//
+// Appends only buffer the record. A committer thread writes everything
+// buffered so far with a single fdatasync (group commit); wait_durable()
+// blocks until a given LSN is on disk. With a non-zero max commit delay the
+// committer waits that long for more writers to join a group.
+//
+// rotate() starts a new active file and renames the current one to
+// <path>.<last_lsn>; the committer finishes it in the background. Retired
+// files are replayed before the active one and dropped by remove_retired()
+// once a checkpoint covers them.
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(const std::string &path);
+    ~WriteAheadLog();
+
+    uint64_t append(uint8_t type, const std::string &payload);
+    void wait_durable(uint64_t lsn);
+    void sync();
+    void replay(uint64_t after_lsn, const std::function<void(const WalRecord&)> &fn);
+    uint64_t rotate();
+    void remove_retired(uint64_t upto_lsn);
+
+    void set_max_commit_delay(std::chrono::microseconds delay);
+    uint64_t last_lsn() const;
+    size_t size_bytes() const;
+    WalStats stats() const;
+
+private:
+    std::string path;
+    int fd;
+    std::string buffer;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    uint64_t active_base_lsn;
+    size_t file_bytes;
+    WalStats counters;
+    size_t buffered_records;
+
+    int retired_fd;
+    std::string retired_buffer;
+    size_t retired_records;
+    uint64_t retired_lsn;
+    bool rotation_pending;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+    std::chrono::microseconds max_commit_delay;
+    bool flushing;
+    bool stopping;
+    std::string error;
+    std::thread committer;
+
+    void open_file();
+    void write_header(uint64_t base_lsn);
+    void committer_loop();
+    bool write_all(int out_fd, const std::string &data);
+    Vector<std::pair<uint64_t, std::string>> retired_files() const;
+    void replay_file(const std::string &file, uint64_t after_lsn, uint64_t &last,
+                     const std::function<void(const WalRecord&)> &fn);
+};
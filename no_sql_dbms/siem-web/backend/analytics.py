@@ -8,11 +8,14 @@ class AnalyticsService:
     def __init__(self, db_client: DBSocketClient):
         self.db = db_client
 
-    def get_events_today(self, limit: int = 1000) -> List[Dict]:
-        events = self.db.find_security_events({}, limit=limit)
+    def _today_query(self) -> Dict:
+        # Bounding the timestamp lets a partitioned collection read only the last day or two
+        yesterday = datetime.utcnow() - timedelta(days=1)
+        return {"timestamp": {"$gt": yesterday.strftime('%Y-%m-%dT%H:%M:%S')}}
 
-        now = datetime.utcnow()
-        yesterday = now - timedelta(days=1)
+    def get_events_today(self, limit: int = 1000) -> List[Dict]:
+        yesterday = datetime.utcnow() - timedelta(days=1)
+        events = self.db.get_security_events(self._today_query(), limit=limit)
 
         recent_events = []
         for event in events:
@@ -75,25 +78,12 @@ class AnalyticsService:
         return [{'hostname': host, 'event_count': count}
                 for host, count in hosts.items()]
 
+    # Counts are computed by the server, so they are not capped by the find limit
     def get_events_by_type(self) -> Dict[str, int]:
-        events = self.get_events_today()
-
-        type_counter = Counter()
-        for event in events:
-            event_type = event.get('event_type', 'unknown')
-            type_counter[event_type] += 1
-
-        return dict(type_counter)
+        return self.db.count_security_events_by('event_type', self._today_query())
 
     def get_events_by_severity(self) -> Dict[str, int]:
-        events = self.get_events_today()
-
-        severity_counter = Counter()
-        for event in events:
-            severity = event.get('severity', 'info')
-            severity_counter[severity] += 1
-
-        return dict(severity_counter)
+        return self.db.count_security_events_by('severity', self._today_query())
 
     def get_top_users(self, limit: int = 10) -> List[Dict]:
         events = self.get_events_today()
@@ -120,29 +110,23 @@ class AnalyticsService:
                 for process, count in process_counter.most_common(limit)]
 
     def get_events_timeline(self) -> List[Dict]:
-        events = self.get_events_today()
+        buckets = self.db.count_security_events_by('timestamp', self._today_query(), bucket='hour')
 
         timeline = defaultdict(int)
-        for event in events:
-            timestamp = event.get('timestamp', '')
-            if timestamp:
-                try:
-                    hour = timestamp.split('T')[1].split(':')[0]
-                    timeline[hour] += 1
-                except:
-                    continue
-
-        sorted_timeline = sorted([{'hour': hour, 'count': count}
-                                 for hour, count in timeline.items()])
+        for key, count in buckets.items():
+            # Keys are "YYYY-MM-DDTHH"; the last day spans two dates
+            if len(key) == 13:
+                timeline[key[11:13]] += count
 
-        return sorted_timeline
+        return [{'hour': hour, 'count': timeline[hour]} for hour in sorted(timeline)]
 
     def get_events_today_count(self) -> int:
-        return len(self.get_events_today())
+        return self.db.count_security_events(self._today_query())
 
     def get_critical_events_count(self) -> int:
-        events = self.get_events_today()
-        return sum(1 for e in events if e.get('severity') == 'high')
+        query = self._today_query()
+        query['severity'] = 'high'
+        return self.db.count_security_events(query)
 
     def get_unique_hosts_count(self) -> int:
         events = self.get_events_today()
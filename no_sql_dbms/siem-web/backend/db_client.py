@@ -109,6 +109,47 @@ class DBSocketClient:
             print(f"[DB Client] Error: {error_msg}")
             return []
 
+    def _count(self, query: Optional[Dict], group_by: str = "", bucket: str = "") -> Optional[Dict]:
+        request = {
+            "database": "security_events",
+            "operation": "count",
+            "query": query or {}
+        }
+        if group_by:
+            request["group_by"] = group_by
+        if bucket:
+            request["bucket"] = bucket
+
+        response = self._send_json(request)
+        if response.get("status") != "success":
+            print(f"[DB Client] Error: {response.get('message', 'Unknown error')}")
+            return None
+        return response
+
+    def count_security_events(self, query: Optional[Dict] = None) -> int:
+        response = self._count(query)
+        return response.get("count", 0) if response else 0
+
+    def count_security_events_by(self, field: str, query: Optional[Dict] = None,
+                                 bucket: str = "") -> Dict[str, int]:
+        response = self._count(query, field, bucket)
+        return response.get("data", {}) if response else {}
+
+    def create_index(self, field: str, database: str = "security_events",
+                     filter: Optional[Dict[str, Any]] = None) -> bool:
+        request = {
+            "database": database,
+            "operation": "create_index",
+            "field": field
+        }
+        if filter is not None:
+            request["filter"] = filter
+        response = self._send_json(request)
+        if response.get("status") != "success":
+            print(f"[DB Client] Error: {response.get('message', 'Unknown error')}")
+            return False
+        return True
+
     def test_connection(self) -> bool:
         try:
             response = self.send_request(
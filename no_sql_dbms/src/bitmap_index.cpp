@@ -0,0 +1,286 @@
+#include "../include/bitmap_index.hpp"
+#include "../include/query_evaluator.hpp"
+#include <stdexcept>
+
+static json bitmap_to_json(const RoaringBitmap &rows) {
+    std::string bytes;
+    rows.serialize(bytes);
+    return json::binary(std::vector<std::uint8_t>(bytes.begin(), bytes.end()));
+}
+
+static RoaringBitmap bitmap_from_json(const json &j) {
+    const auto &bytes = j.get_binary();
+    RoaringBitmap rows;
+    rows.deserialize(std::string(bytes.begin(), bytes.end()));
+    return rows;
+}
+
+bool BitmapIndex::empty() const { return fields.empty(); }
+
+bool BitmapIndex::has_field(const std::string &field) const { return bitmaps.count(field) > 0; }
+
+const Vector<std::string>& BitmapIndex::indexed_fields() const { return fields; }
+
+std::string BitmapIndex::spec() const {
+    std::string s;
+    for (const auto &f : fields) s += (s.empty() ? "" : ",") + f;
+    return s;
+}
+
+// Values are kept apart as written, so 2 and 2.0 stay separate groups as
+// they are for a scanned count; value_rows joins them for conditions.
+bool BitmapIndex::value_key(const json &value, std::string &key) {
+    if (value.is_structured()) return false;
+    key = value.dump();
+    return true;
+}
+
+uint32_t BitmapIndex::row_of(const std::string &id) {
+    auto it = rows_by_id.find(id);
+    if (it != rows_by_id.end()) return it->second;
+    uint32_t row = ids.size();
+    ids.push_back(id);
+    rows_by_id[id] = row;
+    alive.add(row);
+    return row;
+}
+
+void BitmapIndex::set(FieldBitmaps &field, const json &value, uint32_t row) {
+    std::string key;
+    if (!value_key(value, key)) {
+        field.structured.add(row);
+        return;
+    }
+    auto it = field.values.find(key);
+    if (it == field.values.end()) it = field.values.emplace(key, ValueRows{value, RoaringBitmap()}).first;
+    it->second.rows.add(row);
+}
+
+void BitmapIndex::unset(FieldBitmaps &field, const json &value, uint32_t row) {
+    std::string key;
+    if (!value_key(value, key)) {
+        field.structured.remove(row);
+        return;
+    }
+    auto it = field.values.find(key);
+    if (it == field.values.end()) return;
+    it->second.rows.remove(row);
+    if (it->second.rows.empty()) field.values.erase(it);
+}
+
+void BitmapIndex::add_field(const std::string &field) {
+    if (has_field(field)) return;
+    fields.push_back(field);
+    bitmaps[field];
+}
+
+void BitmapIndex::index_field(const std::string &field, const json &doc, const std::string &id) {
+    uint32_t row = row_of(id);
+    if (doc.contains(field)) set(bitmaps[field], doc[field], row);
+}
+
+void BitmapIndex::insert(const json &doc, const std::string &id) {
+    uint32_t row = row_of(id);
+    for (const auto &field : fields) {
+        if (doc.contains(field)) set(bitmaps[field], doc[field], row);
+    }
+}
+
+void BitmapIndex::remove(const json &doc, const std::string &id) {
+    auto it = rows_by_id.find(id);
+    if (it == rows_by_id.end()) return;
+    uint32_t row = it->second;
+    for (const auto &field : fields) {
+        if (doc.contains(field)) unset(bitmaps[field], doc[field], row);
+    }
+    alive.remove(row);
+    ids[row].clear();
+    rows_by_id.erase(it);
+    if (++dead_count > 1024 && dead_count * 2 > ids.size()) compact();
+}
+
+// Renumbers the live rows densely once half of the row numbers are unused.
+void BitmapIndex::compact() {
+    Vector<uint32_t> remap(ids.size());
+    Vector<std::string> live;
+    alive.for_each([&](uint32_t row) {
+        remap[row] = live.size();
+        rows_by_id[ids[row]] = live.size();
+        live.push_back(ids[row]);
+    });
+    auto renumber = [&](RoaringBitmap &rows) {
+        RoaringBitmap moved;
+        rows.for_each([&](uint32_t row) { moved.add(remap[row]); });
+        rows = std::move(moved);
+    };
+    for (auto &f : bitmaps) {
+        for (auto &v : f.second.values) renumber(v.second.rows);
+        renumber(f.second.structured);
+    }
+    renumber(alive);
+    ids = std::move(live);
+    dead_count = 0;
+}
+
+// Rows whose value equals `value` under value_eq: a number matches both its
+// integer and its floating-point spelling.
+bool BitmapIndex::value_rows(const FieldBitmaps &field, const json &value, RoaringBitmap &rows) const {
+    std::string key;
+    if (!value_key(value, key)) return false;
+    rows = RoaringBitmap();
+    Vector<std::string> keys;
+    keys.push_back(key);
+    if (value.is_number()) {
+        double d = value.get<double>();
+        keys.push_back(json(d).dump());
+        if (d > -9e18 && d < 9e18 && d == (double)(int64_t)d) keys.push_back(json((int64_t)d).dump());
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        bool seen = false;
+        for (size_t k = 0; k < i; ++k) seen = seen || keys[k] == keys[i];
+        auto it = field.values.find(keys[i]);
+        if (!seen && it != field.values.end()) rows |= it->second.rows;
+    }
+    return true;
+}
+
+bool BitmapIndex::field_rows(const std::string &name, const json &cond, RoaringBitmap &rows) const {
+    auto f = bitmaps.find(name);
+    if (f == bitmaps.end()) return false;
+    const FieldBitmaps &field = f->second;
+    if (!cond.is_object()) return value_rows(field, cond, rows);
+
+    RoaringBitmap result = field.structured;
+    for (const auto &v : field.values) result |= v.second.rows;
+    for (auto op = cond.begin(); op != cond.end(); ++op) {
+        const json &arg = op.value();
+        RoaringBitmap part;
+        if (op.key() == "$eq" || op.key() == "$ne") {
+            if (!value_rows(field, arg, part)) return false;
+        } else if (op.key() == "$in" || op.key() == "$nin") {
+            if (!arg.is_array()) {
+                result = RoaringBitmap();
+                continue;
+            }
+            for (const auto &v : arg) {
+                RoaringBitmap one;
+                if (!value_rows(field, v, one)) return false;
+                part |= one;
+            }
+        } else {
+            return false;
+        }
+        if (op.key() == "$eq" || op.key() == "$in") result &= part;
+        else result -= part;
+    }
+    rows = std::move(result);
+    return true;
+}
+
+bool BitmapIndex::rows_for(const json &query, RoaringBitmap &rows) const {
+    if (fields.empty() || !query.is_object()) return false;
+    RoaringBitmap result;
+    if (query.contains("$or")) {
+        const json &branches = query["$or"];
+        if (branches.is_array()) {
+            for (const auto &branch : branches) {
+                RoaringBitmap part;
+                if (!rows_for(branch, part)) return false;
+                result |= part;
+            }
+        }
+    } else if (query.contains("$and")) {
+        const json &parts = query["$and"];
+        if (parts.is_array()) {
+            result = alive;
+            for (const auto &sub : parts) {
+                RoaringBitmap part;
+                if (!rows_for(sub, part)) return false;
+                result &= part;
+            }
+        }
+    } else {
+        result = alive;
+        for (auto it = query.begin(); it != query.end(); ++it) {
+            RoaringBitmap part;
+            if (!field_rows(it.key(), it.value(), part)) return false;
+            result &= part;
+        }
+    }
+    rows = std::move(result);
+    return true;
+}
+
+Vector<std::string> BitmapIndex::ids_of(const RoaringBitmap &rows) const {
+    Vector<std::string> result;
+    rows.for_each([&](uint32_t row) { result.push_back(ids[row]); });
+    return result;
+}
+
+bool BitmapIndex::count(const json &query, const std::string &group_by, const std::string &bucket,
+                        HashMap<uint64_t> &counts) const {
+    RoaringBitmap filter;
+    if (!rows_for(query, filter)) return false;
+    auto add = [&](const std::string &key, uint64_t n) {
+        uint64_t current = 0;
+        counts.get(key, current);
+        counts.put(key, current + n);
+    };
+    if (group_by.empty()) {
+        uint64_t n = filter.cardinality();
+        if (n > 0) add("", n);
+        return true;
+    }
+    auto f = bitmaps.find(group_by);
+    if (f == bitmaps.end() || filter.and_cardinality(f->second.structured) > 0) return false;
+    for (const auto &v : f->second.values) {
+        uint64_t n = filter.and_cardinality(v.second.rows);
+        if (n > 0) add(group_key(v.second.value, bucket), n);
+    }
+    return true;
+}
+
+json BitmapIndex::to_json() const {
+    json field_list = json::array(), id_list = json::array(), per_field = json::object();
+    for (const auto &id : ids) id_list.push_back(id);
+    for (const auto &field : fields) {
+        field_list.push_back(field);
+        const FieldBitmaps &f = bitmaps.at(field);
+        json values = json::array(), rows = json::array();
+        for (const auto &v : f.values) {
+            values.push_back(v.second.value);
+            rows.push_back(bitmap_to_json(v.second.rows));
+        }
+        per_field[field] = {{"values", values}, {"rows", rows}, {"structured", bitmap_to_json(f.structured)}};
+    }
+    return {{"fields", field_list}, {"ids", id_list}, {"alive", bitmap_to_json(alive)}, {"bitmaps", per_field}};
+}
+
+void BitmapIndex::from_json(const json &j) {
+    *this = BitmapIndex();
+    for (const auto &id : j.at("ids")) ids.push_back(id.get<std::string>());
+    alive = bitmap_from_json(j.at("alive"));
+    bool bad = false;
+    alive.for_each([&](uint32_t row) {
+        if (row >= ids.size()) bad = true;
+        else rows_by_id[ids[row]] = row;
+    });
+    if (bad) throw std::runtime_error("Corrupt bitmap index");
+    dead_count = ids.size() - rows_by_id.size();
+
+    for (const auto &field : j.at("fields")) {
+        std::string name = field.get<std::string>();
+        add_field(name);
+        const json &f = j.at("bitmaps").at(name);
+        const json &values = f.at("values");
+        const json &rows = f.at("rows");
+        if (values.size() != rows.size()) throw std::runtime_error("Corrupt bitmap index " + name);
+        FieldBitmaps &target = bitmaps[name];
+        for (size_t i = 0; i < values.size(); ++i) {
+            std::string key;
+            if (!value_key(values[i], key)) throw std::runtime_error("Corrupt bitmap index " + name);
+            target.values[key] = ValueRows{values[i], bitmap_from_json(rows[i])};
+        }
+        target.structured = bitmap_from_json(f.at("structured"));
+    }
+}
@@ -0,0 +1,296 @@
+#include "../include/block_index.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static bool listed(const Vector<std::string> &fields, const std::string &field) {
+    for (const auto &f : fields) {
+        if (f == field) return true;
+    }
+    return false;
+}
+
+bool BlockIndex::empty() const { return zone_fields.empty() && bloom_fields.empty(); }
+
+bool BlockIndex::has(const std::string &name) const {
+    if (name.rfind("zonemap:", 0) == 0) return listed(zone_fields, name.substr(8));
+    if (name.rfind("bloom:", 0) == 0) return listed(bloom_fields, name.substr(6));
+    return false;
+}
+
+Vector<std::string> BlockIndex::names() const {
+    Vector<std::string> res;
+    for (const auto &f : zone_fields) res.push_back("zonemap:" + f);
+    for (const auto &f : bloom_fields) res.push_back("bloom:" + f);
+    return res;
+}
+
+std::string BlockIndex::spec() const {
+    std::string s;
+    for (const auto &name : names()) s += (s.empty() ? "" : ",") + name;
+    return s;
+}
+
+void BlockIndex::add(const std::string &name) {
+    if (has(name)) return;
+    if (name.rfind("zonemap:", 0) == 0 && name.size() > 8) zone_fields.push_back(name.substr(8));
+    else if (name.rfind("bloom:", 0) == 0 && name.size() > 6) bloom_fields.push_back(name.substr(6));
+    else throw std::runtime_error("Unknown block index: " + name);
+}
+
+uint32_t BlockIndex::row_of(const std::string &id) {
+    auto it = rows_by_id.find(id);
+    if (it != rows_by_id.end()) return it->second;
+    uint32_t row = ids.size();
+    ids.push_back(id);
+    rows_by_id[id] = row;
+    if (row % BLOCK_ROWS == 0) blocks.push_back(Block());
+    ++blocks.back().live;
+    return row;
+}
+
+void BlockIndex::reserve_row(const std::string &id) { row_of(id); }
+
+// Numbers are keyed by their double value, since 2 and 2.0 are equal to a
+// query; arrays and objects are left out and never rule a block out.
+bool BlockIndex::bloom_key(const json &value, std::string &key) {
+    if (value.is_structured()) return false;
+    if (value.is_number()) key = "n" + json(value.get<double>()).dump();
+    else if (value.is_string()) key = "s" + value.get<std::string>();
+    else key = value.dump();
+    return true;
+}
+
+void BlockIndex::widen(Zone &zone, const json &value) {
+    if (value.is_number()) {
+        double v = value.get<double>();
+        if (!zone.numbers || v < zone.min_num) zone.min_num = v;
+        if (!zone.numbers || v > zone.max_num) zone.max_num = v;
+        zone.numbers = true;
+    } else if (value.is_string()) {
+        const std::string &v = value.get_ref<const std::string&>();
+        if (!zone.strings || v < zone.min_str) zone.min_str = v;
+        if (!zone.strings || v > zone.max_str) zone.max_str = v;
+        zone.strings = true;
+    } else {
+        zone.others = true;
+    }
+}
+
+void BlockIndex::insert(const json &doc, const std::string &id) {
+    Block &block = blocks[row_of(id) / BLOCK_ROWS];
+    for (const auto &field : zone_fields) {
+        if (doc.contains(field)) widen(block.zones[field], doc[field]);
+    }
+    for (const auto &field : bloom_fields) {
+        std::string key;
+        if (!doc.contains(field) || !bloom_key(doc[field], key)) continue;
+        auto it = block.blooms.find(field);
+        if (it == block.blooms.end()) it = block.blooms.emplace(field, BloomFilter(BLOCK_ROWS)).first;
+        it->second.add(BloomFilter::hash(key));
+    }
+}
+
+// A block whose documents are all gone drops its summaries; its rows stay
+// numbered until the index is next rebuilt from a checkpoint.
+void BlockIndex::remove(const std::string &id) {
+    auto it = rows_by_id.find(id);
+    if (it == rows_by_id.end()) return;
+    uint32_t row = it->second;
+    Block &block = blocks[row / BLOCK_ROWS];
+    if (--block.live == 0) {
+        block.zones.clear();
+        block.blooms.clear();
+    }
+    ids[row].clear();
+    rows_by_id.erase(it);
+}
+
+bool BlockIndex::value_may_match(const Block &block, const std::string &field, const json &value) const {
+    if (listed(zone_fields, field)) {
+        auto z = block.zones.find(field);
+        if (z == block.zones.end()) return false;
+        const Zone &zone = z->second;
+        if (value.is_number()) {
+            double v = value.get<double>();
+            if (!zone.numbers || v < zone.min_num || v > zone.max_num) return false;
+        } else if (value.is_string()) {
+            const std::string &v = value.get_ref<const std::string&>();
+            if (!zone.strings || v < zone.min_str || v > zone.max_str) return false;
+        } else if (!zone.others) {
+            return false;
+        }
+    }
+    std::string key;
+    if (listed(bloom_fields, field) && bloom_key(value, key)) {
+        auto b = block.blooms.find(field);
+        if (b == block.blooms.end() || !b->second.may_contain(BloomFilter::hash(key))) return false;
+    }
+    return true;
+}
+
+static int compare_num(double x, double y) {
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// cmp_min and cmp_max compare the block's smallest and largest value with
+// the bound.
+static bool range_may_match(bool present, int cmp_min, int cmp_max, const std::string &op) {
+    if (!present) return false;
+    if (op == "$gt") return cmp_max > 0;
+    if (op == "$gte") return cmp_max >= 0;
+    if (op == "$lt") return cmp_min < 0;
+    return cmp_min <= 0;
+}
+
+// Mirrors evaluate_condition_on_field: every operator must hold, and only
+// the ones a zone map or bloom filter can decide are looked at.
+bool BlockIndex::field_may_match(const Block &block, const std::string &field, const json &cond) const {
+    bool zoned = listed(zone_fields, field);
+    if (!zoned && !listed(bloom_fields, field)) return true;
+    // No condition matches a document without the field.
+    if (zoned && !block.zones.count(field)) return false;
+    if (!cond.is_object()) return value_may_match(block, field, cond);
+
+    for (auto it = cond.begin(); it != cond.end(); ++it) {
+        const std::string &op = it.key();
+        const json &arg = it.value();
+        if (op == "$eq") {
+            if (!value_may_match(block, field, arg)) return false;
+        } else if (op == "$in" && arg.is_array()) {
+            bool any = false;
+            for (const auto &v : arg) {
+                if (value_may_match(block, field, v)) { any = true; break; }
+            }
+            if (!any) return false;
+        } else if (zoned && (op == "$gt" || op == "$gte" || op == "$lt" || op == "$lte")) {
+            const Zone &zone = block.zones.at(field);
+            bool may;
+            if (arg.is_number()) {
+                double a = arg.get<double>();
+                may = range_may_match(zone.numbers, compare_num(zone.min_num, a), compare_num(zone.max_num, a), op);
+            } else if (arg.is_string()) {
+                const std::string &a = arg.get_ref<const std::string&>();
+                may = range_may_match(zone.strings, zone.min_str.compare(a), zone.max_str.compare(a), op);
+            } else {
+                may = false;
+            }
+            if (!may) return false;
+        } else if (zoned && op == "$prefix" && arg.is_string()) {
+            const Zone &zone = block.zones.at(field);
+            const std::string &p = arg.get_ref<const std::string&>();
+            // Strings starting with p sort from p up to the first string
+            // past p that does not start with it.
+            if (!zone.strings || zone.max_str < p) return false;
+            if (zone.min_str > p && zone.min_str.compare(0, p.size(), p) != 0) return false;
+        }
+    }
+    return true;
+}
+
+bool BlockIndex::block_may_match(const Block &block, const json &query) const {
+    if (block.live == 0) return false;
+    if (!query.is_object()) return true;
+
+    if (query.contains("$or")) {
+        const json &branches = query["$or"];
+        if (!branches.is_array()) return true;
+        for (const auto &branch : branches) {
+            if (block_may_match(block, branch)) return true;
+        }
+        return false;
+    }
+    if (query.contains("$and")) {
+        const json &parts = query["$and"];
+        if (!parts.is_array()) return true;
+        for (const auto &part : parts) {
+            if (!block_may_match(block, part)) return false;
+        }
+        return true;
+    }
+    for (auto it = query.begin(); it != query.end(); ++it) {
+        if (!field_may_match(block, it.key(), it.value())) return false;
+    }
+    return true;
+}
+
+bool BlockIndex::candidates(const json &query, Vector<std::string> &out) const {
+    Vector<size_t> keep;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (block_may_match(blocks[b], query)) keep.push_back(b);
+    }
+    if (keep.size() == blocks.size()) return false;
+    for (size_t b : keep) {
+        size_t end = std::min((b + 1) * BLOCK_ROWS, ids.size());
+        for (size_t row = b * BLOCK_ROWS; row < end; ++row) {
+            if (!ids[row].empty()) out.push_back(ids[row]);
+        }
+    }
+    return true;
+}
+
+json BlockIndex::stats() const {
+    json name_list = json::array();
+    for (const auto &name : names()) name_list.push_back(name);
+    return {{"fields", name_list}, {"blocks", blocks.size()}, {"block_rows", (size_t)BLOCK_ROWS},
+            {"documents", rows_by_id.size()}};
+}
+
+json BlockIndex::to_json() const {
+    json name_list = json::array(), id_list = json::array(), block_list = json::array();
+    for (const auto &name : names()) name_list.push_back(name);
+    for (const auto &id : ids) id_list.push_back(id);
+    for (const auto &block : blocks) {
+        json zones = json::object(), blooms = json::object();
+        for (const auto &z : block.zones) {
+            json zone = json::object();
+            if (z.second.numbers) zone["num"] = {z.second.min_num, z.second.max_num};
+            if (z.second.strings) zone["str"] = {z.second.min_str, z.second.max_str};
+            if (z.second.others) zone["other"] = true;
+            zones[z.first] = zone;
+        }
+        for (const auto &b : block.blooms) {
+            const std::string &bits = b.second.data();
+            blooms[b.first] = {{"bits", json::binary(std::vector<std::uint8_t>(bits.begin(), bits.end()))},
+                               {"hashes", b.second.hash_count()}};
+        }
+        block_list.push_back({{"live", block.live}, {"zones", zones}, {"blooms", blooms}});
+    }
+    return {{"names", name_list}, {"ids", id_list}, {"blocks", block_list}};
+}
+
+void BlockIndex::from_json(const json &j) {
+    *this = BlockIndex();
+    for (const auto &name : j.at("names")) add(name.get<std::string>());
+    for (const auto &id : j.at("ids")) ids.push_back(id.get<std::string>());
+    for (size_t row = 0; row < ids.size(); ++row) {
+        if (!ids[row].empty()) rows_by_id[ids[row]] = row;
+    }
+    const json &block_list = j.at("blocks");
+    if (block_list.size() != (ids.size() + BLOCK_ROWS - 1) / BLOCK_ROWS) throw std::runtime_error("Corrupt block index");
+    for (const auto &jb : block_list) {
+        Block block;
+        block.live = jb.at("live").get<uint32_t>();
+        for (auto z = jb.at("zones").begin(); z != jb.at("zones").end(); ++z) {
+            Zone zone;
+            const json &jz = z.value();
+            if (jz.contains("num")) {
+                zone.numbers = true;
+                zone.min_num = jz["num"][0].get<double>();
+                zone.max_num = jz["num"][1].get<double>();
+            }
+            if (jz.contains("str")) {
+                zone.strings = true;
+                zone.min_str = jz["str"][0].get<std::string>();
+                zone.max_str = jz["str"][1].get<std::string>();
+            }
+            zone.others = jz.value("other", false);
+            block.zones[z.key()] = zone;
+        }
+        for (auto b = jb.at("blooms").begin(); b != jb.at("blooms").end(); ++b) {
+            const auto &bits = b.value().at("bits").get_binary();
+            block.blooms.emplace(b.key(), BloomFilter(std::string(bits.begin(), bits.end()),
+                                                      b.value().at("hashes").get<uint32_t>()));
+        }
+        blocks.push_back(std::move(block));
+    }
+}
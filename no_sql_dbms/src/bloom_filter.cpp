@@ -0,0 +1,59 @@
+#include "../include/bloom_filter.hpp"
+#include <stdexcept>
+
+BloomFilter::BloomFilter(size_t keys, size_t bits_per_key) {
+    nbits = keys * bits_per_key;
+    if (nbits < 64) nbits = 64;
+    nbits = (nbits + 7) / 8 * 8;
+    bits.assign(nbits / 8, '\0');
+    // k = ln 2 * bits per key minimizes the false positive rate.
+    k = (uint32_t)(bits_per_key * 69 / 100);
+    if (k < 1) k = 1;
+    if (k > 30) k = 30;
+}
+
+BloomFilter::BloomFilter(const std::string &data, uint32_t hashes)
+: bits(data), nbits(data.size() * 8), k(hashes) {
+    if (nbits == 0 || k == 0) throw std::runtime_error("Corrupt bloom filter");
+}
+
+uint64_t BloomFilter::hash(const std::string &key) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+bool BloomFilter::probe(const uint8_t *data, size_t bit_count, uint32_t hashes, uint64_t h) {
+    uint64_t h1 = h & 0xFFFFFFFF;
+    uint64_t h2 = (h >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; ++i) {
+        uint64_t bit = (h1 + i * h2) % bit_count;
+        if (!(data[bit / 8] & (1u << (bit % 8)))) return false;
+    }
+    return true;
+}
+
+void BloomFilter::add(uint64_t h) {
+    uint64_t h1 = h & 0xFFFFFFFF;
+    uint64_t h2 = (h >> 32) | 1;
+    for (uint32_t i = 0; i < k; ++i) {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        bits[bit / 8] = (char)(bits[bit / 8] | (1u << (bit % 8)));
+    }
+}
+
+bool BloomFilter::may_contain(uint64_t h) const {
+    return probe(reinterpret_cast<const uint8_t*>(bits.data()), nbits, k, h);
+}
+
+const std::string& BloomFilter::data() const { return bits; }
+
+size_t BloomFilter::bit_count() const { return nbits; }
+
+uint32_t BloomFilter::hash_count() const { return k; }
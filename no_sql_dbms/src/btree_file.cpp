@@ -0,0 +1,197 @@
+#include "../include/btree_file.hpp"
+#include "../include/utils.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char BTREE_MAGIC[8] = {'N', 'S', 'Q', 'L', 'B', 'T', 'R', '1'};
+static const uint32_t BTREE_VERSION = 1;
+static const size_t BTREE_PAGE_SIZE = 4096;
+static const size_t BTREE_PAGE_CAPACITY = (BTREE_PAGE_SIZE - sizeof(BTreePageHeader)) / sizeof(BTreePageEntry);
+
+BTreeFile::BTreeFile(const std::string &path)
+: path(path), base(nullptr), length(0), header(nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open B-tree file " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat B-tree file " + path);
+    }
+    length = (size_t)st.st_size;
+    if (length < BTREE_PAGE_SIZE) {
+        ::close(fd);
+        throw std::runtime_error("B-tree file too small: " + path);
+    }
+
+    void *m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) throw std::runtime_error("Cannot mmap B-tree file " + path);
+    base = static_cast<const uint8_t*>(m);
+    header = reinterpret_cast<const BTreeFileHeader*>(base);
+
+    if (memcmp(header->magic, BTREE_MAGIC, sizeof(BTREE_MAGIC)) != 0
+        || header->version != BTREE_VERSION || header->page_size != BTREE_PAGE_SIZE) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Invalid B-tree file header: " + path);
+    }
+    if ((header->page_count + 1) * BTREE_PAGE_SIZE > length || header->ids_offset > length
+        || header->root_page == 0 || header->root_page > header->page_count) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Truncated B-tree file: " + path);
+    }
+    madvise((void*)base, length, MADV_RANDOM);
+}
+
+BTreeFile::~BTreeFile() {
+    if (base) munmap((void*)base, length);
+}
+
+size_t BTreeFile::key_count() const { return (size_t)header->key_count; }
+
+const BTreePageHeader* BTreeFile::page(uint64_t no) const {
+    if (no == 0 || no > header->page_count) throw std::runtime_error("Corrupt B-tree page reference in " + path);
+    return reinterpret_cast<const BTreePageHeader*>(base + no * BTREE_PAGE_SIZE);
+}
+
+const BTreePageEntry* BTreeFile::entries(const BTreePageHeader *p) const {
+    return reinterpret_cast<const BTreePageEntry*>(p + 1);
+}
+
+// Descends to the leaf whose key range contains `key`.
+uint64_t BTreeFile::find_leaf(double key) const {
+    uint64_t no = header->root_page;
+    for (;;) {
+        const BTreePageHeader *p = page(no);
+        if (p->leaf) return no;
+        const BTreePageEntry *es = entries(p);
+        size_t lo = 0, hi = p->count;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (es[mid].key <= key) lo = mid;
+            else hi = mid;
+        }
+        no = es[lo].value;
+    }
+}
+
+void BTreeFile::read_ids(uint64_t offset, double key, Vector<std::pair<double, std::string>> *pairs, Vector<std::string> *ids) const {
+    const uint8_t *p = base + header->ids_offset + offset;
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    p += sizeof(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (p + len > base + length) throw std::runtime_error("Truncated B-tree id list in " + path);
+        std::string id(reinterpret_cast<const char*>(p), len);
+        p += len;
+        if (pairs) pairs->push_back(std::make_pair(key, id));
+        else ids->push_back(id);
+    }
+}
+
+void BTreeFile::search(double key, Vector<std::string> &out) const {
+    const BTreePageHeader *p = page(find_leaf(key));
+    const BTreePageEntry *es = entries(p);
+    size_t lo = 0, hi = p->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (es[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < p->count && es[lo].key == key) read_ids(es[lo].value, key, nullptr, &out);
+}
+
+void BTreeFile::range(double low, double high, bool includeLow, bool includeHigh,
+                      Vector<std::pair<double, std::string>> &out) const {
+    uint64_t no = find_leaf(low);
+    while (no != 0) {
+        const BTreePageHeader *p = page(no);
+        const BTreePageEntry *es = entries(p);
+        for (size_t i = 0; i < p->count; ++i) {
+            double k = es[i].key;
+            if (k < low || (k == low && !includeLow)) continue;
+            if (k > high || (k == high && !includeHigh)) return;
+            read_ids(es[i].value, k, &out, nullptr);
+        }
+        no = p->next;
+    }
+}
+
+BTreeFileWriter::BTreeFileWriter(const std::string &path) : path(path), key_count(0) {}
+
+uint64_t BTreeFileWriter::append_page(bool is_leaf, const std::string &body, uint16_t count, uint64_t next) {
+    uint64_t no = pages.size() / BTREE_PAGE_SIZE + 1;
+    BTreePageHeader h;
+    h.leaf = is_leaf ? 1 : 0;
+    h.count = count;
+    h.reserved = 0;
+    h.next = next;
+    pages.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    pages.append(body);
+    pages.append(BTREE_PAGE_SIZE - sizeof(h) - body.size(), '\0');
+    return no;
+}
+
+void BTreeFileWriter::flush_leaf(bool has_next) {
+    BTreePageEntry first{0, 0};
+    if (!leaf.empty()) memcpy(&first, leaf.data(), sizeof(first));
+    uint64_t no = pages.size() / BTREE_PAGE_SIZE + 1;
+    append_page(true, leaf, (uint16_t)(leaf.size() / sizeof(BTreePageEntry)), has_next ? no + 1 : 0);
+    level.push_back(BTreePageEntry{first.key, no});
+    leaf.clear();
+}
+
+void BTreeFileWriter::add(double key, const Vector<std::string> &ids) {
+    if (leaf.size() / sizeof(BTreePageEntry) == BTREE_PAGE_CAPACITY) flush_leaf(true);
+
+    BTreePageEntry e{key, (uint64_t)ids_data.size()};
+    leaf.append(reinterpret_cast<const char*>(&e), sizeof(e));
+
+    uint32_t n = (uint32_t)ids.size();
+    ids_data.append(reinterpret_cast<const char*>(&n), sizeof(n));
+    for (const auto &id : ids) {
+        uint32_t len = (uint32_t)id.size();
+        ids_data.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        ids_data.append(id);
+    }
+    ++key_count;
+}
+
+void BTreeFileWriter::finish() {
+    flush_leaf(false);
+    uint32_t height = 1;
+    while (level.size() > 1) {
+        Vector<BTreePageEntry> parents;
+        for (size_t i = 0; i < level.size(); i += BTREE_PAGE_CAPACITY) {
+            size_t n = level.size() - i < BTREE_PAGE_CAPACITY ? level.size() - i : BTREE_PAGE_CAPACITY;
+            std::string body(reinterpret_cast<const char*>(&level[i]), n * sizeof(BTreePageEntry));
+            uint64_t no = append_page(false, body, (uint16_t)n, 0);
+            parents.push_back(BTreePageEntry{level[i].key, no});
+        }
+        level = parents;
+        ++height;
+    }
+
+    BTreeFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BTREE_MAGIC, sizeof(BTREE_MAGIC));
+    h.version = BTREE_VERSION;
+    h.page_size = BTREE_PAGE_SIZE;
+    h.page_count = pages.size() / BTREE_PAGE_SIZE;
+    h.root_page = level[0].value;
+    h.key_count = key_count;
+    h.ids_offset = (h.page_count + 1) * BTREE_PAGE_SIZE;
+    h.height = height;
+
+    std::string data(reinterpret_cast<const char*>(&h), sizeof(h));
+    data.append(BTREE_PAGE_SIZE - sizeof(h), '\0');
+    data.append(pages);
+    data.append(ids_data);
+    write_file_atomic(path, data);
+}
@@ -1,106 +1,483 @@
 #include "../include/btree_index.hpp"
-#include <iostream>
+#include "../include/algorithms.hpp"
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-BTreeNode::BTreeNode(bool isLeaf) : leaf(isLeaf) {}
+BTreeIndex::BTreeIndex(int fanout) : max_keys(fanout), root(0) {
+    if (fanout < MIN_FANOUT || fanout > MAX_FANOUT) {
+        throw std::runtime_error("B-tree fanout must be between " + std::to_string(MIN_FANOUT)
+                                 + " and " + std::to_string(MAX_FANOUT));
+    }
+    root = new_node(true);
+}
+
+int BTreeIndex::fanout() const { return max_keys; }
 
-BTreeIndex::BTreeIndex(int t) : t(t), root(std::make_shared<BTreeNode>(true)) {}
+// Number of the n sorted keys that are < k, or <= k when Inclusive. Halves
+// the range without branching until at most 16 keys are left, then
+// compares those two at a time and counts the mask bits.
+template<bool Inclusive>
+static inline int rank(const double *keys, int n, double k) {
+    const double *base = keys;
+    while (n > 16) {
+        int half = n / 2;
+        double probe = base[half - 1];
+        base = (Inclusive ? probe <= k : probe < k) ? base + half : base;
+        n -= half;
+    }
+    int count = 0, i = 0;
+#ifdef __SSE2__
+    __m128d key = _mm_set1_pd(k);
+    for (; i + 2 <= n; i += 2) {
+        __m128d v = _mm_loadu_pd(base + i);
+        count += __builtin_popcount(_mm_movemask_pd(Inclusive ? _mm_cmple_pd(v, key) : _mm_cmplt_pd(v, key)));
+    }
+#endif
+    for (; i < n; ++i) count += Inclusive ? base[i] <= k : base[i] < k;
+    return (int)(base - keys) + count;
+}
 
-void BTreeIndex::splitChild(std::shared_ptr<BTreeNode> x, int i, std::shared_ptr<BTreeNode> y) {
-    auto z = std::make_shared<BTreeNode>(y->leaf);
-    for (int j = 0; j < t - 1; j++) {
-        z->keys.push_back(y->keys[j + t]);
-        z->ids.push_back(y->ids[j + t]);
+// The arrays grow by doubling; Vector::resize alone would reallocate for
+// every new node.
+uint32_t BTreeIndex::new_node(bool leaf) {
+    if (!free_nodes.empty()) {
+        uint32_t node = free_nodes.back();
+        free_nodes.pop_back();
+        counts[node] = 0;
+        leaves[node] = leaf ? 1 : 0;
+        for (int j = 0; j < max_keys; ++j) node_ids(node)[j] = Vector<std::string>();
+        node_refs(node)[max_keys] = NO_NODE;
+        return node;
     }
-    if (!y->leaf) {
-        for (int j = 0; j < t; j++) z->children.push_back(y->children[j + t]);
+    uint32_t node = (uint32_t)counts.size();
+    if (counts.size() == counts.capacity()) {
+        size_t cap = counts.capacity() < 4 ? 4 : counts.capacity() * 2;
+        keys.reserve(cap * max_keys);
+        refs.reserve(cap * (max_keys + 1));
+        ids.reserve(cap * max_keys);
+        counts.reserve(cap);
+        leaves.reserve(cap);
+    }
+    keys.resize(keys.size() + max_keys);
+    refs.resize(refs.size() + max_keys + 1);
+    ids.resize(ids.size() + max_keys);
+    counts.push_back(0);
+    leaves.push_back(leaf ? 1 : 0);
+    if (leaf) node_refs(node)[max_keys] = NO_NODE;
+    return node;
+}
+
+// Splits the full child i of `parent`, which has room for one more key. A
+// leaf moves its upper half to a new leaf and copies the new leaf's first
+// key up; an inner node moves its median key up.
+void BTreeIndex::split_child(uint32_t parent, int i) {
+    uint32_t left = node_refs(parent)[i];
+    bool leaf = leaves[left];
+    uint32_t right = new_node(leaf);
+    double *lk = node_keys(left), *rk = node_keys(right);
+    uint32_t *lr = node_refs(left), *rr = node_refs(right);
+    int n = counts[left], half = n / 2;
+    double separator;
+    if (leaf) {
+        int moved = n - half;
+        memcpy(rk, lk + half, moved * sizeof(double));
+        Vector<std::string> *li = node_ids(left), *ri = node_ids(right);
+        for (int j = 0; j < moved; ++j) ri[j] = std::move(li[half + j]);
+        rr[max_keys] = lr[max_keys];
+        lr[max_keys] = right;
+        counts[left] = half;
+        counts[right] = moved;
+        separator = rk[0];
+    } else {
+        int moved = n - half - 1;
+        memcpy(rk, lk + half + 1, moved * sizeof(double));
+        memcpy(rr, lr + half + 1, (moved + 1) * sizeof(uint32_t));
+        counts[left] = half;
+        counts[right] = moved;
+        separator = lk[half];
     }
-    y->keys.resize(t - 1);
-    y->ids.resize(t - 1);
-    if (!y->leaf) y->children.resize(t);
 
-    x->children.insert(i + 1, z);
-    x->keys.insert(i, y->keys[t - 1]);
-    x->ids.insert(i, y->ids[t - 1]);
+    double *pk = node_keys(parent);
+    uint32_t *pr = node_refs(parent);
+    int pn = counts[parent];
+    memmove(pk + i + 1, pk + i, (pn - i) * sizeof(double));
+    memmove(pr + i + 2, pr + i + 1, (pn - i) * sizeof(uint32_t));
+    pk[i] = separator;
+    pr[i + 1] = right;
+    counts[parent] = pn + 1;
 }
 
-void BTreeIndex::insertNonFull(std::shared_ptr<BTreeNode> x, double k, const std::string &id) {
-    int i = (int)x->keys.size() - 1;
-    if (x->leaf) {
-        while (i >= 0 && k < x->keys[i]) i--;
-        if (i >= 0 && x->keys[i] == k) {
-            x->ids[i].push_back(id);
-            return;
+void BTreeIndex::insert(double key, const std::string &id) {
+    // Re-adding an entry of the base file only lifts its tombstone.
+    if (!tombstones.empty() && tombstones.erase(std::make_pair(key, id))) return;
+    if (counts[root] == max_keys) {
+        uint32_t top = new_node(false);
+        node_refs(top)[0] = root;
+        root = top;
+        split_child(top, 0);
+    }
+
+    uint32_t node = root;
+    while (!leaves[node]) {
+        int i = rank<true>(node_keys(node), counts[node], key);
+        uint32_t child = node_refs(node)[i];
+        if (counts[child] == max_keys) {
+            split_child(node, i);
+            if (key >= node_keys(node)[i]) ++i;
+            child = node_refs(node)[i];
         }
+        node = child;
+    }
+
+    double *k = node_keys(node);
+    Vector<std::string> *lists = node_ids(node);
+    int n = counts[node];
+    int i = rank<false>(k, n, key);
+    if (i < n && k[i] == key) {
+        lists[i].push_back(id);
+        return;
+    }
+    memmove(k + i + 1, k + i, (n - i) * sizeof(double));
+    for (int j = n; j > i; --j) lists[j] = std::move(lists[j - 1]);
+    k[i] = key;
+    lists[i] = Vector<std::string>();
+    lists[i].push_back(id);
+    counts[node] = n + 1;
+}
 
-        x->keys.insert(i + 1, k);
-        Vector<std::string> new_id_vec;
-        new_id_vec.push_back(id);
-        x->ids.insert(i + 1, new_id_vec);
+bool BTreeIndex::remove(double key, const std::string &id) {
+    if (remove_from_tree(key, id)) {
+        // Packs the tree again once most of its nodes are free.
+        if (free_nodes.size() > 1024 && free_nodes.size() * 2 > counts.size()) {
+            auto pairs = tree_pairs();
+            bulk_load(pairs);
+        }
+        return true;
+    }
+    if (!base) return false;
+    Vector<std::string> in_base;
+    base->search(key, in_base);
+    bool found = false;
+    for (const auto &current : in_base) found = found || current == id;
+    if (!found || !tombstones.insert(std::make_pair(key, id)).second) return false;
+    if (tombstones.size() > 1024 && tombstones.size() * 2 > base->key_count()) compact();
+    return true;
+}
+
+bool BTreeIndex::remove_from_tree(double key, const std::string &id) {
+    // (parent, child index) for every step of the descent.
+    Vector<std::pair<uint32_t, int>> path;
+    uint32_t node = root;
+    while (!leaves[node]) {
+        int i = rank<true>(node_keys(node), counts[node], key);
+        path.push_back(std::make_pair(node, i));
+        node = node_refs(node)[i];
+    }
+
+    double *k = node_keys(node);
+    Vector<std::string> *lists = node_ids(node);
+    int n = counts[node];
+    int i = rank<false>(k, n, key);
+    if (i == n || k[i] != key) return false;
+    Vector<std::string> &list = lists[i];
+    size_t pos = 0;
+    while (pos < list.size() && list[pos] != id) ++pos;
+    if (pos == list.size()) return false;
+    list.erase(pos);
+    if (!list.empty()) return true;
+
+    memmove(k + i, k + i + 1, (n - i - 1) * sizeof(double));
+    for (int j = i; j + 1 < n; ++j) lists[j] = std::move(lists[j + 1]);
+    lists[n - 1] = Vector<std::string>();
+    counts[node] = n - 1;
+
+    int min = max_keys / 2;
+    while (!path.empty() && counts[node] < min) {
+        uint32_t parent = path.back().first;
+        int c = path.back().second;
+        path.pop_back();
+        const uint32_t *pr = node_refs(parent);
+        if (c > 0 && counts[pr[c - 1]] > min) {
+            borrow_from_left(parent, c);
+            break;
+        }
+        if (c < counts[parent] && counts[pr[c + 1]] > min) {
+            borrow_from_right(parent, c);
+            break;
+        }
+        merge_children(parent, c > 0 ? c - 1 : c);
+        node = parent;
+    }
+    if (!leaves[root] && counts[root] == 0) {
+        free_nodes.push_back(root);
+        root = node_refs(root)[0];
+    }
+    return true;
+}
+
+// Moves the last entry of child i - 1 to the front of child i.
+void BTreeIndex::borrow_from_left(uint32_t parent, int i) {
+    uint32_t left = node_refs(parent)[i - 1], node = node_refs(parent)[i];
+    double *lk = node_keys(left), *k = node_keys(node);
+    int ln = counts[left], n = counts[node];
+    memmove(k + 1, k, n * sizeof(double));
+    if (leaves[node]) {
+        Vector<std::string> *ll = node_ids(left), *lists = node_ids(node);
+        for (int j = n; j > 0; --j) lists[j] = std::move(lists[j - 1]);
+        k[0] = lk[ln - 1];
+        lists[0] = std::move(ll[ln - 1]);
+        node_keys(parent)[i - 1] = k[0];
+    } else {
+        uint32_t *r = node_refs(node);
+        memmove(r + 1, r, (n + 1) * sizeof(uint32_t));
+        k[0] = node_keys(parent)[i - 1];
+        r[0] = node_refs(left)[ln];
+        node_keys(parent)[i - 1] = lk[ln - 1];
+    }
+    counts[left] = ln - 1;
+    counts[node] = n + 1;
+}
+
+// Moves the first entry of child i + 1 to the end of child i.
+void BTreeIndex::borrow_from_right(uint32_t parent, int i) {
+    uint32_t node = node_refs(parent)[i], right = node_refs(parent)[i + 1];
+    double *k = node_keys(node), *rk = node_keys(right);
+    int n = counts[node], rn = counts[right];
+    if (leaves[node]) {
+        Vector<std::string> *lists = node_ids(node), *rl = node_ids(right);
+        k[n] = rk[0];
+        lists[n] = std::move(rl[0]);
+        for (int j = 0; j + 1 < rn; ++j) rl[j] = std::move(rl[j + 1]);
+        memmove(rk, rk + 1, (rn - 1) * sizeof(double));
+        node_keys(parent)[i] = rk[0];
     } else {
-        while (i >= 0 && k < x->keys[i]) i--;
-        i++;
-        if ((int)x->children[i]->keys.size() == 2*t - 1) {
-            splitChild(x, i, x->children[i]);
-            if (k > x->keys[i]) i++;
+        uint32_t *r = node_refs(node), *rr = node_refs(right);
+        k[n] = node_keys(parent)[i];
+        r[n + 1] = rr[0];
+        node_keys(parent)[i] = rk[0];
+        memmove(rk, rk + 1, (rn - 1) * sizeof(double));
+        memmove(rr, rr + 1, rn * sizeof(uint32_t));
+    }
+    counts[node] = n + 1;
+    counts[right] = rn - 1;
+}
+
+// Appends child i + 1 to child i and drops it from the parent. Called only
+// when the two fit into one node.
+void BTreeIndex::merge_children(uint32_t parent, int i) {
+    uint32_t left = node_refs(parent)[i], right = node_refs(parent)[i + 1];
+    double *lk = node_keys(left), *rk = node_keys(right);
+    int ln = counts[left], rn = counts[right];
+    if (leaves[left]) {
+        Vector<std::string> *ll = node_ids(left), *rl = node_ids(right);
+        for (int j = 0; j < rn; ++j) {
+            lk[ln + j] = rk[j];
+            ll[ln + j] = std::move(rl[j]);
         }
-        insertNonFull(x->children[i], k, id);
+        node_refs(left)[max_keys] = node_refs(right)[max_keys];
+        counts[left] = ln + rn;
+    } else {
+        lk[ln] = node_keys(parent)[i];
+        memcpy(lk + ln + 1, rk, rn * sizeof(double));
+        memcpy(node_refs(left) + ln + 1, node_refs(right), (rn + 1) * sizeof(uint32_t));
+        counts[left] = ln + rn + 1;
     }
+    free_nodes.push_back(right);
+
+    double *pk = node_keys(parent);
+    uint32_t *pr = node_refs(parent);
+    int pn = counts[parent];
+    memmove(pk + i, pk + i + 1, (pn - i - 1) * sizeof(double));
+    memmove(pr + i + 1, pr + i + 2, (pn - i - 1) * sizeof(uint32_t));
+    counts[parent] = pn - 1;
 }
 
-void BTreeIndex::insert(double key, const std::string &id) {
-    if ((int)root->keys.size() == 2*t - 1) {
-        auto s = std::make_shared<BTreeNode>(false);
-        s->children.push_back(root);
-        splitChild(s, 0, root);
-        root = s;
+std::vector<std::pair<double, std::string>> BTreeIndex::tree_pairs() const {
+    std::vector<std::pair<double, std::string>> pairs;
+    for (uint32_t leaf = find_leaf(-std::numeric_limits<double>::infinity()); leaf != NO_NODE;
+         leaf = node_refs(leaf)[max_keys]) {
+        for (int i = 0; i < counts[leaf]; ++i) {
+            for (const auto &id : node_ids(leaf)[i]) pairs.emplace_back(node_keys(leaf)[i], id);
+        }
     }
-    insertNonFull(root, key, id);
+    return pairs;
 }
 
-Vector<std::string> BTreeIndex::searchNode(std::shared_ptr<BTreeNode> x, double k) const {
-    int i = 0;
-    while (i < (int)x->keys.size() && k > x->keys[i]) i++;
-    if (i < (int)x->keys.size() && k == x->keys[i]) return x->ids[i];
-    if (x->leaf) return Vector<std::string>();
-    return searchNode(x->children[i], k);
+// Loads the live entries of the base file together with the in-memory
+// ones into a fresh tree and drops the base and its tombstones.
+void BTreeIndex::compact() {
+    Vector<std::pair<double, std::string>> from_base;
+    base->range(-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+                true, true, from_base);
+    std::vector<std::pair<double, std::string>> pairs;
+    pairs.reserve(from_base.size());
+    for (auto &p : from_base) {
+        if (!tombstones.count(p)) pairs.push_back(std::move(p));
+    }
+    size_t from_file = pairs.size();
+    for (auto &p : tree_pairs()) pairs.push_back(std::move(p));
+    std::inplace_merge(pairs.begin(), pairs.begin() + from_file, pairs.end(),
+                       [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b) {
+                           return a.first < b.first;
+                       });
+    base.reset();
+    tombstones.clear();
+    bulk_load(pairs);
 }
 
-Vector<std::string> BTreeIndex::search(double key) const {
-    return searchNode(root, key);
-}
-
-void BTreeIndex::rangeSearchNode(std::shared_ptr<BTreeNode> x, double low, double high, bool includeLow, bool includeHigh, Vector<std::string> &result) const {
-    int i;
-    for (i = 0; i < (int)x->keys.size(); i++) {
-        if (!x->leaf) rangeSearchNode(x->children[i], low, high, includeLow, includeHigh, result);
-        double k = x->keys[i];
-        bool inRange = (k > low || (includeLow && k == low)) && (k < high || (includeHigh && k == high));
-        if (inRange) {
-            for (const auto& id : x->ids[i]) {
-                result.push_back(id);
+// Spreads `items` over as few nodes of at most `per_node` items as possible,
+// evenly, so that no node ends up nearly empty. Returns the node sizes.
+static Vector<size_t> even_split(size_t items, size_t per_node) {
+    Vector<size_t> sizes;
+    size_t nodes = (items + per_node - 1) / per_node;
+    for (size_t i = 0; i < nodes; ++i) sizes.push_back(items / nodes + (i < items % nodes ? 1 : 0));
+    return sizes;
+}
+
+void BTreeIndex::bulk_load(std::vector<std::pair<double, std::string>> &pairs) {
+    auto kept = base;
+    auto kept_tombstones = std::move(tombstones);
+    *this = BTreeIndex(max_keys);
+    base = kept;
+    tombstones = std::move(kept_tombstones);
+    if (pairs.empty()) return;
+
+    size_t distinct = 1;
+    for (size_t i = 1; i < pairs.size(); ++i) distinct += pairs[i].first != pairs[i - 1].first;
+    Vector<size_t> leaf_sizes = even_split(distinct, max_keys);
+    size_t total_nodes = leaf_sizes.size() * 2 + 1;
+    keys.clear();
+    refs.clear();
+    ids.clear();
+    counts.clear();
+    leaves.clear();
+    keys.reserve(total_nodes * max_keys);
+    refs.reserve(total_nodes * (max_keys + 1));
+    ids.reserve(total_nodes * max_keys);
+    counts.reserve(total_nodes);
+    leaves.reserve(total_nodes);
+
+    // Level being built: first key and node number of every node.
+    Vector<std::pair<double, uint32_t>> level;
+    size_t p = 0;
+    for (size_t size : leaf_sizes) {
+        uint32_t leaf = new_node(true);
+        double *k = node_keys(leaf);
+        Vector<std::string> *lists = node_ids(leaf);
+        for (size_t slot = 0; slot < size; ++slot) {
+            k[slot] = pairs[p].first;
+            do {
+                lists[slot].push_back(std::move(pairs[p].second));
+                ++p;
+            } while (p < pairs.size() && pairs[p].first == k[slot]);
+        }
+        counts[leaf] = (uint16_t)size;
+        if (!level.empty()) node_refs(level.back().second)[max_keys] = leaf;
+        level.push_back(std::make_pair(k[0], leaf));
+    }
+
+    while (level.size() > 1) {
+        Vector<std::pair<double, uint32_t>> parents;
+        size_t c = 0;
+        for (size_t size : even_split(level.size(), max_keys + 1)) {
+            uint32_t node = new_node(false);
+            for (size_t j = 0; j < size; ++j, ++c) {
+                node_refs(node)[j] = level[c].second;
+                if (j > 0) node_keys(node)[j - 1] = level[c].first;
             }
+            counts[node] = (uint16_t)(size - 1);
+            parents.push_back(std::make_pair(level[c - size].first, node));
         }
+        level = std::move(parents);
+    }
+    root = level[0].second;
+}
+
+uint32_t BTreeIndex::find_leaf(double k) const {
+    uint32_t node = root;
+    while (!leaves[node]) node = node_refs(node)[rank<true>(node_keys(node), counts[node], k)];
+    return node;
+}
+
+Vector<std::string> BTreeIndex::search(double key) const {
+    Vector<std::string> result;
+    if (base) base->search(key, result);
+    if (!tombstones.empty()) {
+        size_t removed = custom_remove_if(result.begin(), result.end(), [&](const std::string &id) {
+            return tombstones.count(std::make_pair(key, id)) > 0;
+        });
+        result.resize(result.size() - removed);
+    }
+    uint32_t leaf = find_leaf(key);
+    const double *k = node_keys(leaf);
+    int i = rank<false>(k, counts[leaf], key);
+    if (i < counts[leaf] && k[i] == key) {
+        for (const auto &id : node_ids(leaf)[i]) result.push_back(id);
     }
-    if (!x->leaf) rangeSearchNode(x->children[i], low, high, includeLow, includeHigh, result);
+    return result;
 }
 
 Vector<std::string> BTreeIndex::rangeSearch(double low, double high, bool includeLow, bool includeHigh) const {
+    Vector<std::pair<double, std::string>> from_base, from_memory;
+    if (base) base->range(low, high, includeLow, includeHigh, from_base);
+    if (!tombstones.empty()) {
+        size_t removed = custom_remove_if(from_base.begin(), from_base.end(), [&](const std::pair<double, std::string> &p) {
+            return tombstones.count(p) > 0;
+        });
+        from_base.resize(from_base.size() - removed);
+    }
+
+    uint32_t leaf = find_leaf(low);
+    int i = includeLow ? rank<false>(node_keys(leaf), counts[leaf], low)
+                       : rank<true>(node_keys(leaf), counts[leaf], low);
+    while (leaf != NO_NODE) {
+        const double *k = node_keys(leaf);
+        const Vector<std::string> *lists = node_ids(leaf);
+        int n = counts[leaf];
+        for (; i < n; ++i) {
+            if (k[i] > high || (k[i] == high && !includeHigh)) { leaf = NO_NODE; break; }
+            for (const auto &id : lists[i]) from_memory.push_back(std::make_pair(k[i], id));
+        }
+        if (leaf != NO_NODE) leaf = node_refs(leaf)[max_keys];
+        i = 0;
+    }
+
     Vector<std::string> result;
-    rangeSearchNode(root, low, high, includeLow, includeHigh, result);
+    if (from_base.empty()) {
+        for (auto &p : from_memory) result.push_back(std::move(p.second));
+        return result;
+    }
+    size_t a = 0, b = 0;
+    while (a < from_base.size() || b < from_memory.size()) {
+        if (b == from_memory.size() || (a < from_base.size() && from_base[a].first <= from_memory[b].first)) {
+            result.push_back(from_base[a++].second);
+        } else {
+            result.push_back(from_memory[b++].second);
+        }
+    }
     return result;
 }
 
-json BTreeIndex::to_json(std::shared_ptr<BTreeNode> node) const {
-    if (!node) node = root;
-    json j;
-    j["leaf"] = node->leaf;
-    j["keys"] = node->keys;
-    j["ids"] = node->ids;
-    if (!node->leaf) {
-        j["children"] = json::array();
-        for (auto &ch : node->children) j["children"].push_back(to_json(ch));
+// Written as a single leaf holding every key in order, which load_entries
+// reads like any other tree.
+json BTreeIndex::to_json() const {
+    json key_list = json::array(), id_list = json::array();
+    uint32_t leaf = find_leaf(-std::numeric_limits<double>::infinity());
+    while (leaf != NO_NODE) {
+        for (int i = 0; i < counts[leaf]; ++i) {
+            key_list.push_back(node_keys(leaf)[i]);
+            json list = json::array();
+            for (const auto &id : node_ids(leaf)[i]) list.push_back(id);
+            id_list.push_back(list);
+        }
+        leaf = node_refs(leaf)[max_keys];
     }
-    return j;
+    return {{"leaf", true}, {"keys", key_list}, {"ids", id_list}};
 }
 
 template<typename T>
@@ -112,25 +489,50 @@ Vector<T> json_to_vector(const json& j) {
     return result;
 }
 
-std::shared_ptr<BTreeNode> BTreeIndex::load_node(const json &j) const {
-    auto node = std::make_shared<BTreeNode>(j["leaf"]);
-
-    node->keys = json_to_vector<double>(j["keys"]);
-
-    Vector<Vector<std::string>> ids_vec;
-    for (const auto& id_array : j["ids"]) {
-        ids_vec.push_back(json_to_vector<std::string>(id_array));
+// Collects (key, ids) in key order. Inner nodes of the older B-tree layout
+// carry ids of their own; B+tree inner nodes have none.
+void BTreeIndex::load_entries(const json &j, Vector<std::pair<double, Vector<std::string>>> &out) {
+    const json &keys = j["keys"];
+    const json &ids = j["ids"];
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!j["leaf"].get<bool>()) load_entries(j["children"][i], out);
+        if (i < ids.size()) out.push_back(std::make_pair(keys[i].get<double>(), json_to_vector<std::string>(ids[i])));
     }
-    node->ids = ids_vec;
+    if (!j["leaf"].get<bool>()) load_entries(j["children"][keys.size()], out);
+}
 
-    if (!node->leaf) {
-        for (auto &child : j["children"]) {
-            node->children.push_back(load_node(child));
-        }
+void BTreeIndex::from_json(const json &j) {
+    Vector<std::pair<double, Vector<std::string>>> entries;
+    load_entries(j, entries);
+    std::vector<std::pair<double, std::string>> pairs;
+    for (const auto &e : entries) {
+        for (const auto &id : e.second) pairs.emplace_back(e.first, id);
     }
-    return node;
+    std::stable_sort(pairs.begin(), pairs.end(),
+                     [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b) {
+                         return a.first < b.first;
+                     });
+    bulk_load(pairs);
 }
 
-void BTreeIndex::from_json(const json &j) {
-    root = load_node(j);
+void BTreeIndex::set_base(std::shared_ptr<const BTreeFile> file) {
+    base = file;
+    tombstones.clear();
+}
+
+json BTreeIndex::stats() const {
+    size_t keys_in_memory = 0, ids_in_memory = 0;
+    for (uint32_t leaf = find_leaf(-std::numeric_limits<double>::infinity()); leaf != NO_NODE;
+         leaf = node_refs(leaf)[max_keys]) {
+        keys_in_memory += counts[leaf];
+        for (int i = 0; i < counts[leaf]; ++i) ids_in_memory += node_ids(leaf)[i].size();
+    }
+    return {
+        {"fanout", max_keys},
+        {"nodes", counts.size() - free_nodes.size()},
+        {"keys", keys_in_memory},
+        {"ids", ids_in_memory},
+        {"base_keys", base ? base->key_count() : 0},
+        {"tombstones", tombstones.size()}
+    };
 }
@@ -4,224 +4,1037 @@
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <vector>
 
-Collection::Collection(const std::string &db_path, const std::string &name)
+// Delta files a hash or B-tree index file collects before a checkpoint
+// writes the index out in full again.
+static const size_t MAX_INDEX_DELTAS = 8;
+
+Collection::Collection(const std::string &db_path, const std::string &name, const CollectionOptions &requested)
 : dbpath(db_path), collname(name) {
     collfile = dbpath + "/" + collname + ".json";
+    segfile = dbpath + "/" + collname + ".seg";
     indexdir = dbpath + "/indexes";
+    walfile = dbpath + "/" + collname + ".wal";
+    catalogfile = indexdir + "/" + collname + ".catalog.json";
+    metafile = dbpath + "/" + collname + ".meta.json";
+    checkpoint_wal_bytes = 64 * 1024 * 1024;
     std::filesystem::create_directories(dbpath);
+    load_options(requested);
+    if (!options.partition_field.empty()) {
+        partitions = std::make_unique<PartitionSet>(dbpath, collname, options);
+        return;
+    }
+    store = make_engine();
+    segfile = dbpath + "/" + collname + store->file_extension();
     std::filesystem::create_directories(indexdir);
+    wal = std::make_unique<WriteAheadLog>(walfile);
     load();
 }
 
-Collection::~Collection() { save(); }
+Collection::~Collection() {
+    if (partitions || discarded) return;
+    try {
+        wait_for_checkpoint();
+        save();
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to save collection '" << collname << "': " << e.what() << std::endl;
+    }
+}
 
 std::string Collection::insert(json doc) {
+    if (partitions) return partitions->insert(doc);
     if (!doc.is_object()) throw std::runtime_error("Document must be an object");
     std::string id = gen_id();
     doc["_id"] = id;
-    store.put(id, doc);
+    auto bytes = json::to_msgpack(doc);
+    wal->append(WAL_INSERT, std::string(bytes.begin(), bytes.end()));
+    apply_insert(id, doc);
+    return id;
+}
+
+// Inserts a document under its existing _id; used when moving documents
+// between collections.
+void Collection::restore(const json &doc) {
+    if (partitions) return partitions->restore(doc);
+    if (!doc.is_object() || !doc.contains("_id") || !doc["_id"].is_string()) {
+        throw std::runtime_error("Restored document must have a string _id");
+    }
+    auto bytes = json::to_msgpack(doc);
+    wal->append(WAL_INSERT, std::string(bytes.begin(), bytes.end()));
+    apply_insert(doc["_id"].get<std::string>(), doc);
+}
+
+void Collection::apply_insert(const std::string &id, const json &doc) {
+    json old;
+    bool existed = store->get(id, old);
+    if (pending_build) record_for_build(id, existed ? old : json());
+    if (existed) unindex_document(id, old);
+    store->put(id, doc);
+    index_document(id, doc);
+}
+
+bool Collection::apply_delete(const std::string &id) {
+    json doc;
+    if (!store->get(id, doc)) return false;
+    if (pending_build) record_for_build(id, doc);
+    store->remove(id);
+    unindex_document(id, doc);
+    return true;
+}
 
-    auto index_items = indexes.items();
-    for (const auto& item : index_items) {
-        const std::string& field = item.first;
-        if (doc.contains(field)) {
+void Collection::index_document(const std::string &id, const json &doc) {
+    indexes.for_each([&](const std::string &field, HashMap<Vector<std::string>> &field_index) {
+        if (doc.contains(field) && indexed_by("hash", field, doc)) {
             std::string key = index_key_for_value(doc[field]);
-            HashMap<Vector<std::string>> field_index = item.second;
-            Vector<std::string> ids;
-            field_index.get(key, ids);
-            ids.push_back(id);
-            field_index.put(key, ids);
-            indexes.put(field, field_index);
+            field_index.find_or_insert(key).push_back(id);
+            index_changes.find_or_insert("hash:" + field).push_back(IndexChange{true, key, id});
         }
-    }
+    });
 
-    auto btree_items = btree_indexes.items();
-    for (const auto& item : btree_items) {
-        const std::string& field = item.first;
-        if (doc.contains(field) && doc[field].is_number()) {
-            BTreeIndex bt = item.second;
+    btree_indexes.for_each([&](const std::string &field, BTreeIndex &bt) {
+        if (doc.contains(field) && doc[field].is_number() && indexed_by("btree", field, doc)) {
             bt.insert(doc[field].get<double>(), id);
-            btree_indexes.put(field, bt);
+            index_changes.find_or_insert("btree:" + field).push_back(IndexChange{true, doc[field], id});
+        }
+    });
+
+    ordered_indexes.for_each([&](const std::string &spec, OrderedIndex &ordered) {
+        if (!indexed_by("ordered", spec, doc)) return;
+        ordered.insert(doc, id);
+        dirty_indexes.put("ordered:" + spec, true);
+    });
+
+    trigram_indexes.for_each([&](const std::string &field, TrigramIndex &trigrams) {
+        if (doc.contains(field) && doc[field].is_string() && indexed_by("trigram", field, doc)) {
+            trigrams.insert(doc, id);
+            dirty_indexes.put("trigram:" + field, true);
+        }
+    });
+
+    text_indexes.for_each([&](const std::string &field, TextIndex &text) {
+        if (doc.contains(field) && doc[field].is_string() && indexed_by("text", field, doc)) {
+            text.insert(doc, id);
+            dirty_indexes.put("text:" + field, true);
+        }
+    });
+
+    ttl_indexes.for_each([&](const std::string &field, TtlIndex &ttl) {
+        if (doc.contains(field) && indexed_by("ttl", field, doc)) {
+            ttl.insert(doc, id);
+            dirty_indexes.put("ttl:" + field, true);
         }
+    });
+
+    if (!bitmaps.empty()) {
+        bitmaps.insert(doc, id);
+        dirty_indexes.put("bitmap:" + bitmaps.spec(), true);
     }
 
-    return id;
+    if (!blocks.empty()) {
+        blocks.insert(doc, id);
+        dirty_indexes.put("blocks:" + blocks.spec(), true);
+        if (tracking_block_changes) blocks_changed.put(id, true);
+    }
 }
 
-Vector<json> Collection::find(const json &query) {
-    Vector<json> res;
+// The documents of a snapshot that match a partial index's filter.
+class FilteredSnapshot : public StorageSnapshot {
+public:
+    FilteredSnapshot(const StorageSnapshot &all, const json &filter) : all(all), filter(filter) {}
+    size_t size() const override { return all.size(); }
+    void for_each(const Visitor &fn) const override {
+        all.for_each([&](const std::string &id, const json &doc) {
+            if (evaluate_query(doc, filter)) fn(id, doc);
+        });
+    }
+    void write(const std::string &, uint64_t) const override {
+        throw std::runtime_error("A filtered snapshot cannot be written");
+    }
 
-    if (query.is_object() && query.size() == 1 && !query.contains("$or")) {
-        auto it = query.begin();
-        std::string field = it.key();
-        const json &cond = it.value();
+private:
+    const StorageSnapshot &all;
+    const json &filter;
+};
 
-        BTreeIndex bt;
-        if (btree_indexes.get(field, bt) && cond.is_object()) {
-            Vector<std::string> ids;
+static void sort_ids(Vector<std::string> &ids) {
+    std::sort(ids.begin(), ids.end());
+    ids.resize(std::unique(ids.begin(), ids.end()) - ids.begin());
+}
+
+// Whether the document belongs in the index: always, unless the index is
+// partial and the document does not match its filter.
+bool Collection::indexed_by(const std::string &type, const std::string &name, const json &doc) const {
+    if (index_filters.size() == 0) return true;
+    const json *filter = index_filters.find(type + ":" + name);
+    return !filter || evaluate_query(doc, *filter);
+}
+
+// Whether the index may serve a query: a partial index only holds the
+// documents of its filter, so every match of the query must match it too.
+bool Collection::filter_implied(const std::string &type, const std::string &name, const json &context) const {
+    if (index_filters.size() == 0) return true;
+    const json *filter = index_filters.find(type + ":" + name);
+    return !filter || query_implies(context, *filter);
+}
 
-            if (cond.contains("$eq"))
-                ids = bt.search(cond["$eq"].get<double>());
-            else if (cond.contains("$gt") && cond.contains("$lt"))
-                ids = bt.rangeSearch(cond["$gt"].get<double>(), cond["$lt"].get<double>());
-            else if (cond.contains("$gt"))
-                ids = bt.rangeSearch(cond["$gt"].get<double>(), 1e18);
-            else if (cond.contains("$lt"))
-                ids = bt.rangeSearch(-1e18, cond["$lt"].get<double>());
-
-            if (!ids.empty()) {
-                for (auto &id : ids) {
-                    json d;
-                    if (store.get(id, d)) res.push_back(d);
+// Candidate ids for one field condition from an index on that field, or
+// false when none of them serves the condition. `context` is everything
+// the matching documents are known to satisfy, for partial indexes.
+bool Collection::field_candidates(const std::string &field, const json &cond, Vector<std::string> &ids,
+                                  const json &context) {
+    json single = {{field, cond}};
+
+    const TextIndex *text = text_indexes.find(field);
+    if (text && text->usable(single) && filter_implied("text", field, context)) {
+        ids = text->lookup(single);
+        return true;
+    }
+
+    const TrigramIndex *trigrams = trigram_indexes.find(field);
+    if (trigrams && trigrams->usable(single) && filter_implied("trigram", field, context)) {
+        ids = trigrams->lookup(single);
+        return true;
+    }
+
+    RoaringBitmap rows;
+    if (bitmaps.field_rows(field, cond, rows)) {
+        ids = bitmaps.ids_of(rows);
+        return true;
+    }
+
+    const BTreeIndex *bt = btree_indexes.find(field);
+    if (bt && filter_implied("btree", field, context)) {
+        const json *eq = cond.is_object() ? (cond.contains("$eq") ? &cond["$eq"] : nullptr) : &cond;
+        if (eq && eq->is_number()) {
+            ids = bt->search(eq->get<double>());
+            return true;
+        }
+        double low = -1e18, high = 1e18;
+        bool includeLow = false, includeHigh = false, ranged = false;
+        if (cond.is_object()) {
+            for (auto op = cond.begin(); op != cond.end(); ++op) {
+                if (!op.value().is_number()) continue;
+                if (op.key() == "$gt" || op.key() == "$gte") {
+                    low = op.value().get<double>();
+                    includeLow = op.key() == "$gte";
+                    ranged = true;
+                } else if (op.key() == "$lt" || op.key() == "$lte") {
+                    high = op.value().get<double>();
+                    includeHigh = op.key() == "$lte";
+                    ranged = true;
                 }
-                return res;
             }
         }
+        if (ranged) {
+            ids = bt->rangeSearch(low, high, includeLow, includeHigh);
+            return true;
+        }
     }
 
-    bool usedIndex = false;
-    if (query.is_object() && query.size() == 1 && !query.contains("$or")) {
-        auto it = query.begin();
-        std::string field = it.key();
-        const json &cond = it.value();
+    const OrderedIndex *ordered = ordered_indexes.find(field);
+    if (ordered && ordered->usable_fields(single) > 0 && filter_implied("ordered", field, context)) {
+        ids = ordered->lookup(single);
+        return true;
+    }
 
-        HashMap<Vector<std::string>> field_index;
-        if (indexes.get(field, field_index)) {
-            if (!cond.is_object()) {
-                std::string key = index_key_for_value(cond);
-                Vector<std::string> ids;
-                if (field_index.get(key, ids)) {
-                    for (auto &id : ids) {
-                        json d; if (store.get(id, d)) res.push_back(d);
-                    }
-                    usedIndex = true;
-                }
-            } else if (cond.contains("$eq")) {
-                std::string key = index_key_for_value(cond["$eq"]);
-                Vector<std::string> ids;
-                if (field_index.get(key, ids)) {
-                    for (auto &id : ids) {
-                        json d; if (store.get(id, d)) res.push_back(d);
-                    }
-                    usedIndex = true;
-                }
-            } else if (cond.contains("$in")) {
-                for (const auto &v : cond["$in"]) {
-                    std::string key = index_key_for_value(v);
-                    Vector<std::string> ids;
-                    if (field_index.get(key, ids)) {
-                        for (auto &id : ids) {
-                            json d; if (store.get(id, d)) res.push_back(d);
-                        }
-                    }
-                }
-                usedIndex = true;
+    const HashMap<Vector<std::string>> *field_index = indexes.find(field);
+    if (field_index && filter_implied("hash", field, context)) {
+        Vector<const json*> keys;
+        if (!cond.is_object()) keys.push_back(&cond);
+        else if (cond.contains("$eq")) keys.push_back(&cond["$eq"]);
+        else if (cond.contains("$in") && cond["$in"].is_array()) {
+            for (const auto &v : cond["$in"]) keys.push_back(&v);
+        } else return false;
+
+        for (const json *v : keys) {
+            const Vector<std::string> *found = field_index->find(index_key_for_value(*v));
+            if (found) for (const auto &id : *found) ids.push_back(id);
+        }
+        if (keys.size() > 1) sort_ids(ids);
+        return true;
+    }
+    return false;
+}
+
+// Candidate ids for the query, a superset of its matches; false when it
+// can only be answered by a scan. Conjuncts served by an index are
+// intersected and $or branches united, mirroring evaluate_query, which also
+// looks only at $or or $and when the query has them. A single list keeps
+// the order of its index; combined lists are sorted by id. `context` is the
+// whole query; within an $or branch it is narrowed to the branch.
+bool Collection::index_candidates(const json &query, Vector<std::string> &ids, const json &context) {
+    if (!query.is_object()) return false;
+
+    RoaringBitmap rows;
+    if (!bitmaps.empty() && !query.empty() && bitmaps.rows_for(query, rows)) {
+        ids = bitmaps.ids_of(rows);
+        return true;
+    }
+
+    if (query.contains("$or")) {
+        const json &branches = query["$or"];
+        if (!branches.is_array()) return false;
+        for (const auto &branch : branches) {
+            Vector<std::string> part;
+            json narrowed = index_filters.size() == 0 ? json() : json{{"$and", json::array({context, branch})}};
+            if (!index_candidates(branch, part, narrowed)) return false;
+            for (auto &id : part) ids.push_back(std::move(id));
+        }
+        if (branches.size() > 1) sort_ids(ids);
+        return true;
+    }
+
+    Vector<Vector<std::string>> lists;
+    if (query.contains("$and")) {
+        const json &parts = query["$and"];
+        if (!parts.is_array()) return false;
+        for (const auto &sub : parts) {
+            Vector<std::string> part;
+            if (index_candidates(sub, part, context)) lists.push_back(std::move(part));
+        }
+    } else {
+        for (auto it = query.begin(); it != query.end(); ++it) {
+            Vector<std::string> part;
+            if (field_candidates(it.key(), it.value(), part, context)) lists.push_back(std::move(part));
+        }
+
+        // Of the compound indexes, the one covering the most leading fields
+        // adds one more list.
+        const OrderedIndex *best = nullptr;
+        size_t best_fields = 0;
+        ordered_indexes.for_each([&](const std::string &spec, OrderedIndex &ordered) {
+            if (spec.find(',') == std::string::npos || !filter_implied("ordered", spec, context)) return;
+            size_t used = ordered.usable_fields(query);
+            if (used > best_fields) {
+                best = &ordered;
+                best_fields = used;
             }
+        });
+        if (best) lists.push_back(best->lookup(query));
+    }
+
+    if (lists.empty()) return false;
+    if (lists.size() == 1) {
+        ids = std::move(lists[0]);
+        return true;
+    }
+    // Lists much longer than the shortest one would cost more to sort than
+    // the post-filter saves, so they are left to evaluate_query.
+    std::sort(lists.begin(), lists.end(),
+              [](const Vector<std::string> &x, const Vector<std::string> &y) { return x.size() < y.size(); });
+    ids = std::move(lists[0]);
+    sort_ids(ids);
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+        if (lists[i].size() > 32 * (ids.size() + 16)) break;
+        sort_ids(lists[i]);
+        ids = gallop_intersect(ids, lists[i]);
+    }
+    return true;
+}
+
+Vector<json> Collection::find(const json &query) {
+    if (partitions) return partitions->find(query);
+    Vector<json> res;
+
+    Vector<std::string> ids;
+    if (index_candidates(query, ids, query)) {
+        for (const auto &id : ids) {
+            json d;
+            if (store->get(id, d) && evaluate_query(d, query)) res.push_back(d);
         }
+        return res;
     }
 
-    if (!usedIndex) {
-        auto all_items = store.items();
-        for (auto &p : all_items) {
-            if (evaluate_query(p.second, query))
-                res.push_back(p.second);
+    // Without an index, the block zone maps and bloom filters can still
+    // narrow the scan down to the blocks that may hold matches.
+    if (!blocks.empty() && blocks.candidates(query, ids)) {
+        for (const auto &id : ids) {
+            json d;
+            if (store->get(id, d) && evaluate_query(d, query)) res.push_back(d);
         }
+        return res;
     }
 
+    store->for_each([&](const std::string &, const json &doc) {
+        if (evaluate_query(doc, query)) res.push_back(doc);
+    });
+    return res;
+}
+
+// Grouped count without materializing the matching documents when the
+// bitmap indexes cover the query and group_by field, or the engine supports
+// it. Documents without the group_by field are not counted.
+json Collection::count(const json &query, const std::string &group_by, const std::string &bucket) {
+    if (partitions) return partitions->count(query, group_by, bucket);
+    HashMap<uint64_t> counts;
+    bool counted = !bitmaps.empty() && bitmaps.count(query, group_by, bucket, counts);
+    if (!counted && !store->count_by(query, group_by, bucket, counts)) {
+        for (const auto &doc : find(query)) {
+            std::string key;
+            if (!group_by.empty()) {
+                if (!doc.contains(group_by)) continue;
+                key = group_key(doc[group_by], bucket);
+            }
+            uint64_t n = 0;
+            counts.get(key, n);
+            counts.put(key, n + 1);
+        }
+    }
+    json res = json::object();
+    for (const auto &p : counts.items()) res[p.first] = p.second;
     return res;
 }
 
 int Collection::remove(const json &query) {
+    if (partitions) return partitions->remove(query);
     auto found = find(query);
     int cnt = 0;
     for (auto &d : found) {
         std::string id = d["_id"].get<std::string>();
-        if (store.remove(id)) {
+        if (apply_delete(id)) {
+            wal->append(WAL_DELETE, id);
             ++cnt;
-            auto index_items = indexes.items();
-            for (const auto& item : index_items) {
-                const std::string& field = item.first;
-                if (d.contains(field)) {
-                    std::string key = index_key_for_value(d[field]);
-                    HashMap<Vector<std::string>> field_index = item.second;
-                    Vector<std::string> ids;
-                    if (field_index.get(key, ids)) {
-                        size_t removed = custom_remove_if(ids.begin(), ids.end(),
-                                                          [&](const std::string& current_id) { return current_id == id; });
-                        if (removed > 0) {
-                            ids.resize(ids.size() - removed);
-                            if (ids.empty()) {
-                                field_index.remove(key);
-                            } else {
-                                field_index.put(key, ids);
-                            }
-                            indexes.put(field, field_index);
-                        }
-                    }
-                }
-            }
         }
     }
+    return cnt;
+}
 
-    if (cnt > 0) {
-        save();
+static bool remove_from_hash_index(HashMap<Vector<std::string>> &field_index, const std::string &key,
+                                   const std::string &id) {
+    Vector<std::string> *ids = field_index.find(key);
+    if (!ids) return false;
+    size_t removed = custom_remove_if(ids->begin(), ids->end(),
+                                      [&](const std::string& current_id) { return current_id == id; });
+    if (removed == 0) return false;
+    ids->resize(ids->size() - removed);
+    if (ids->empty()) field_index.remove(key);
+    return true;
+}
+
+void Collection::unindex_document(const std::string &id, const json &d) {
+    indexes.for_each([&](const std::string &field, HashMap<Vector<std::string>> &field_index) {
+        if (!d.contains(field) || !indexed_by("hash", field, d)) return;
+        std::string key = index_key_for_value(d[field]);
+        if (remove_from_hash_index(field_index, key, id)) {
+            index_changes.find_or_insert("hash:" + field).push_back(IndexChange{false, key, id});
+        }
+    });
+
+    btree_indexes.for_each([&](const std::string &field, BTreeIndex &bt) {
+        if (d.contains(field) && d[field].is_number() && indexed_by("btree", field, d) && bt.remove(d[field].get<double>(), id)) {
+            index_changes.find_or_insert("btree:" + field).push_back(IndexChange{false, d[field], id});
+        }
+    });
+
+    ordered_indexes.for_each([&](const std::string &spec, OrderedIndex &ordered) {
+        if (!indexed_by("ordered", spec, d)) return;
+        ordered.remove(d, id);
+        dirty_indexes.put("ordered:" + spec, true);
+    });
+
+    trigram_indexes.for_each([&](const std::string &field, TrigramIndex &trigrams) {
+        if (d.contains(field) && d[field].is_string() && indexed_by("trigram", field, d)) {
+            trigrams.remove(d, id);
+            dirty_indexes.put("trigram:" + field, true);
+        }
+    });
+
+    text_indexes.for_each([&](const std::string &field, TextIndex &text) {
+        if (d.contains(field) && d[field].is_string() && indexed_by("text", field, d)) {
+            text.remove(d, id);
+            dirty_indexes.put("text:" + field, true);
+        }
+    });
+
+    ttl_indexes.for_each([&](const std::string &field, TtlIndex &ttl) {
+        if (d.contains(field) && indexed_by("ttl", field, d)) {
+            ttl.remove(d, id);
+            dirty_indexes.put("ttl:" + field, true);
+        }
+    });
+
+    if (!bitmaps.empty()) {
+        bitmaps.remove(d, id);
+        dirty_indexes.put("bitmap:" + bitmaps.spec(), true);
     }
 
-    return cnt;
+    if (!blocks.empty()) {
+        blocks.remove(id);
+        dirty_indexes.put("blocks:" + blocks.spec(), true);
+        if (tracking_block_changes) blocks_changed.put(id, true);
+    }
+}
+
+// The WAL record is the spec itself, or {"spec", "filter"} for a partial
+// index.
+static std::string create_index_record(const std::string &spec, const json &filter) {
+    if (filter.is_null()) return spec;
+    return json{{"spec", spec}, {"filter", filter}}.dump();
+}
+
+static void check_index_filter(const std::string &spec, const json &filter) {
+    if (filter.is_null()) return;
+    if (!filter.is_object()) throw std::runtime_error("Index filter must be a query object");
+    if (spec.rfind("bitmap:", 0) == 0) throw std::runtime_error("Bitmap indexes cannot be partial");
+    if (spec.rfind("zonemap:", 0) == 0 || spec.rfind("bloom:", 0) == 0) {
+        throw std::runtime_error("Block indexes cannot be partial");
+    }
+}
+
+void Collection::create_index(const std::string &field, const json &filter) {
+    if (partitions) {
+        for (auto &part : add_partition_index(field, filter)) part->create_index(field, filter);
+        return;
+    }
+    check_index_filter(field, filter);
+    wal->append(WAL_CREATE_INDEX, create_index_record(field, filter));
+    build_index(field, filter);
 }
 
-void Collection::create_index(const std::string &field) {
-    bool numericField = false;
-    auto all_items = store.items();
-    for (auto &p : all_items) {
-        const json &doc = p.second;
-        if (doc.contains(field) && doc[field].is_number()) {
-            numericField = true;
-            break;
+Vector<std::shared_ptr<Collection>> Collection::add_partition_index(const std::string &spec, const json &filter) {
+    if (!partitions) throw std::runtime_error("Collection is not partitioned");
+    check_index_filter(spec, filter);
+    if (spec.rfind("ttl:", 0) == 0) {
+        throw std::runtime_error("Partitioned collections expire documents through retention_days");
+    }
+    return partitions->add_index(spec, filter);
+}
+
+Vector<std::string> Collection::index_fields() const {
+    if (partitions) return partitions->index_fields();
+    Vector<std::string> fields = indexes.keys();
+    for (const auto &field : btree_indexes.keys()) fields.push_back(field);
+    for (const auto &spec : ordered_indexes.keys()) {
+        fields.push_back(spec.find(',') == std::string::npos ? "ordered:" + spec : spec);
+    }
+    for (const auto &field : trigram_indexes.keys()) fields.push_back("trigram:" + field);
+    for (const auto &field : text_indexes.keys()) fields.push_back("text:" + field);
+    for (const auto &field : bitmaps.indexed_fields()) fields.push_back("bitmap:" + field);
+    for (const auto &name : blocks.names()) fields.push_back(name);
+    for (const auto &field : ttl_indexes.keys()) {
+        fields.push_back("ttl:" + field + ":" + std::to_string(ttl_indexes.find(field)->expire_after()));
+    }
+    return fields;
+}
+
+json Collection::index_filter(const std::string &name) const {
+    if (partitions) return partitions->index_filter(name);
+    // TTL indexes are listed with their expiry time appended.
+    std::string key = name.rfind("ttl:", 0) == 0 ? name.substr(0, name.rfind(':')) : name;
+    for (const char *type : {"hash:", "btree:", "ordered:", ""}) {
+        const json *filter = index_filters.find(type + key);
+        if (filter) return *filter;
+    }
+    return json();
+}
+
+void Collection::build_index(const std::string &spec, const json &filter) {
+    if (spec.rfind("bitmap:", 0) == 0 && bitmaps.has_field(spec.substr(7))) return;
+    if (blocks.has(spec)) return;
+    auto build = start_index_build(spec, filter);
+    run_index_build(*build);
+    publish_index_build(*build);
+}
+
+// A comma-separated field list ("event_type,timestamp") creates a compound
+// ordered index and "ordered:<field>" a single-field one, so that string
+// ranges and prefixes can use it; a bare field gets a B-tree when it holds
+// numbers and a hash index otherwise, which "hash:<field>" forces.
+// "trigram:<field>" adds a substring index for $like, "text:<field>" a
+// token index for $text and "bitmap:<field>" a bitmap index, next to
+// whatever else the field has.
+// "btree:<field>[:<fanout>]" forces a numeric B-tree with the given number
+// of keys per node, and "ttl:<field>:<seconds>" makes documents expire that
+// long after the time in the field. "zonemap:<field>" and "bloom:<field>"
+// summarize blocks of documents so that scans can skip some of them.
+//
+// Runs under the write lock and only takes a snapshot; writes from then on
+// record the document they replace until the build is published.
+std::shared_ptr<IndexBuild> Collection::start_index_build(const std::string &spec, const json &filter) {
+    if (partitions) throw std::runtime_error("Partitioned collections build indexes per partition");
+    if (pending_build) throw std::runtime_error("Index build on '" + pending_build->spec + "' is still running");
+    check_index_filter(spec, filter);
+
+    auto build = std::make_shared<IndexBuild>();
+    build->spec = spec;
+    build->filter = filter;
+    build->field = spec;
+    for (const char *type : {"bitmap", "bloom", "btree", "hash", "ordered", "text", "trigram", "ttl", "zonemap"}) {
+        std::string prefix = std::string(type) + ":";
+        if (spec.rfind(prefix, 0) == 0) {
+            build->type = type;
+            build->field = spec.substr(prefix.size());
         }
     }
+    size_t colon = build->field.rfind(':');
+    if (build->type == "btree" && colon != std::string::npos) {
+        std::string fanout = build->field.substr(colon + 1);
+        if (fanout.empty() || fanout.size() > 6 || fanout.find_first_not_of("0123456789") != std::string::npos
+            || std::stoi(fanout) < BTreeIndex::MIN_FANOUT || std::stoi(fanout) > BTreeIndex::MAX_FANOUT) {
+            throw std::runtime_error("Invalid B-tree fanout: " + fanout);
+        }
+        build->fanout = std::stoi(fanout);
+        build->field.resize(colon);
+    }
+    if (build->type == "ttl") {
+        std::string seconds = colon == std::string::npos ? "" : build->field.substr(colon + 1);
+        if (seconds.empty() || seconds.size() > 10 || seconds.find_first_not_of("0123456789") != std::string::npos
+            || std::stoll(seconds) == 0) {
+            throw std::runtime_error("TTL index needs a positive number of seconds: " + spec);
+        }
+        build->expire_after = std::stoll(seconds);
+        build->field.resize(colon);
+    }
+    if (build->field.empty()) throw std::runtime_error("Index needs a field name: " + spec);
+    if (build->type.empty() && spec.find(',') != std::string::npos) build->type = "ordered";
+    if (build->type == "bitmap") {
+        // Bitmap fields share row numbers, so all of them are rebuilt together.
+        std::string name = build->field;
+        build->field = bitmaps.spec();
+        if (!bitmaps.has_field(name)) build->field += (build->field.empty() ? "" : ",") + name;
+    }
+    if (build->type == "zonemap" || build->type == "bloom") {
+        // Likewise for block summaries, which share the blocks.
+        build->type = "blocks";
+        build->field = blocks.spec();
+        if (!blocks.has(spec)) build->field += (build->field.empty() ? "" : ",") + spec;
+    }
+
+    build->snap = store->snapshot();
+    pending_build = build;
+    return build;
+}
+
+// Needs no lock: reads only the snapshot and fills the build.
+void Collection::run_index_build(IndexBuild &build) {
+    FilteredSnapshot filtered(*build.snap, build.filter);
+    const StorageSnapshot &snap = build.filter.is_null() ? *build.snap : filtered;
+    const std::string &field = build.field;
+    if (build.type.empty()) {
+        bool numericField = false;
+        snap.for_each([&](const std::string &, const json &doc) {
+            if (doc.contains(field) && doc[field].is_number()) numericField = true;
+        });
+        build.type = numericField ? "btree" : "hash";
+    }
+
+    if (build.type == "hash") build.hash = build_hash_index(field, snap);
+    else if (build.type == "btree") build.btree = build_btree_index(field, snap, build.fanout);
+    else if (build.type == "ordered") build.ordered = build_ordered_index(field, snap);
+    else if (build.type == "trigram") build.trigram = build_trigram_index(field, snap);
+    else if (build.type == "text") build.text = build_text_index(field, snap);
+    else if (build.type == "ttl") build.ttl = build_ttl_index(field, build.expire_after, snap);
+    else if (build.type == "blocks") build.blocks = build_block_index(field, snap);
+    else build.bitmap = build_bitmap_index(field, snap);
+}
+
+void Collection::finish_index_build(const std::shared_ptr<IndexBuild> &build) {
+    if (build != pending_build) throw std::runtime_error("Index build on '" + build->spec + "' is not running");
+    wal->append(WAL_CREATE_INDEX, create_index_record(build->spec, build->filter));
+    publish_index_build(*build);
+}
 
-    if (numericField) {
-        BTreeIndex btree;
-        for (auto &p : all_items) {
-            const json &doc = p.second;
-            if (doc.contains(field) && doc[field].is_number())
-                btree.insert(doc[field].get<double>(), p.first);
+void Collection::abort_index_build(const std::shared_ptr<IndexBuild> &build) {
+    if (build == pending_build) pending_build.reset();
+}
+
+// Called on every write while a build is pending. Only the first write to a
+// document matters: the document it replaces is the one in the snapshot.
+void Collection::record_for_build(const std::string &id, const json &before) {
+    if (!pending_build->before.find(id)) pending_build->before.put(id, before);
+}
+
+// Moves the documents written since the snapshot from their snapshot
+// version to their current one, then swaps the index in. Runs under the
+// write lock; the work is proportional to the writes made during the build.
+void Collection::publish_index_build(IndexBuild &build) {
+    const std::string &field = build.field;
+    build.before.for_each([&](const std::string &id, json &old) {
+        json doc;
+        bool exists = store->get(id, doc);
+        if (!build.filter.is_null()) {
+            if (!old.is_null() && !evaluate_query(old, build.filter)) old = json();
+            exists = exists && evaluate_query(doc, build.filter);
+        }
+        if (build.type == "hash") {
+            if (!old.is_null() && old.contains(field)) {
+                Vector<std::string> *ids = build.hash.find(index_key_for_value(old[field]));
+                if (ids) {
+                    size_t removed = custom_remove_if(ids->begin(), ids->end(),
+                                                      [&](const std::string &current) { return current == id; });
+                    ids->resize(ids->size() - removed);
+                }
+            }
+            if (exists && doc.contains(field)) build.hash.find_or_insert(index_key_for_value(doc[field])).push_back(id);
+        } else if (build.type == "btree") {
+            if (!old.is_null() && old.contains(field) && old[field].is_number()) {
+                build.btree.remove(old[field].get<double>(), id);
+            }
+            if (exists && doc.contains(field) && doc[field].is_number()) build.btree.insert(doc[field].get<double>(), id);
+        } else if (build.type == "ordered") {
+            if (!old.is_null()) build.ordered.remove(old, id);
+            if (exists) build.ordered.insert(doc, id);
+        } else if (build.type == "trigram") {
+            if (!old.is_null()) build.trigram.remove(old, id);
+            if (exists) build.trigram.insert(doc, id);
+        } else if (build.type == "text") {
+            if (!old.is_null()) build.text.remove(old, id);
+            if (exists) build.text.insert(doc, id);
+        } else if (build.type == "ttl") {
+            if (!old.is_null()) build.ttl.remove(old, id);
+            if (exists) build.ttl.insert(doc, id);
+        } else if (build.type == "blocks") {
+            if (!old.is_null()) build.blocks.remove(id);
+            if (exists) build.blocks.insert(doc, id);
+        } else {
+            if (!old.is_null()) build.bitmap.remove(old, id);
+            if (exists) build.bitmap.insert(doc, id);
         }
-        btree_indexes.put(field, btree);
+    });
 
-        std::string fname = indexdir + "/" + collname + "." + field + ".btree.json";
-        std::ofstream ofs(fname);
-        ofs << std::setw(2) << btree.to_json() << std::endl;
+    if (build.type == "hash") {
+        indexes.find_or_insert(field) = std::move(build.hash);
+        std::cout << "Simple index created on field '" << field << "'.\n";
+    } else if (build.type == "btree") {
+        btree_indexes.find_or_insert(field) = std::move(build.btree);
         std::cout << "B-Tree index created on numeric field '" << field << "'.\n";
+    } else if (build.type == "ordered") {
+        ordered_indexes.find_or_insert(field) = std::move(build.ordered);
+        std::cout << (field.find(',') != std::string::npos ? "Compound index created on fields '"
+                                                           : "Ordered index created on string field '")
+                  << field << "'.\n";
+    } else if (build.type == "trigram") {
+        trigram_indexes.find_or_insert(field) = std::move(build.trigram);
+        std::cout << "Trigram index created on field '" << field << "'.\n";
+    } else if (build.type == "text") {
+        text_indexes.find_or_insert(field) = std::move(build.text);
+        std::cout << "Text index created on field '" << field << "'.\n";
+    } else if (build.type == "ttl") {
+        ttl_indexes.find_or_insert(field) = std::move(build.ttl);
+        std::cout << "TTL index created on field '" << field << "', documents expire after "
+                  << build.expire_after << " s.\n";
+    } else if (build.type == "blocks") {
+        blocks = std::move(build.blocks);
+        std::cout << "Block index created on '" << field << "'.\n";
     } else {
-        HashMap<Vector<std::string>> mapidx;
-        for (auto &p : all_items) {
-            const json &doc = p.second;
-            if (doc.contains(field)) {
-                std::string key = index_key_for_value(doc[field]);
-                Vector<std::string> ids;
-                mapidx.get(key, ids);
-                ids.push_back(p.first);
-                mapidx.put(key, ids);
+        bitmaps = std::move(build.bitmap);
+        std::cout << "Bitmap index created on fields '" << field << "'.\n";
+    }
+    if (build.filter.is_null()) index_filters.remove(build.type + ":" + field);
+    else index_filters.put(build.type + ":" + field, build.filter);
+    dirty_indexes.put(build.type + ":" + field, true);
+    if (pending_build.get() == &build) pending_build.reset();
+}
+
+void Collection::rebuild_index(const IndexFileEntry &entry) {
+    const std::string &field = entry.field, &type = entry.type;
+    auto all = store->snapshot();
+    FilteredSnapshot filtered(*all, entry.filter);
+    const StorageSnapshot &snap = entry.filter.is_null() ? *all : filtered;
+    if (type == "btree") btree_indexes.find_or_insert(field) = build_btree_index(field, snap, entry.fanout);
+    else if (type == "ordered") ordered_indexes.put(field, build_ordered_index(field, snap));
+    else if (type == "trigram") trigram_indexes.put(field, build_trigram_index(field, snap));
+    else if (type == "text") text_indexes.put(field, build_text_index(field, snap));
+    else if (type == "bitmap") bitmaps = build_bitmap_index(field, snap);
+    else if (type == "ttl") ttl_indexes.put(field, build_ttl_index(field, entry.expire_after, snap));
+    else if (type == "blocks") blocks = build_block_index(field, snap);
+    else indexes.put(field, build_hash_index(field, snap));
+}
+
+bool Collection::expires_documents() const { return !partitions && ttl_indexes.size() > 0; }
+
+// Deletes like remove() does, but takes the ids straight from the TTL
+// indexes instead of running a query.
+size_t Collection::remove_expired(int64_t now, size_t limit) {
+    if (partitions) return 0;
+    Vector<std::string> ids;
+    ttl_indexes.for_each([&](const std::string &, TtlIndex &ttl) {
+        if (ids.size() >= limit) return;
+        for (auto &id : ttl.expired(now, limit - ids.size())) ids.push_back(std::move(id));
+    });
+    size_t deleted = 0;
+    for (const auto &id : ids) {
+        if (apply_delete(id)) {
+            wal->append(WAL_DELETE, id);
+            ++deleted;
+        }
+    }
+    return deleted;
+}
+
+void Collection::record_ttl_pass(uint64_t deleted, double ms) {
+    ++ttl_stats.passes;
+    ttl_stats.deleted += deleted;
+    ttl_stats.last_deleted = deleted;
+    ttl_stats.last_pass_ms = ms;
+    if (ms > ttl_stats.max_pass_ms) ttl_stats.max_pass_ms = ms;
+}
+
+void Collection::commit() {
+    if (partitions) return partitions->commit();
+    wal->sync();
+    checkpoint_if_needed();
+}
+
+uint64_t Collection::last_lsn() const { return partitions ? 0 : wal->last_lsn(); }
+
+// A partitioned collection has one WAL per partition, so the LSN is
+// ignored and every write issued so far is waited for.
+void Collection::wait_durable(uint64_t lsn) {
+    if (partitions) return partitions->wait_durable();
+    wal->wait_durable(lsn);
+}
+
+void Collection::checkpoint_if_needed() {
+    if (partitions) return partitions->checkpoint_if_needed();
+    install_rebuilt_blocks();
+    if (checkpoint_running || wal->size_bytes() <= checkpoint_wal_bytes) return;
+    wait_for_checkpoint();
+    std::cout << "Checkpointing collection '" << collname << "' in background (WAL "
+              << wal->size_bytes() << " bytes)" << std::endl;
+    checkpoint_running = true;
+    checkpoint_thread = std::thread(prepare_checkpoint());
+}
+
+void Collection::wait_for_checkpoint() {
+    if (checkpoint_thread.joinable()) checkpoint_thread.join();
+}
+
+// Runs under the collection's write lock: rotates the WAL and takes a
+// copy-on-write snapshot. The returned job writes the snapshot without
+// holding any lock and then drops the WAL files it covers. Unchanged indexes
+// keep their files. A changed hash or B-tree index gets a delta file of the
+// changes made since the previous checkpoint, until MAX_INDEX_DELTAS of them
+// are written out in full again; other changed indexes are rewritten from
+// the snapshot. Everything after the checkpoint is recovered from the WAL.
+std::function<void()> Collection::prepare_checkpoint() {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t lsn = wal->rotate();
+    auto snap = store->snapshot();
+
+    Vector<IndexFileEntry> previous;
+    Vector<std::string> stale;
+    bool rewrite_all;
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        previous = index_files;
+        stale = legacy_index_files;
+        rewrite_all = rewrite_all_indexes;
+    }
+
+    Vector<IndexFileEntry> next, to_write;
+    auto deltas = std::make_shared<Vector<std::pair<std::string, Vector<IndexChange>>>>();
+    auto plan = [&](const std::string &field, const std::string &type) {
+        bool dirty = false;
+        dirty_indexes.get(type + ":" + field, dirty);
+        if (!dirty && !rewrite_all) {
+            for (const auto &e : previous) {
+                if (e.field != field || e.type != type) continue;
+                Vector<IndexChange> *changes = index_changes.find(type + ":" + field);
+                if (!changes || changes->empty()) { next.push_back(e); return; }
+                if (e.deltas.size() >= MAX_INDEX_DELTAS) break;
+                IndexFileEntry updated = e;
+                updated.deltas.push_back(collname + "." + field + "." + std::to_string(lsn) + "." + type + ".delta.mpk");
+                deltas->emplace_back(updated.deltas.back(), std::move(*changes));
+                next.push_back(updated);
+                return;
             }
         }
-        indexes.put(field, mapidx);
-        save_index(field);
-        std::cout << "Simple index created on field '" << field << "'.\n";
+        std::string suffix = type == "btree" ? ".btree" : type == "ordered" ? ".ordered.mpk"
+            : type == "trigram" ? ".trigram.mpk" : type == "text" ? ".text.mpk"
+            : type == "bitmap" ? ".bitmap.mpk" : type == "ttl" ? ".ttl.mpk"
+            : type == "blocks" ? ".blocks.mpk" : ".hash.mpk";
+        IndexFileEntry e{field, type, collname + "." + field + "." + std::to_string(lsn) + suffix};
+        if (type == "btree") e.fanout = btree_indexes.find(field)->fanout();
+        if (type == "ttl") e.expire_after = ttl_indexes.find(field)->expire_after();
+        index_filters.get(type + ":" + field, e.filter);
+        next.push_back(e);
+        to_write.push_back(e);
+    };
+    for (const auto &field : indexes.keys()) plan(field, "hash");
+    for (const auto &field : btree_indexes.keys()) plan(field, "btree");
+    for (const auto &spec : ordered_indexes.keys()) plan(spec, "ordered");
+    for (const auto &field : trigram_indexes.keys()) plan(field, "trigram");
+    for (const auto &field : text_indexes.keys()) plan(field, "text");
+    for (const auto &field : ttl_indexes.keys()) plan(field, "ttl");
+    if (!bitmaps.empty()) plan(bitmaps.spec(), "bitmap");
+    if (!blocks.empty()) plan(blocks.spec(), "blocks");
+    dirty_indexes = HashMap<bool>();
+    index_changes = HashMap<Vector<IndexChange>>();
+    // Deletes leave rows behind in the block index; the rebuilt one the
+    // checkpoint writes out replaces it once it catches up.
+    tracking_block_changes = false;
+    for (const auto &e : to_write) {
+        if (e.type == "blocks") tracking_block_changes = true;
     }
+    // Only files this collection's catalog listed are deleted: other
+    // collections keep theirs in the same directory, under names that may
+    // start with this one's ("logs." is a prefix of "logs.archive.").
+    auto files_of = [](const IndexFileEntry &e) {
+        Vector<std::string> files = e.deltas;
+        files.push_back(e.file);
+        return files;
+    };
+    for (const auto &old : previous) {
+        for (const auto &file : files_of(old)) {
+            bool kept = false;
+            for (const auto &e : next) {
+                for (const auto &f : files_of(e)) {
+                    if (f == file) { kept = true; break; }
+                }
+            }
+            if (!kept) stale.push_back(file);
+        }
+    }
+    blocks_changed = HashMap<bool>();
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        rebuilt_blocks.reset();
+    }
+    double lock_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    return [this, snap, next, to_write, deltas, stale, lsn, lock_us] {
+        auto job_start = std::chrono::steady_clock::now();
+        bool ok = true, cataloged = false;
+        std::shared_ptr<BlockIndex> rebuilt;
+        try {
+            for (const auto &e : to_write) write_index_file(e, *snap, &rebuilt);
+            for (const auto &d : *deltas) write_index_delta(d.first, d.second);
+            write_catalog(lsn, next);
+            cataloged = true;
+            snap->write(segfile, lsn);
+            wal->remove_retired(lsn);
+            remove_index_files(stale);
+        } catch (const std::exception &e) {
+            ok = false;
+            std::cerr << "Checkpoint of '" << collname << "' failed: " << e.what() << std::endl;
+            // Until the catalog is replaced nothing refers to the new files.
+            if (!cataloged) {
+                Vector<std::string> written;
+                for (const auto &e : to_write) written.push_back(e.file);
+                for (const auto &d : *deltas) written.push_back(d.first);
+                remove_index_files(written);
+            }
+        }
+        double duration_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job_start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(checkpoint_mutex);
+            if (ok) index_files = next;
+            if (ok) rebuilt_blocks = rebuilt;
+            if (ok) legacy_index_files = Vector<std::string>();
+            rewrite_all_indexes = !ok;
+            ++checkpoint_stats.count;
+            checkpoint_stats.last_lsn = lsn;
+            checkpoint_stats.last_lock_us = lock_us;
+            if (lock_us > checkpoint_stats.max_lock_us) checkpoint_stats.max_lock_us = lock_us;
+            checkpoint_stats.last_duration_ms = duration_ms;
+            checkpoint_stats.indexes_written += to_write.size();
+            checkpoint_stats.deltas_written += deltas->size();
+        }
+        checkpoint_running = false;
+    };
+}
+
+// Runs under the write lock. The rebuilt index is as of the checkpoint's
+// snapshot, so the documents written since are moved to their current
+// version first. It is dropped if the block index changed shape meanwhile.
+void Collection::install_rebuilt_blocks() {
+    std::shared_ptr<BlockIndex> rebuilt;
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        rebuilt.swap(rebuilt_blocks);
+    }
+    if (!rebuilt || !tracking_block_changes) return;
+    tracking_block_changes = false;
+    if (rebuilt->spec() == blocks.spec()) {
+        blocks_changed.for_each([&](const std::string &id, bool &) {
+            rebuilt->remove(id);
+            json doc;
+            if (store->get(id, doc)) rebuilt->insert(doc, id);
+        });
+        blocks = std::move(*rebuilt);
+    }
+    blocks_changed = HashMap<bool>();
+}
+
+void Collection::set_commit_delay(std::chrono::microseconds delay) {
+    if (partitions) return partitions->set_commit_delay(delay);
+    wal->set_max_commit_delay(delay);
+}
+
+void Collection::set_checkpoint_wal_bytes(size_t bytes) {
+    if (partitions) return partitions->set_checkpoint_wal_bytes(bytes);
+    checkpoint_wal_bytes = bytes;
+}
+
+WalStats Collection::wal_stats() const { return partitions ? WalStats() : wal->stats(); }
+
+bool Collection::partitioned() const { return partitions != nullptr; }
+
+bool Collection::is_discarded() const { return discarded; }
+
+// Drops the in-memory state without writing it back; the caller is about
+// to delete the collection's files.
+void Collection::discard() {
+    if (!partitions) wait_for_checkpoint();
+    discarded = true;
 }
 
 void Collection::save() {
-    json j = store.to_json();
-    std::ofstream ofs(collfile);
-    ofs << std::setw(2) << j << std::endl;
+    if (partitions) return partitions->save();
+    wait_for_checkpoint();
+    checkpoint_running = true;
+    prepare_checkpoint()();
+}
 
-    auto index_items = indexes.items();
-    for (const auto& item : index_items) {
-        save_index(item.first);
+json Collection::stats() const {
+    if (partitions) return partitions->stats();
+    WalStats ws = wal->stats();
+    CheckpointStats cs;
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_mutex);
+        cs = checkpoint_stats;
     }
+    json btrees = json::object();
+    for (const auto &field : btree_indexes.keys()) btrees[field] = btree_indexes.find(field)->stats();
+    json ttl = json::object();
+    for (const auto &field : ttl_indexes.keys()) ttl[field] = ttl_indexes.find(field)->stats();
+    return {
+        {"documents", store->size()},
+        {"storage", store->stats()},
+        {"btree_indexes", btrees},
+        {"partial_indexes", index_filters.to_json()},
+        {"block_index", blocks.stats()},
+        {"ttl", {
+            {"indexes", ttl},
+            {"passes", ttl_stats.passes},
+            {"deleted", ttl_stats.deleted},
+            {"last_deleted", ttl_stats.last_deleted},
+            {"last_pass_ms", ttl_stats.last_pass_ms},
+            {"max_pass_ms", ttl_stats.max_pass_ms}
+        }},
+        {"wal", {
+            {"last_lsn", wal->last_lsn()},
+            {"active_bytes", wal->size_bytes()},
+            {"commits", ws.commits},
+            {"records", ws.records},
+            {"bytes", ws.bytes}
+        }},
+        {"checkpoint", {
+            {"running", checkpoint_running.load()},
+            {"count", cs.count},
+            {"last_lsn", cs.last_lsn},
+            {"last_lock_us", cs.last_lock_us},
+            {"max_lock_us", cs.max_lock_us},
+            {"last_duration_ms", cs.last_duration_ms},
+            {"indexes_written", cs.indexes_written},
+            {"deltas_written", cs.deltas_written}
+        }}
+    };
 }
 
 Vector<std::string> json_to_string_vector(const json& j) {
@@ -233,32 +1046,160 @@ Vector<std::string> json_to_string_vector(const json& j) {
 }
 
 void Collection::load() {
-    if (!std::filesystem::exists(collfile)) return;
+    if (partitions) return;
+    if (!std::filesystem::exists(segfile) && std::filesystem::exists(collfile)) {
+        convert_legacy_file();
+    }
+    if (std::filesystem::exists(segfile)) {
+        store->load(segfile);
+        load_indexes();
+    }
+
+    wal->replay(store->checkpoint_lsn(), [this](const WalRecord &rec) {
+        if (rec.type == WAL_INSERT) {
+            json doc = json::from_msgpack(rec.payload);
+            apply_insert(doc["_id"].get<std::string>(), doc);
+        } else if (rec.type == WAL_DELETE) {
+            apply_delete(rec.payload);
+        } else if (rec.type == WAL_CREATE_INDEX) {
+            if (rec.payload.empty() || rec.payload[0] != '{') {
+                build_index(rec.payload);
+            } else {
+                json r = json::parse(rec.payload);
+                build_index(r.at("spec").get<std::string>(), r.at("filter"));
+            }
+        }
+    });
+}
+
+json CollectionOptions::to_json() const {
+    json j = json::object();
+    if (engine != "document") j["engine"] = engine;
+    if (engine == "columnar") {
+        json cols = json::array();
+        for (const auto &c : columns) cols.push_back({{"name", c.name}, {"type", c.type}});
+        j["columns"] = cols;
+    }
+    if (!partition_field.empty()) {
+        j["partition"] = {
+            {"field", partition_field},
+            {"granularity", partition_granularity},
+            {"retention_days", retention_days}
+        };
+    }
+    return j;
+}
+
+CollectionOptions CollectionOptions::from_json(const json &j) {
+    CollectionOptions o;
+    o.engine = j.value("engine", "document");
+    if (j.contains("columns")) {
+        for (const auto &c : j["columns"]) {
+            o.columns.push_back(ColumnSpec{c["name"].get<std::string>(), c["type"].get<std::string>()});
+        }
+    }
+    if (j.contains("partition")) {
+        const json &p = j["partition"];
+        o.partition_field = p.value("field", "");
+        o.partition_granularity = p.value("granularity", "day");
+        o.retention_days = p.value("retention_days", 0);
+    }
+    return o;
+}
+
+void Collection::load_options(const CollectionOptions &requested) {
+    if (std::filesystem::exists(metafile)) {
+        std::ifstream ifs(metafile);
+        json meta; ifs >> meta;
+        options = CollectionOptions::from_json(meta);
+        options.cache_bytes = requested.cache_bytes;
+        return;
+    }
+
+    options = requested;
+    if (options.to_json().empty()) return;
+    if (!options.partition_field.empty() && !PartitionSet::valid_granularity(options.partition_granularity)) {
+        throw std::runtime_error("Unknown partition granularity: " + options.partition_granularity);
+    }
+    if (options.engine != "document" && options.engine != "columnar" && options.engine != "paged"
+        && options.engine != "lsm") {
+        throw std::runtime_error("Unknown storage engine: " + options.engine);
+    }
+    // A WAL larger than its 16-byte header holds writes in the default layout.
+    bool has_data = std::filesystem::exists(segfile) || std::filesystem::exists(collfile)
+        || (std::filesystem::exists(walfile) && std::filesystem::file_size(walfile) > 16);
+    if (has_data) {
+        std::cout << "Collection '" << collname << "' already holds data, keeping its current layout "
+                  << "(migrate with db_convert)" << std::endl;
+        options = CollectionOptions();
+        return;
+    }
+    write_file_atomic(metafile, options.to_json().dump(2) + "\n");
+}
+
+std::unique_ptr<StorageEngine> Collection::make_engine() const {
+    if (options.engine == "columnar") return std::make_unique<ColumnStore>(options.columns);
+    if (options.engine == "paged") return std::make_unique<PagedStore>(dbpath + "/" + collname, options.cache_bytes);
+    if (options.engine == "lsm") return std::make_unique<LsmStore>(dbpath + "/" + collname);
+    return std::make_unique<DocStore>();
+}
+
+void Collection::convert_legacy_file() {
+    std::cout << "Converting legacy collection file " << collfile << " to " << segfile << std::endl;
     std::ifstream ifs(collfile);
     json j; ifs >> j;
-    store.from_json(j);
+
+    auto legacy = make_engine();
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        legacy->put(it.key(), it.value());
+    }
+    legacy->snapshot()->write(segfile, 0);
+    std::filesystem::rename(collfile, collfile + ".bak");
+}
+
+// Index files are trusted only if the catalog was written by the same
+// checkpoint as the segment; otherwise (or for pre-catalog databases) the
+// listed indexes are rebuilt from the documents.
+void Collection::load_indexes() {
+    if (std::filesystem::exists(catalogfile)) {
+        std::ifstream ifs(catalogfile);
+        json catalog; ifs >> catalog;
+        bool valid = catalog.value("lsn", (uint64_t)0) == store->checkpoint_lsn();
+        if (!valid) {
+            std::cout << "Index catalog of '" << collname << "' does not match the segment, rebuilding indexes" << std::endl;
+            rewrite_all_indexes = true;
+        }
+        for (const auto &je : catalog["indexes"]) {
+            IndexFileEntry e{je["field"], je["type"], je["file"], je.value("fanout", 0), je.value("filter", json()),
+                             je.value("expire_after", (int64_t)0)};
+            for (const auto &file : je.value("deltas", json::array())) e.deltas.push_back(file.get<std::string>());
+            if (valid) {
+                read_index_file(e);
+                for (const auto &file : e.deltas) read_index_delta(e, file);
+                index_files.push_back(e);
+            } else {
+                rebuild_index(e);
+            }
+            if (!e.filter.is_null()) index_filters.put(e.type + ":" + e.field, e.filter);
+        }
+        return;
+    }
 
     if (!std::filesystem::exists(indexdir)) return;
+    std::string prefix = collname + ".";
     for (auto &p : std::filesystem::directory_iterator(indexdir)) {
         std::string fname = p.path().filename().string();
-        std::string prefix = collname + ".";
         if (fname.rfind(prefix, 0) != 0) continue;
 
-        if (fname.find(".index.json") != std::string::npos) {
-            std::string field = fname.substr(prefix.size(), fname.find(".index.json") - prefix.size());
-            std::ifstream fi(p.path());
-            json ji; fi >> ji;
-            HashMap<Vector<std::string>> mapidx;
-            for (auto it = ji.begin(); it != ji.end(); ++it) {
-                mapidx.put(it.key(), json_to_string_vector(it.value()));
-            }
-            indexes.put(field, mapidx);
-        } else if (fname.find(".btree.json") != std::string::npos) {
-            std::string field = fname.substr(prefix.size(), fname.find(".btree.json") - prefix.size());
-            std::ifstream fi(p.path());
-            json jb; fi >> jb;
-            BTreeIndex bt; bt.from_json(jb);
-            btree_indexes.put(field, bt);
+        size_t pos;
+        if ((pos = fname.find(".index.json")) != std::string::npos) {
+            rebuild_index(IndexFileEntry{fname.substr(prefix.size(), pos - prefix.size()), "hash"});
+            legacy_index_files.push_back(fname);
+            rewrite_all_indexes = true;
+        } else if ((pos = fname.find(".btree.json")) != std::string::npos) {
+            rebuild_index(IndexFileEntry{fname.substr(prefix.size(), pos - prefix.size()), "btree"});
+            legacy_index_files.push_back(fname);
+            rewrite_all_indexes = true;
         }
     }
 }
@@ -273,16 +1214,255 @@ std::string Collection::index_key_for_value(const json &v) {
     return "j:" + v.dump();
 }
 
-void Collection::save_index(const std::string &field) {
-    HashMap<Vector<std::string>> field_index;
-    if (!indexes.get(field, field_index)) return;
+HashMap<Vector<std::string>> Collection::build_hash_index(const std::string &field, const StorageSnapshot &snap) {
+    json groups = json::object();
+    snap.for_each([&](const std::string &id, const json &doc) {
+        if (doc.contains(field)) groups[index_key_for_value(doc[field])].push_back(id);
+    });
+    HashMap<Vector<std::string>> mapidx;
+    for (auto it = groups.begin(); it != groups.end(); ++it) {
+        mapidx.put(it.key(), json_to_string_vector(it.value()));
+    }
+    return mapidx;
+}
+
+// (value, id) pairs of the documents with a number in `field`, sorted.
+static std::vector<std::pair<double, std::string>> sorted_numeric_pairs(const std::string &field,
+                                                                        const StorageSnapshot &snap) {
+    std::vector<std::pair<double, std::string>> pairs;
+    pairs.reserve(snap.size());
+    snap.for_each([&](const std::string &id, const json &doc) {
+        auto it = doc.find(field);
+        if (it != doc.end() && it->is_number()) pairs.emplace_back(it->get<double>(), id);
+    });
+    parallel_sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+BTreeIndex Collection::build_btree_index(const std::string &field, const StorageSnapshot &snap, int fanout) {
+    BTreeIndex btree(fanout > 0 ? fanout : BTreeIndex::DEFAULT_FANOUT);
+    auto pairs = sorted_numeric_pairs(field, snap);
+    btree.bulk_load(pairs);
+    return btree;
+}
+
+OrderedIndex Collection::build_ordered_index(const std::string &spec, const StorageSnapshot &snap) {
+    OrderedIndex ordered(spec);
+    snap.for_each([&](const std::string &id, const json &doc) { ordered.insert(doc, id); });
+    return ordered;
+}
+
+TrigramIndex Collection::build_trigram_index(const std::string &field, const StorageSnapshot &snap) {
+    TrigramIndex trigrams(field);
+    snap.for_each([&](const std::string &id, const json &doc) { trigrams.insert(doc, id); });
+    return trigrams;
+}
+
+TextIndex Collection::build_text_index(const std::string &field, const StorageSnapshot &snap) {
+    TextIndex text(field);
+    snap.for_each([&](const std::string &id, const json &doc) { text.insert(doc, id); });
+    return text;
+}
+
+BitmapIndex Collection::build_bitmap_index(const std::string &spec, const StorageSnapshot &snap) {
+    BitmapIndex index;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == std::string::npos) comma = spec.size();
+        index.add_field(spec.substr(start, comma - start));
+        start = comma + 1;
+    }
+    snap.for_each([&](const std::string &id, const json &doc) { index.insert(doc, id); });
+    return index;
+}
+
+// Rows follow the values of the first zone-mapped field, so that blocks
+// built from a snapshot in storage order still cover narrow ranges of it.
+BlockIndex Collection::build_block_index(const std::string &spec, const StorageSnapshot &snap) {
+    BlockIndex index;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == std::string::npos) comma = spec.size();
+        index.add(spec.substr(start, comma - start));
+        start = comma + 1;
+    }
+    Vector<std::string> names = index.names();
+    if (!names.empty() && names[0].rfind("zonemap:", 0) == 0) {
+        std::string field = names[0].substr(8);
+        Vector<std::pair<json, std::string>> order;
+        snap.for_each([&](const std::string &id, const json &doc) {
+            order.emplace_back(doc.contains(field) ? doc[field] : json(), id);
+        });
+        std::sort(order.begin(), order.end());
+        for (const auto &entry : order) index.reserve_row(entry.second);
+    }
+    snap.for_each([&](const std::string &id, const json &doc) { index.insert(doc, id); });
+    return index;
+}
+
+TtlIndex Collection::build_ttl_index(const std::string &field, int64_t expire_after, const StorageSnapshot &snap) {
+    TtlIndex ttl(field, expire_after);
+    snap.for_each([&](const std::string &id, const json &doc) { ttl.insert(doc, id); });
+    return ttl;
+}
+
+// For the block index, `rebuilt` (when given) receives the index written.
+void Collection::write_index_file(const IndexFileEntry &entry, const StorageSnapshot &all,
+                                  std::shared_ptr<BlockIndex> *rebuilt) const {
+    FilteredSnapshot filtered(all, entry.filter);
+    const StorageSnapshot &snap = entry.filter.is_null() ? all : filtered;
+    if (entry.type == "btree") {
+        auto pairs = sorted_numeric_pairs(entry.field, snap);
+        BTreeFileWriter writer(indexdir + "/" + entry.file);
+        size_t i = 0;
+        while (i < pairs.size()) {
+            Vector<std::string> ids;
+            double key = pairs[i].first;
+            for (; i < pairs.size() && pairs[i].first == key; ++i) ids.push_back(pairs[i].second);
+            writer.add(key, ids);
+        }
+        writer.finish();
+        return;
+    }
+
+    if (entry.type == "ordered") {
+        auto bytes = json::to_msgpack(build_ordered_index(entry.field, snap).to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        return;
+    }
+
+    if (entry.type == "trigram") {
+        auto bytes = json::to_msgpack(build_trigram_index(entry.field, snap).to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        return;
+    }
+
+    if (entry.type == "text") {
+        auto bytes = json::to_msgpack(build_text_index(entry.field, snap).to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        return;
+    }
+
+    if (entry.type == "bitmap") {
+        auto bytes = json::to_msgpack(build_bitmap_index(entry.field, snap).to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        return;
+    }
+
+    if (entry.type == "ttl") {
+        auto bytes = json::to_msgpack(build_ttl_index(entry.field, entry.expire_after, snap).to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        return;
+    }
+
+    if (entry.type == "blocks") {
+        auto index = std::make_shared<BlockIndex>(build_block_index(entry.field, snap));
+        auto bytes = json::to_msgpack(index->to_json());
+        write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+        if (rebuilt) *rebuilt = index;
+        return;
+    }
+
+    json content = json::object();
+    snap.for_each([&](const std::string &id, const json &doc) {
+        if (doc.contains(entry.field)) content[index_key_for_value(doc[entry.field])].push_back(id);
+    });
+    auto bytes = json::to_msgpack(content);
+    write_file_atomic(indexdir + "/" + entry.file, std::string(bytes.begin(), bytes.end()));
+}
+
+void Collection::read_index_file(const IndexFileEntry &entry) {
+    std::string path = indexdir + "/" + entry.file;
+    bool paged = entry.type == "btree" && entry.file.size() > 6
+        && entry.file.compare(entry.file.size() - 6, 6, ".btree") == 0;
+    int fanout = entry.fanout > 0 ? entry.fanout : BTreeIndex::DEFAULT_FANOUT;
+    if (paged) {
+        BTreeIndex bt(fanout);
+        bt.set_base(std::make_shared<BTreeFile>(path));
+        btree_indexes.put(entry.field, bt);
+        return;
+    }
+
+    std::ifstream ifs(path, std::ios::binary);
+    json content = json::from_msgpack(ifs);
+    if (entry.type == "btree") {
+        BTreeIndex bt(fanout);
+        bt.from_json(content);
+        btree_indexes.put(entry.field, bt);
+    } else if (entry.type == "ordered") {
+        OrderedIndex ordered;
+        ordered.from_json(content);
+        ordered_indexes.put(entry.field, ordered);
+    } else if (entry.type == "trigram") {
+        TrigramIndex trigrams;
+        trigrams.from_json(content);
+        trigram_indexes.put(entry.field, trigrams);
+    } else if (entry.type == "text") {
+        TextIndex text;
+        text.from_json(content);
+        text_indexes.put(entry.field, text);
+    } else if (entry.type == "bitmap") {
+        bitmaps.from_json(content);
+    } else if (entry.type == "ttl") {
+        TtlIndex ttl;
+        ttl.from_json(content);
+        ttl_indexes.put(entry.field, ttl);
+    } else if (entry.type == "blocks") {
+        blocks.from_json(content);
+    } else {
+        HashMap<Vector<std::string>> mapidx;
+        for (auto it = content.begin(); it != content.end(); ++it) {
+            mapidx.put(it.key(), json_to_string_vector(it.value()));
+        }
+        indexes.put(entry.field, mapidx);
+    }
+}
+
+// A delta is a list of [added, key, id] changes in the order they were made.
+void Collection::write_index_delta(const std::string &file, const Vector<IndexChange> &changes) const {
+    json list = json::array();
+    for (const auto &c : changes) list.push_back(json::array({c.added, c.key, c.id}));
+    auto bytes = json::to_msgpack(list);
+    write_file_atomic(indexdir + "/" + file, std::string(bytes.begin(), bytes.end()));
+}
+
+void Collection::read_index_delta(const IndexFileEntry &entry, const std::string &file) {
+    std::ifstream ifs(indexdir + "/" + file, std::ios::binary);
+    json list = json::from_msgpack(ifs);
+    BTreeIndex *bt = entry.type == "btree" ? btree_indexes.find(entry.field) : nullptr;
+    HashMap<Vector<std::string>> *field_index = entry.type == "hash" ? indexes.find(entry.field) : nullptr;
+    if (!bt && !field_index) throw std::runtime_error("Delta file " + file + " has no index to apply to");
+    for (const auto &c : list) {
+        bool added = c.at(0).get<bool>();
+        const std::string &id = c.at(2).get_ref<const std::string&>();
+        if (bt && added) bt->insert(c.at(1).get<double>(), id);
+        else if (bt) bt->remove(c.at(1).get<double>(), id);
+        else if (added) field_index->find_or_insert(c.at(1).get<std::string>()).push_back(id);
+        else remove_from_hash_index(*field_index, c.at(1).get<std::string>(), id);
+    }
+}
+
+void Collection::write_catalog(uint64_t lsn, const Vector<IndexFileEntry> &entries) const {
+    json catalog = {{"lsn", lsn}, {"indexes", json::array()}};
+    for (const auto &e : entries) {
+        json je = {{"field", e.field}, {"type", e.type}, {"file", e.file}};
+        if (e.fanout > 0) je["fanout"] = e.fanout;
+        if (!e.filter.is_null()) je["filter"] = e.filter;
+        if (e.expire_after > 0) je["expire_after"] = e.expire_after;
+        if (!e.deltas.empty()) {
+            je["deltas"] = json::array();
+            for (const auto &file : e.deltas) je["deltas"].push_back(file);
+        }
+        catalog["indexes"].push_back(je);
+    }
+    write_file_atomic(catalogfile, catalog.dump(2) + "\n");
+}
 
-    std::string fname = indexdir + "/" + collname + "." + field + ".index.json";
-    json ji;
-    auto items = field_index.items();
-    for (auto &p : items) {
-        ji[p.first] = p.second;
+void Collection::remove_index_files(const Vector<std::string> &files) const {
+    for (const auto &file : files) {
+        std::error_code ec;
+        std::filesystem::remove(indexdir + "/" + file, ec);
     }
-    std::ofstream ofs(fname);
-    ofs << std::setw(2) << ji << std::endl;
 }
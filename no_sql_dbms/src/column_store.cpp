@@ -0,0 +1,569 @@
+#include "../include/column_store.hpp"
+#include "../include/query_evaluator.hpp"
+#include "../include/utils.hpp"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char COLUMN_MAGIC[8] = {'N', 'S', 'Q', 'L', 'C', 'O', 'L', '1'};
+static const uint32_t COLUMN_VERSION = 1;
+static const size_t COLUMN_WRITE_CHUNK = 1 << 20;
+
+enum ColumnTypeCode : uint8_t { COL_DICT = 1, COL_NUMBER = 2, COL_BLOB = 3 };
+
+struct ColumnFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t column_count;
+    uint64_t rows;
+    uint64_t lsn;
+};
+
+static uint8_t type_code(const std::string &type) {
+    if (type == "dict") return COL_DICT;
+    if (type == "number") return COL_NUMBER;
+    return COL_BLOB;
+}
+
+// Streams a file to <path>.tmp and renames it into place on finish().
+class ColumnFileWriter {
+public:
+    explicit ColumnFileWriter(const std::string &path) : path(path), tmp_path(path + ".tmp") {
+        fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Cannot create column file " + tmp_path);
+    }
+
+    ~ColumnFileWriter() {
+        if (fd >= 0) {
+            ::close(fd);
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    template<typename T>
+    void put(const T &v) { buffer.append(reinterpret_cast<const char*>(&v), sizeof(v)); maybe_flush(); }
+
+    void put_string(const char *data, size_t len) {
+        uint32_t n = (uint32_t)len;
+        buffer.append(reinterpret_cast<const char*>(&n), sizeof(n));
+        buffer.append(data, len);
+        maybe_flush();
+    }
+
+    void finish() {
+        flush();
+        ::fsync(fd);
+        ::close(fd);
+        fd = -1;
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot rename " + tmp_path + " to " + path);
+        }
+        fsync_directory(std::filesystem::path(path).parent_path().string());
+    }
+
+private:
+    std::string path, tmp_path;
+    int fd;
+    std::string buffer;
+
+    void maybe_flush() { if (buffer.size() >= COLUMN_WRITE_CHUNK) flush(); }
+
+    void flush() {
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (n <= 0) throw std::runtime_error("Column file write failed: " + tmp_path);
+            written += (size_t)n;
+        }
+        buffer.clear();
+    }
+};
+
+// Bounds-checked cursor over a column file read into memory.
+class ColumnFileReader {
+public:
+    ColumnFileReader(const std::string &data, const std::string &path) : data(data), path(path), pos(0) {}
+
+    template<typename T>
+    T get() {
+        T v;
+        need(sizeof(v));
+        memcpy(&v, data.data() + pos, sizeof(v));
+        pos += sizeof(v);
+        return v;
+    }
+
+    std::string get_string() {
+        uint32_t n = get<uint32_t>();
+        need(n);
+        std::string s = data.substr(pos, n);
+        pos += n;
+        return s;
+    }
+
+private:
+    const std::string &data;
+    const std::string &path;
+    size_t pos;
+
+    void need(size_t n) {
+        if (pos + n > data.size()) throw std::runtime_error("Truncated column file: " + path);
+    }
+};
+
+ColumnStore::ColumnStore(const Vector<ColumnSpec> &schema)
+: state(std::make_shared<State>()), loaded_lsn(0) {
+    state->schema = schema;
+    for (const auto &spec : schema) {
+        if (!valid_type(spec.type)) throw std::runtime_error("Unknown column type: " + spec.type);
+        state->dictionaries.push_back(spec.type == "dict" ? std::make_shared<Dictionary>() : nullptr);
+    }
+}
+
+bool ColumnStore::valid_type(const std::string &type) {
+    return type == "dict" || type == "number" || type == "blob";
+}
+
+Vector<ColumnSpec> ColumnStore::parse_schema(const std::string &spec) {
+    Vector<ColumnSpec> schema;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(start, end - start);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos || eq == 0) throw std::runtime_error("Invalid column spec: " + item);
+        ColumnSpec c{item.substr(0, eq), item.substr(eq + 1)};
+        if (!valid_type(c.type)) throw std::runtime_error("Unknown column type: " + c.type);
+        schema.push_back(c);
+        start = end + 1;
+    }
+    if (schema.empty()) throw std::runtime_error("Empty column spec");
+    return schema;
+}
+
+int ColumnStore::column_index(const std::string &name) const {
+    for (size_t i = 0; i < state->schema.size(); ++i) {
+        if (state->schema[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+ColumnStore::Chunk& ColumnStore::writable_chunk(size_t idx) {
+    if (state->chunks[idx].use_count() > 1) {
+        state->chunks[idx] = std::make_shared<Chunk>(*state->chunks[idx]);
+    }
+    return *state->chunks[idx];
+}
+
+ColumnStore::Dictionary& ColumnStore::writable_dictionary(size_t col) {
+    if (state->dictionaries[col].use_count() > 1) {
+        state->dictionaries[col] = std::make_shared<Dictionary>(*state->dictionaries[col]);
+    }
+    return *state->dictionaries[col];
+}
+
+void ColumnStore::put(const std::string &id, const json &doc) {
+    remove(id);
+
+    if (state->chunks.empty() || state->chunks.back()->ids.size() == CHUNK_ROWS) {
+        auto chunk = std::make_shared<Chunk>();
+        chunk->columns.resize(state->schema.size());
+        state->chunks.push_back(chunk);
+    }
+    size_t chunk_idx = state->chunks.size() - 1;
+    Chunk &chunk = writable_chunk(chunk_idx);
+
+    json extras = json::object();
+    for (auto it = doc.begin(); it != doc.end(); ++it) {
+        if (it.key() == "_id") continue;
+        int col = column_index(it.key());
+        bool stored = col >= 0 && (state->schema[col].type == "number" ? it.value().is_number() : it.value().is_string());
+        if (!stored) extras[it.key()] = it.value();
+    }
+
+    for (size_t i = 0; i < state->schema.size(); ++i) {
+        const ColumnSpec &spec = state->schema[i];
+        Column &c = chunk.columns[i];
+        auto it = doc.find(spec.name);
+        bool has = it != doc.end();
+
+        if (spec.type == "dict") {
+            bool ok = has && it->is_string();
+            uint32_t code = 0;
+            if (ok) {
+                const std::string &v = it->get_ref<const std::string&>();
+                if (!state->dictionaries[i]->codes.get(v, code)) {
+                    Dictionary &d = writable_dictionary(i);
+                    code = (uint32_t)d.values.size();
+                    d.values.push_back(v);
+                    d.codes.put(v, code);
+                }
+            }
+            c.present.push_back(ok ? 1 : 0);
+            c.codes.push_back(code);
+        } else if (spec.type == "number") {
+            uint8_t kind = NUM_MISSING;
+            uint64_t bits = 0;
+            if (has && it->is_number_float()) {
+                double d = it->get<double>();
+                memcpy(&bits, &d, sizeof(bits));
+                kind = NUM_FLOAT;
+            } else if (has && it->is_number_unsigned()) {
+                bits = it->get<uint64_t>();
+                kind = NUM_UINT;
+            } else if (has && it->is_number_integer()) {
+                int64_t v = it->get<int64_t>();
+                memcpy(&bits, &v, sizeof(bits));
+                kind = NUM_INT;
+            }
+            c.present.push_back(kind);
+            c.bits.push_back(bits);
+        } else {
+            bool ok = has && it->is_string();
+            if (ok) c.arena.append(it->get_ref<const std::string&>());
+            c.present.push_back(ok ? 1 : 0);
+            c.ends.push_back(c.arena.size());
+        }
+    }
+
+    if (extras.empty()) {
+        chunk.extras.push_back(std::string());
+    } else {
+        auto bytes = json::to_msgpack(extras);
+        chunk.extras.push_back(std::string(bytes.begin(), bytes.end()));
+    }
+    chunk.ids.push_back(id);
+    chunk.live.push_back(1);
+    rows.put(id, chunk_idx * CHUNK_ROWS + chunk.ids.size() - 1);
+    ++state->live_rows;
+}
+
+json ColumnStore::value(const State &st, const Chunk &chunk, size_t col, size_t row) {
+    const Column &c = chunk.columns[col];
+    const std::string &type = st.schema[col].type;
+    if (type == "dict") {
+        return st.dictionaries[col]->values[c.codes[row]];
+    }
+    if (type == "number") {
+        uint64_t bits = c.bits[row];
+        if (c.present[row] == NUM_FLOAT) {
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+        if (c.present[row] == NUM_UINT) return bits;
+        int64_t v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+    uint64_t start = row == 0 ? 0 : c.ends[row - 1];
+    return c.arena.substr(start, c.ends[row] - start);
+}
+
+json ColumnStore::extra_fields(const Chunk &chunk, size_t row) {
+    return chunk.extras[row].empty() ? json::object() : json::from_msgpack(chunk.extras[row]);
+}
+
+json ColumnStore::decode(const State &st, const Chunk &chunk, size_t row) {
+    json doc = extra_fields(chunk, row);
+    for (size_t i = 0; i < st.schema.size(); ++i) {
+        if (chunk.columns[i].present[row]) doc[st.schema[i].name] = value(st, chunk, i, row);
+    }
+    doc["_id"] = chunk.ids[row];
+    return doc;
+}
+
+bool ColumnStore::get(const std::string &id, json &out) const {
+    uint64_t r;
+    if (!rows.get(id, r)) return false;
+    out = decode(*state, *state->chunks[r / CHUNK_ROWS], r % CHUNK_ROWS);
+    return true;
+}
+
+bool ColumnStore::contains(const std::string &id) const {
+    uint64_t r;
+    return rows.get(id, r);
+}
+
+bool ColumnStore::remove(const std::string &id) {
+    uint64_t r;
+    if (!rows.get(id, r)) return false;
+    writable_chunk(r / CHUNK_ROWS).live[r % CHUNK_ROWS] = 0;
+    rows.remove(id);
+    --state->live_rows;
+    return true;
+}
+
+void ColumnStore::visit(const State &st, const Visitor &fn) {
+    for (const auto &chunk : st.chunks) {
+        for (size_t row = 0; row < chunk->ids.size(); ++row) {
+            if (chunk->live[row]) fn(chunk->ids[row], decode(st, *chunk, row));
+        }
+    }
+}
+
+void ColumnStore::for_each(const Visitor &fn) const {
+    visit(*state, fn);
+}
+
+size_t ColumnStore::size() const { return state->live_rows; }
+
+std::shared_ptr<StorageSnapshot> ColumnStore::snapshot() const {
+    auto s = std::make_shared<Snapshot>();
+    s->state = std::make_shared<State>(*state);
+    return s;
+}
+
+uint64_t ColumnStore::checkpoint_lsn() const { return loaded_lsn; }
+
+std::string ColumnStore::file_extension() const { return ".col"; }
+
+// Filters and groups on column values only; dictionary columns evaluate each
+// condition once per distinct value instead of once per row.
+bool ColumnStore::count_by(const json &query, const std::string &field, const std::string &bucket,
+                           HashMap<uint64_t> &counts) const {
+    const State &st = *state;
+    if (!query.is_object()) return false;
+    int group_col = field.empty() ? -1 : column_index(field);
+    if (!field.empty() && group_col < 0) return false;
+
+    struct Filter {
+        size_t col;
+        json cond;
+        Vector<int8_t> by_code;
+    };
+    Vector<Filter> filters;
+    for (auto it = query.begin(); it != query.end(); ++it) {
+        int col = column_index(it.key());
+        if (col < 0) return false;
+        filters.push_back(Filter{(size_t)col, it.value(), Vector<int8_t>()});
+    }
+
+    bool group_dict = group_col >= 0 && st.schema[group_col].type == "dict";
+    Vector<uint64_t> by_code;
+    if (group_dict) by_code.resize(st.dictionaries[group_col]->values.size());
+    uint64_t ungrouped = 0;
+
+    for (const auto &chunk : st.chunks) {
+        for (size_t row = 0; row < chunk->ids.size(); ++row) {
+            if (!chunk->live[row]) continue;
+
+            // Values that did not fit their column live in the row's extras.
+            bool match = true;
+            for (auto &f : filters) {
+                const Column &c = chunk->columns[f.col];
+                const std::string &name = st.schema[f.col].name;
+                if (!c.present[row]) {
+                    match = evaluate_condition_on_field(extra_fields(*chunk, row), name, f.cond);
+                } else if (st.schema[f.col].type == "dict") {
+                    uint32_t code = c.codes[row];
+                    while (f.by_code.size() <= code) f.by_code.push_back(-1);
+                    if (f.by_code[code] < 0) {
+                        json probe = {{name, st.dictionaries[f.col]->values[code]}};
+                        f.by_code[code] = evaluate_condition_on_field(probe, name, f.cond) ? 1 : 0;
+                    }
+                    match = f.by_code[code] == 1;
+                } else {
+                    json probe = {{name, value(st, *chunk, f.col, row)}};
+                    match = evaluate_condition_on_field(probe, name, f.cond);
+                }
+                if (!match) break;
+            }
+            if (!match) continue;
+
+            if (group_col < 0) {
+                ++ungrouped;
+            } else if (group_dict && chunk->columns[group_col].present[row]) {
+                ++by_code[chunk->columns[group_col].codes[row]];
+            } else {
+                json v;
+                if (chunk->columns[group_col].present[row]) {
+                    v = value(st, *chunk, group_col, row);
+                } else {
+                    json doc = extra_fields(*chunk, row);
+                    if (!doc.contains(field)) continue;
+                    v = doc[field];
+                }
+                std::string key = group_key(v, bucket);
+                uint64_t n = 0;
+                counts.get(key, n);
+                counts.put(key, n + 1);
+            }
+        }
+    }
+
+    if (group_col < 0) {
+        uint64_t n = 0;
+        counts.get("", n);
+        counts.put("", n + ungrouped);
+    }
+    for (size_t code = 0; code < by_code.size(); ++code) {
+        if (by_code[code] == 0) continue;
+        std::string key = group_key(st.dictionaries[group_col]->values[code], bucket);
+        uint64_t n = 0;
+        counts.get(key, n);
+        counts.put(key, n + by_code[code]);
+    }
+    return true;
+}
+
+json ColumnStore::stats() const {
+    size_t total = 0;
+    for (const auto &chunk : state->chunks) total += chunk->ids.size();
+    json dictionaries = json::object();
+    for (size_t i = 0; i < state->schema.size(); ++i) {
+        if (state->dictionaries[i]) dictionaries[state->schema[i].name] = state->dictionaries[i]->values.size();
+    }
+    return {
+        {"engine", "columnar"},
+        {"rows", total},
+        {"live_rows", state->live_rows},
+        {"chunks", state->chunks.size()},
+        {"dictionary_sizes", dictionaries}
+    };
+}
+
+size_t ColumnStore::Snapshot::size() const { return state->live_rows; }
+
+void ColumnStore::Snapshot::for_each(const Visitor &fn) const {
+    visit(*state, fn);
+}
+
+void ColumnStore::Snapshot::write(const std::string &path, uint64_t lsn) const {
+    const State &st = *state;
+    ColumnFileWriter w(path);
+
+    ColumnFileHeader h;
+    memcpy(h.magic, COLUMN_MAGIC, sizeof(COLUMN_MAGIC));
+    h.version = COLUMN_VERSION;
+    h.column_count = (uint32_t)st.schema.size();
+    h.rows = st.live_rows;
+    h.lsn = lsn;
+    w.put(h);
+
+    for (const auto &spec : st.schema) {
+        w.put_string(spec.name.data(), spec.name.size());
+        w.put(type_code(spec.type));
+    }
+
+    auto each_row = [&](const std::function<void(const Chunk&, size_t)> &fn) {
+        for (const auto &chunk : st.chunks) {
+            for (size_t row = 0; row < chunk->ids.size(); ++row) {
+                if (chunk->live[row]) fn(*chunk, row);
+            }
+        }
+    };
+
+    each_row([&](const Chunk &c, size_t row) { w.put_string(c.ids[row].data(), c.ids[row].size()); });
+
+    for (size_t i = 0; i < st.schema.size(); ++i) {
+        const std::string &type = st.schema[i].type;
+        if (type == "dict") {
+            const Dictionary &d = *st.dictionaries[i];
+            w.put((uint32_t)d.values.size());
+            for (const auto &v : d.values) w.put_string(v.data(), v.size());
+            each_row([&](const Chunk &c, size_t row) { w.put(c.columns[i].present[row]); });
+            each_row([&](const Chunk &c, size_t row) { w.put(c.columns[i].codes[row]); });
+        } else if (type == "number") {
+            each_row([&](const Chunk &c, size_t row) { w.put(c.columns[i].present[row]); });
+            each_row([&](const Chunk &c, size_t row) { w.put(c.columns[i].bits[row]); });
+        } else {
+            each_row([&](const Chunk &c, size_t row) { w.put(c.columns[i].present[row]); });
+            each_row([&](const Chunk &c, size_t row) {
+                const Column &col = c.columns[i];
+                uint64_t start = row == 0 ? 0 : col.ends[row - 1];
+                w.put_string(col.arena.data() + start, col.ends[row] - start);
+            });
+        }
+    }
+
+    each_row([&](const Chunk &c, size_t row) { w.put_string(c.extras[row].data(), c.extras[row].size()); });
+    w.finish();
+}
+
+void ColumnStore::load(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) throw std::runtime_error("Cannot open column file " + path);
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    ColumnFileReader r(data, path);
+
+    ColumnFileHeader h = r.get<ColumnFileHeader>();
+    if (memcmp(h.magic, COLUMN_MAGIC, sizeof(COLUMN_MAGIC)) != 0 || h.version != COLUMN_VERSION) {
+        throw std::runtime_error("Invalid column file header: " + path);
+    }
+    if (h.column_count != state->schema.size()) {
+        throw std::runtime_error("Column file " + path + " does not match the collection schema");
+    }
+    for (size_t i = 0; i < state->schema.size(); ++i) {
+        std::string name = r.get_string();
+        uint8_t type = r.get<uint8_t>();
+        if (name != state->schema[i].name || type != type_code(state->schema[i].type)) {
+            throw std::runtime_error("Column file " + path + " does not match the collection schema");
+        }
+    }
+
+    auto fresh = std::make_shared<State>();
+    fresh->schema = state->schema;
+    for (const auto &spec : state->schema) {
+        fresh->dictionaries.push_back(spec.type == "dict" ? std::make_shared<Dictionary>() : nullptr);
+    }
+    HashMap<uint64_t> fresh_rows;
+    size_t n = (size_t)h.rows;
+
+    for (size_t row = 0; row < n; ++row) {
+        if (row % CHUNK_ROWS == 0) {
+            auto chunk = std::make_shared<Chunk>();
+            chunk->columns.resize(fresh->schema.size());
+            fresh->chunks.push_back(chunk);
+        }
+        Chunk &c = *fresh->chunks.back();
+        std::string id = r.get_string();
+        fresh_rows.put(id, row);
+        c.ids.push_back(id);
+        c.live.push_back(1);
+    }
+
+    auto chunk_of = [&](size_t row) -> Chunk& { return *fresh->chunks[row / CHUNK_ROWS]; };
+    for (size_t i = 0; i < fresh->schema.size(); ++i) {
+        const std::string &type = fresh->schema[i].type;
+        if (type == "dict") {
+            Dictionary &d = *fresh->dictionaries[i];
+            uint32_t size = r.get<uint32_t>();
+            for (uint32_t k = 0; k < size; ++k) {
+                std::string v = r.get_string();
+                d.codes.put(v, k);
+                d.values.push_back(v);
+            }
+            for (size_t row = 0; row < n; ++row) chunk_of(row).columns[i].present.push_back(r.get<uint8_t>());
+            for (size_t row = 0; row < n; ++row) {
+                uint32_t code = r.get<uint32_t>();
+                if (code >= size && chunk_of(row).columns[i].present[row % CHUNK_ROWS]) {
+                    throw std::runtime_error("Corrupt dictionary code in " + path);
+                }
+                chunk_of(row).columns[i].codes.push_back(code);
+            }
+        } else if (type == "number") {
+            for (size_t row = 0; row < n; ++row) chunk_of(row).columns[i].present.push_back(r.get<uint8_t>());
+            for (size_t row = 0; row < n; ++row) chunk_of(row).columns[i].bits.push_back(r.get<uint64_t>());
+        } else {
+            for (size_t row = 0; row < n; ++row) chunk_of(row).columns[i].present.push_back(r.get<uint8_t>());
+            for (size_t row = 0; row < n; ++row) {
+                Column &col = chunk_of(row).columns[i];
+                col.arena.append(r.get_string());
+                col.ends.push_back(col.arena.size());
+            }
+        }
+    }
+    for (size_t row = 0; row < n; ++row) chunk_of(row).extras.push_back(r.get_string());
+
+    fresh->live_rows = n;
+    state = fresh;
+    rows = fresh_rows;
+    loaded_lsn = h.lsn;
+}
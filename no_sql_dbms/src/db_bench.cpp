@@ -0,0 +1,822 @@
+#include "../include/collection.hpp"
+#include "../include/doc_store.hpp"
+#include "../include/utils.hpp"
+#include "../include/btree_index.hpp"
+#include "../include/text_index.hpp"
+#include "../include/algorithms.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <csignal>
+
+using Clock = std::chrono::steady_clock;
+
+static json make_event(size_t i) {
+    static const char *types[] = {"auth_failure", "auth_success", "sudo_command", "process_start", "file_access"};
+    static const char *severities[] = {"low", "medium", "high", "critical"};
+    static const char *hosts[] = {"web-01", "web-02", "db-01", "bastion"};
+    json e;
+    e["timestamp"] = "2026-10-" + std::to_string(1 + i % 28) + "T12:00:00.000Z";
+    e["hostname"] = hosts[i % 4];
+    e["source"] = "auth.log";
+    e["event_type"] = types[i % 5];
+    e["severity"] = severities[i % 4];
+    e["user"] = "user" + std::to_string(i % 97);
+    e["process"] = "sshd";
+    e["raw_log"] = "Oct 16 12:00:00 host sshd[" + std::to_string(1000 + i) +
+                   "]: Failed password for user" + std::to_string(i % 97) +
+                   " from 10.0." + std::to_string(i % 256) + "." + std::to_string(i % 251) + " port 22 ssh2";
+    return e;
+}
+
+struct Measurement {
+    double seconds;
+    long max_rss_kb;
+};
+
+// Runs fn in a child process so that peak RSS is measured per scenario.
+static Measurement measure(const std::function<void()> &fn) {
+    int fds[2];
+    if (pipe(fds) != 0) throw std::runtime_error("pipe failed");
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        auto start = Clock::now();
+        fn();
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        if (write(fds[1], &secs, sizeof(secs)) != sizeof(secs)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    Measurement m{0, 0};
+    if (read(fds[0], &m.seconds, sizeof(m.seconds)) != sizeof(m.seconds)) m.seconds = -1;
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    m.max_rss_kb = ru.ru_maxrss;
+    return m;
+}
+
+static void print_row(const std::string &name, const Measurement &m) {
+    std::cout << "  " << std::left << std::setw(34) << name
+              << std::right << std::setw(10) << std::fixed << std::setprecision(3) << m.seconds << " s"
+              << std::setw(12) << m.max_rss_kb / 1024 << " MB peak RSS" << std::endl;
+}
+
+static int bench_load(size_t n) {
+    std::string dir = "/tmp/nosql_bench_load";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string json_path = dir + "/events.json";
+    std::string seg_path = dir + "/events.seg";
+
+    std::cout << "Generating " << n << " events..." << std::endl;
+    measure([&] {
+        json all = json::object();
+        DocStore docs;
+        for (size_t i = 0; i < n; ++i) {
+            json e = make_event(i);
+            std::string id = gen_id();
+            e["_id"] = id;
+            all[id] = e;
+            docs.put(id, e);
+        }
+        std::ofstream ofs(json_path);
+        ofs << std::setw(2) << all << std::endl;
+        docs.write_segment(seg_path, 0);
+    });
+    std::cout << "  legacy JSON:  " << std::filesystem::file_size(json_path) / 1024 << " KB" << std::endl;
+    std::cout << "  segment:      " << std::filesystem::file_size(seg_path) / 1024 << " KB" << std::endl;
+
+    std::cout << "Load time:" << std::endl;
+    print_row("legacy JSON (parse + HashMap)", measure([&] {
+        std::ifstream ifs(json_path);
+        json j; ifs >> j;
+        HashMap<json> store;
+        store.from_json(j);
+    }));
+    print_row("segment (mmap + id table)", measure([&] {
+        DocStore store;
+        store.load_segment(seg_path);
+    }));
+    print_row("segment + decode every document", measure([&] {
+        DocStore store;
+        store.load_segment(seg_path);
+        size_t fields = 0;
+        for (auto &p : store.items()) fields += p.second.size();
+        if (fields == 0) std::cerr << "empty" << std::endl;
+    }));
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+static int connect_to(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Runs db_server in a child process on a fresh directory and waits until
+// it accepts connections. Returns -1 if it does not come up.
+static pid_t start_server(const std::string &binary, int port, const std::string &dir, long delay_us) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        std::string port_arg = std::to_string(port), delay_arg = std::to_string(delay_us);
+        execl(binary.c_str(), binary.c_str(), port_arg.c_str(), dir.c_str(),
+              "--commit-delay-us", delay_arg.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int fd = connect_to(port);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+// Sends one request and reads the newline-terminated response.
+static json round_trip(int fd, const json &request) {
+    std::string out = request.dump();
+    for (size_t sent = 0; sent < out.size();) {
+        ssize_t n = write(fd, out.data() + sent, out.size() - sent);
+        if (n <= 0) throw std::runtime_error("Lost connection to the server");
+        sent += n;
+    }
+    std::string in;
+    char buf[4096];
+    while (in.empty() || in.back() != '\n') {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) throw std::runtime_error("Lost connection to the server");
+        in.append(buf, n);
+    }
+    return json::parse(in);
+}
+
+// Drives a db_server over TCP the way clients do: each client sends insert
+// batches and waits for the acknowledgement, which the server gives once
+// the group commit holding the batch is on disk. Latency is per request.
+static int bench_group_commit(size_t batch, double seconds, long delay_us, const std::string &binary) {
+    const size_t client_counts[] = {1, 2, 4, 8, 16, 32, 64};
+    const int port = 27100 + getpid() % 1000;
+    std::string dir = "/tmp/nosql_bench_group_commit";
+
+    // The server reads a request with a single 4 KB read, so events are kept small.
+    auto make_request = [&](size_t first) {
+        json docs = json::array();
+        for (size_t i = first; i < first + batch; ++i) {
+            json e = make_event(i);
+            docs.push_back({{"hostname", e["hostname"]}, {"event_type", e["event_type"]},
+                            {"severity", e["severity"]}, {"user", e["user"]}, {"seq", i}});
+        }
+        return json{{"database", "events"}, {"operation", "insert"}, {"data", docs}};
+    };
+    if (make_request(100000000).dump().size() >= 4000) {
+        std::cerr << "Batch of " << batch << " does not fit in one server request" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Group commit through " << binary << ": batch " << batch << " documents, max delay "
+              << delay_us << " us, " << seconds << " s per run" << std::endl;
+    std::cout << "  " << std::left << std::setw(10) << "clients" << std::right
+              << std::setw(14) << "inserts/s" << std::setw(12) << "fsyncs/s"
+              << std::setw(16) << "records/fsync" << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::endl;
+
+    for (size_t clients : client_counts) {
+        std::filesystem::remove_all(dir);
+        pid_t server = start_server(binary, port, dir, delay_us);
+        if (server < 0) {
+            std::cerr << "Could not start " << binary << std::endl;
+            return 1;
+        }
+        int admin = connect_to(port);
+        json before = round_trip(admin, {{"database", "events"}, {"operation", "stats"}})["data"]["wal"];
+
+        std::atomic<bool> running{true};
+        std::atomic<uint64_t> inserted{0};
+        std::vector<std::vector<double>> latencies(clients);
+        Vector<std::thread> threads;
+        for (size_t c = 0; c < clients; ++c) {
+            threads.emplace_back([&, c] {
+                int fd = connect_to(port);
+                if (fd < 0) return;
+                size_t i = c * 10000000;
+                while (running) {
+                    json request = make_request(i);
+                    i += batch;
+                    auto start = Clock::now();
+                    json response = round_trip(fd, request);
+                    latencies[c].push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                    if (response.value("status", "") == "success") inserted += batch;
+                }
+                close(fd);
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        running = false;
+        for (auto &t : threads) t.join();
+        json after = round_trip(admin, {{"database", "events"}, {"operation", "stats"}})["data"]["wal"];
+        close(admin);
+        kill(server, SIGKILL);
+        waitpid(server, nullptr, 0);
+
+        std::vector<double> all;
+        for (const auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        auto pct = [&](double p) { return all.empty() ? 0.0 : all[(size_t)(p * (all.size() - 1))]; };
+        uint64_t commits = after["commits"].get<uint64_t>() - before["commits"].get<uint64_t>();
+        uint64_t records = after["records"].get<uint64_t>() - before["records"].get<uint64_t>();
+        std::cout << "  " << std::left << std::setw(10) << clients << std::right << std::fixed
+                  << std::setw(14) << std::setprecision(0) << inserted / seconds
+                  << std::setw(12) << commits / seconds
+                  << std::setw(16) << std::setprecision(1) << (commits ? (double)records / commits : 0.0)
+                  << std::setprecision(2) << std::setw(10) << pct(0.5) << std::setw(10) << pct(0.99)
+                  << std::setw(10) << (all.empty() ? 0.0 : all.back()) << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Inserts n events in batches, checkpointing as the server does, and reports
+// the insert rate of each tenth of the run to show how it changes as the
+// collection grows.
+static int bench_ingest(const std::string &engine, size_t n, size_t checkpoint_mb) {
+    const size_t batch = 100;
+    std::string dir = "/tmp/nosql_bench_ingest";
+    std::filesystem::remove_all(dir);
+
+    {
+        CollectionOptions options;
+        options.engine = engine;
+        Collection coll(dir, "events", options);
+        coll.set_checkpoint_wal_bytes(checkpoint_mb * 1024 * 1024);
+
+        std::cout << "Ingest: " << n << " documents, engine " << engine << ", checkpoint every "
+                  << checkpoint_mb << " MB of WAL" << std::endl;
+        std::cout << "  " << std::left << std::setw(14) << "documents" << std::right
+                  << std::setw(14) << "inserts/s" << std::endl;
+
+        size_t window = std::max<size_t>(n / 10, batch);
+        size_t i = 0;
+        auto start = Clock::now(), window_start = start;
+        while (i < n) {
+            for (size_t b = 0; b < batch && i < n; ++b) coll.insert(make_event(i++));
+            coll.commit();
+            coll.checkpoint_if_needed();
+            if (i % window == 0 || i == n) {
+                auto now = Clock::now();
+                double secs = std::chrono::duration<double>(now - window_start).count();
+                size_t done = i % window == 0 ? window : i % window;
+                std::cout << "  " << std::left << std::setw(14) << i << std::right << std::fixed
+                          << std::setw(14) << std::setprecision(0) << done / secs << std::endl;
+                window_start = now;
+            }
+        }
+        double total = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "  total " << std::fixed << std::setprecision(2) << total << " s, "
+                  << std::setprecision(0) << n / total << " inserts/s" << std::endl;
+        std::cout << "  storage " << coll.stats()["storage"].dump() << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Inserts n events into a collection with hash indexes on a low and a high
+// cardinality field and a B+tree index on a numeric one. Index updates are
+// done in place, so the rate should not fall as the indexes grow. The index
+// types are named explicitly so that the hash indexes are measured whatever
+// create_index would pick for a bare field.
+static int bench_index_insert(size_t n) {
+    const size_t batch = 100;
+    std::string dir = "/tmp/nosql_bench_index_insert";
+    std::filesystem::remove_all(dir);
+
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        json seed = make_event(0);
+        seed["pid"] = 0;
+        coll.insert(seed);
+        coll.create_index("hash:hostname");
+        coll.create_index("hash:raw_log");
+        coll.create_index("btree:pid");
+
+        std::cout << "Indexed insert: " << n << " documents, indexes on hostname, raw_log, pid" << std::endl;
+        std::cout << "  " << std::left << std::setw(14) << "documents" << std::right
+                  << std::setw(14) << "inserts/s" << std::endl;
+        size_t window = std::max<size_t>(n / 10, batch);
+        auto window_start = Clock::now();
+        for (size_t i = 1; i <= n;) {
+            for (size_t b = 0; b < batch && i <= n; ++b, ++i) {
+                json e = make_event(i);
+                e["pid"] = (double)(1000 + i);
+                coll.insert(e);
+            }
+            coll.commit();
+            size_t done = i - 1;
+            if (done % window == 0 || done == n) {
+                auto now = Clock::now();
+                double secs = std::chrono::duration<double>(now - window_start).count();
+                size_t count = done % window == 0 ? window : done % window;
+                std::cout << "  " << std::left << std::setw(14) << done << std::right << std::fixed
+                          << std::setw(14) << std::setprecision(0) << count / secs << std::endl;
+                window_start = now;
+            }
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times range queries on in-memory B+tree indexes of growing size. With the
+// scan walking leaves from the lower bound, the cost of a query should
+// follow its result size and stay flat across index sizes.
+static int bench_range(size_t max_keys) {
+    const size_t result_sizes[] = {10, 100, 1000, 10000};
+    std::mt19937_64 rng(42);
+
+    std::cout << "B+tree range queries: us per query by result size" << std::endl;
+    std::cout << "  " << std::left << std::setw(12) << "index keys" << std::right;
+    for (size_t r : result_sizes) std::cout << std::setw(12) << r;
+    std::cout << std::endl;
+
+    for (size_t n = 10000; n <= max_keys; n *= 10) {
+        std::vector<size_t> keys(n);
+        for (size_t i = 0; i < n; ++i) keys[i] = i;
+        std::shuffle(keys.begin(), keys.end(), rng);
+        BTreeIndex index;
+        for (size_t k : keys) index.insert((double)k, "id" + std::to_string(k));
+
+        std::cout << "  " << std::left << std::setw(12) << n << std::right;
+        for (size_t r : result_sizes) {
+            if (r > n) {
+                std::cout << std::setw(12) << "-";
+                continue;
+            }
+            size_t queries = std::max<size_t>(20, 200000 / r), found = 0;
+            auto start = Clock::now();
+            for (size_t q = 0; q < queries; ++q) {
+                double low = (double)(rng() % (n - r + 1));
+                found += index.rangeSearch(low, low + r, true, false).size();
+            }
+            double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / queries;
+            if (found != queries * r) std::cerr << "unexpected result size" << std::endl;
+            std::cout << std::setw(12) << std::fixed << std::setprecision(2) << us;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Point lookups, 100-key range scans and inserts on the in-memory B+tree
+// for several node fanouts (keys per node), over shuffled integer keys.
+// "miss" probes absent keys, which times the descent alone.
+static int bench_btree(size_t max_keys, const std::vector<int> &fanouts) {
+    std::mt19937_64 rng(7);
+    std::cout << "B+tree by fanout: ns per lookup / us per 100-key range / ns per insert" << std::endl;
+    std::cout << "  " << std::left << std::setw(12) << "index keys" << std::setw(8) << "fanout" << std::right
+              << std::setw(12) << "miss" << std::setw(12) << "lookup" << std::setw(12) << "range" << std::setw(12) << "insert" << std::endl;
+
+    for (size_t n = 100000; n <= max_keys; n *= 10) {
+        std::vector<size_t> keys(n);
+        for (size_t i = 0; i < n; ++i) keys[i] = i;
+        std::shuffle(keys.begin(), keys.end(), rng);
+        std::vector<std::string> ids(n);
+        for (size_t i = 0; i < n; ++i) ids[i] = "id" + std::to_string(i);
+
+        for (int fanout : fanouts) {
+            BTreeIndex index(fanout);
+            auto start = Clock::now();
+            for (size_t k : keys) index.insert((double)k, ids[k]);
+            double insert_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+
+            size_t lookups = 1000000, found = 0;
+            std::vector<double> probes(lookups);
+            for (auto &p : probes) p = (double)(rng() % n);
+            start = Clock::now();
+            for (double p : probes) found += index.search(p).size();
+            double lookup_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / lookups;
+            start = Clock::now();
+            for (double p : probes) found += index.search(p + 0.5).size();
+            double miss_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / lookups;
+
+            size_t ranges = 100000;
+            start = Clock::now();
+            for (size_t q = 0; q < ranges; ++q) {
+                double low = (double)(rng() % (n - 100));
+                found += index.rangeSearch(low, low + 100, true, false).size();
+            }
+            double range_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / ranges;
+            if (found != lookups + ranges * 100) std::cerr << "unexpected result size" << std::endl;
+
+            std::cout << "  " << std::left << std::setw(12) << n << std::setw(8) << fanout << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(12) << miss_ns << std::setw(12) << lookup_ns
+                      << std::setprecision(2) << std::setw(12) << range_us
+                      << std::setprecision(1) << std::setw(12) << insert_ns << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Builds a B+tree over n shuffled (key, id) pairs one insert at a time and
+// by sorting plus bulk loading, then times create_index on a collection of
+// n / 10 documents, which takes the bulk path.
+static int bench_btree_build(size_t n) {
+    std::mt19937_64 rng(11);
+    std::vector<std::pair<double, std::string>> pairs(n);
+    for (size_t i = 0; i < n; ++i) pairs[i] = std::make_pair((double)(rng() % n), "ev" + std::to_string(i));
+
+    auto start = Clock::now();
+    BTreeIndex inserted;
+    for (const auto &p : pairs) inserted.insert(p.first, p.second);
+    double insert_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    parallel_sort(pairs.begin(), pairs.end());
+    double sort_s = std::chrono::duration<double>(Clock::now() - start).count();
+    BTreeIndex loaded;
+    loaded.bulk_load(pairs);
+    double load_s = std::chrono::duration<double>(Clock::now() - start).count() - sort_s;
+
+    size_t mismatches = 0;
+    for (size_t q = 0; q < 1000; ++q) {
+        double k = (double)(rng() % n);
+        mismatches += inserted.search(k).size() != loaded.search(k).size();
+    }
+    if (mismatches) std::cerr << mismatches << " lookups differ" << std::endl;
+
+    std::cout << "B+tree build over " << n << " keys (" << std::thread::hardware_concurrency() << " threads)" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "  insert one by one   " << std::setw(8) << insert_s << " s" << std::endl
+              << "  sort + bulk load    " << std::setw(8) << sort_s + load_s << " s  (sort "
+              << sort_s << " s, load " << load_s << " s)" << std::endl;
+
+    size_t docs = n / 10;
+    std::string dir = "/tmp/nosql_bench_btree_build";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        for (size_t i = 0; i < docs; ++i) {
+            json e = make_event(i);
+            e["pid"] = (double)(rng() % docs);
+            coll.insert(e);
+        }
+        coll.commit();
+        start = Clock::now();
+        coll.create_index("btree:pid");
+        std::cout << "  create_index on " << docs << " documents " << std::setw(8)
+                  << std::chrono::duration<double>(Clock::now() - start).count() << " s" << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times $like queries on raw_log with a full scan and with a trigram index.
+static int bench_like(size_t n) {
+    const char *patterns[] = {"%sshd[12345]%", "%user42 from 10.0.7.%", "%FAILED PASSWORD%"};
+    std::string dir = "/tmp/nosql_bench_like";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        for (size_t i = 0; i < n; ++i) coll.insert(make_event(i));
+        coll.commit();
+
+        auto run = [&](const char *pattern, size_t &found) {
+            json query = {{"raw_log", {{"$like", pattern}}}};
+            size_t queries = 0;
+            auto start = Clock::now();
+            do {
+                found = coll.find(query).size();
+                ++queries;
+            } while (std::chrono::duration<double>(Clock::now() - start).count() < 0.5);
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / queries;
+        };
+
+        const size_t count = sizeof(patterns) / sizeof(patterns[0]);
+        double scan_ms[count], index_ms[count];
+        size_t scan_found[count], index_found[count];
+        for (size_t p = 0; p < count; ++p) scan_ms[p] = run(patterns[p], scan_found[p]);
+        coll.create_index("trigram:raw_log");
+        for (size_t p = 0; p < count; ++p) index_ms[p] = run(patterns[p], index_found[p]);
+
+        std::cout << "$like on raw_log over " << n << " documents: ms per query" << std::endl;
+        std::cout << "  " << std::left << std::setw(26) << "pattern" << std::right << std::setw(12) << "matches"
+                  << std::setw(12) << "full scan" << std::setw(12) << "trigram" << std::endl;
+        for (size_t p = 0; p < count; ++p) {
+            if (scan_found[p] != index_found[p]) std::cerr << "result mismatch for " << patterns[p] << std::endl;
+            std::cout << "  " << std::left << std::setw(26) << patterns[p] << std::right
+                      << std::setw(12) << scan_found[p] << std::fixed << std::setprecision(2)
+                      << std::setw(12) << scan_ms[p] << std::setw(12) << index_ms[p] << std::endl;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times $text queries on raw_log with a full scan and with a text index,
+// and reports how large the compressed posting lists are.
+static int bench_text(size_t n) {
+    const char *labels[] = {"10.0.7.42", "user42 10.0.7.42", "sshd port", "user1 OR user2"};
+    const json conds[] = {"10.0.7.42", "user42 10.0.7.42", "sshd port", json::array({"user1", "user2"})};
+    std::string dir = "/tmp/nosql_bench_text";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        TextIndex sizes("raw_log");
+        size_t raw_bytes = 0;
+        for (size_t i = 0; i < n; ++i) {
+            json e = make_event(i);
+            raw_bytes += e["raw_log"].get_ref<const std::string&>().size();
+            sizes.insert(e, std::to_string(i));
+            coll.insert(e);
+        }
+        coll.commit();
+
+        auto run = [&](const json &cond, size_t &found) {
+            json query = {{"raw_log", {{"$text", cond}}}};
+            size_t count = 0;
+            auto start = Clock::now();
+            do {
+                found = coll.find(query).size();
+                ++count;
+            } while (std::chrono::duration<double>(Clock::now() - start).count() < 0.5);
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / count;
+        };
+
+        const size_t count = sizeof(conds) / sizeof(conds[0]);
+        double scan_ms[count], index_ms[count];
+        size_t scan_found[count], index_found[count];
+        for (size_t q = 0; q < count; ++q) scan_ms[q] = run(conds[q], scan_found[q]);
+        coll.create_index("text:raw_log");
+        for (size_t q = 0; q < count; ++q) index_ms[q] = run(conds[q], index_found[q]);
+
+        std::cout << "$text on raw_log over " << n << " documents: " << raw_bytes / 1024 << " KB of text, "
+                  << sizes.posting_bytes() / 1024 << " KB of postings" << std::endl;
+        std::cout << "  " << std::left << std::setw(26) << "terms" << std::right << std::setw(12) << "matches"
+                  << std::setw(12) << "full scan" << std::setw(12) << "index" << std::endl;
+        for (size_t q = 0; q < count; ++q) {
+            if (scan_found[q] != index_found[q]) std::cerr << "result mismatch for " << conds[q] << std::endl;
+            std::cout << "  " << std::left << std::setw(26) << labels[q] << std::right
+                      << std::setw(12) << scan_found[q] << std::fixed << std::setprecision(2)
+                      << std::setw(12) << scan_ms[q] << std::setw(12) << index_ms[q] << std::endl;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times multi-field, $and and $or queries with a full scan and with one
+// index per field, whose id lists the planner intersects or unites.
+static int bench_planner(size_t n) {
+    const char *labels[] = {"hostname + user", "$and type + user", "$or user1 | user2", "hostname + severity"};
+    const json queries[] = {
+        {{"hostname", "web-01"}, {"user", "user42"}},
+        {{"$and", {{{"event_type", "auth_failure"}}, {{"user", "user42"}}}}},
+        {{"$or", {{{"user", "user1"}}, {{"user", "user2"}}}}},
+        {{"hostname", "web-01"}, {"severity", "high"}}};
+    std::string dir = "/tmp/nosql_bench_planner";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        for (size_t i = 0; i < n; ++i) coll.insert(make_event(i));
+        coll.commit();
+
+        auto run = [&](const json &query, size_t &found) {
+            size_t count = 0;
+            auto start = Clock::now();
+            do {
+                found = coll.find(query).size();
+                ++count;
+            } while (std::chrono::duration<double>(Clock::now() - start).count() < 0.5);
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / count;
+        };
+
+        const size_t count = sizeof(queries) / sizeof(queries[0]);
+        double scan_ms[count], index_ms[count];
+        size_t scan_found[count], index_found[count];
+        for (size_t q = 0; q < count; ++q) scan_ms[q] = run(queries[q], scan_found[q]);
+        for (const char *field : {"hostname", "user", "event_type", "severity"}) coll.create_index(field);
+        for (size_t q = 0; q < count; ++q) index_ms[q] = run(queries[q], index_found[q]);
+
+        std::cout << "Combined conditions over " << n << " documents: ms per query" << std::endl;
+        std::cout << "  " << std::left << std::setw(26) << "query" << std::right << std::setw(12) << "matches"
+                  << std::setw(12) << "full scan" << std::setw(12) << "indexes" << std::endl;
+        for (size_t q = 0; q < count; ++q) {
+            if (scan_found[q] != index_found[q]) std::cerr << "result mismatch for " << queries[q] << std::endl;
+            std::cout << "  " << std::left << std::setw(26) << labels[q] << std::right
+                      << std::setw(12) << scan_found[q] << std::fixed << std::setprecision(2)
+                      << std::setw(12) << scan_ms[q] << std::setw(12) << index_ms[q] << std::endl;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times dashboard-style grouped counts with a scan and with bitmap indexes.
+static int bench_count(size_t n) {
+    struct Case { const char *label; json query; const char *group_by; };
+    const Case cases[] = {
+        {"all by severity", json::object(), "severity"},
+        {"auth_failure by hostname", {{"event_type", "auth_failure"}}, "hostname"},
+        {"high|critical by type", {{"severity", {{"$in", {"high", "critical"}}}}}, "event_type"},
+        {"not web-01, by severity", {{"hostname", {{"$ne", "web-01"}}}}, "severity"}};
+    std::string dir = "/tmp/nosql_bench_count";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        for (size_t i = 0; i < n; ++i) coll.insert(make_event(i));
+        coll.commit();
+
+        auto run = [&](const Case &c, json &result) {
+            size_t count = 0;
+            auto start = Clock::now();
+            do {
+                result = coll.count(c.query, c.group_by, "");
+                ++count;
+            } while (std::chrono::duration<double>(Clock::now() - start).count() < 0.5);
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / count;
+        };
+
+        const size_t count = sizeof(cases) / sizeof(cases[0]);
+        double scan_ms[count], index_ms[count];
+        json scan_result[count], index_result[count];
+        for (size_t q = 0; q < count; ++q) scan_ms[q] = run(cases[q], scan_result[q]);
+        for (const char *field : {"severity", "hostname", "event_type"}) coll.create_index(std::string("bitmap:") + field);
+        for (size_t q = 0; q < count; ++q) index_ms[q] = run(cases[q], index_result[q]);
+
+        std::cout << "Grouped counts over " << n << " documents: ms per query" << std::endl;
+        std::cout << "  " << std::left << std::setw(28) << "query" << std::right
+                  << std::setw(12) << "full scan" << std::setw(12) << "bitmaps" << std::endl;
+        for (size_t q = 0; q < count; ++q) {
+            if (scan_result[q] != index_result[q]) std::cerr << "result mismatch for " << cases[q].label << std::endl;
+            std::cout << "  " << std::left << std::setw(28) << cases[q].label << std::right << std::fixed
+                      << std::setprecision(3) << std::setw(12) << scan_ms[q] << std::setw(12) << index_ms[q] << std::endl;
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Times unindexed time-range and point queries with a scan and with block
+// zone maps and bloom filters. Events arrive in time order.
+static int bench_prune(size_t n) {
+    const char *labels[] = {"last 1% by timestamp", "seq range", "session point", "host + session"};
+    auto stamp = [](size_t i) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "2026-%02zu-%02zuT%02zu:%02zu:%02zu.000Z", 1 + i / 2419200 % 12,
+                      1 + i / 86400 % 28, i / 3600 % 24, i / 60 % 60, i % 60);
+        return std::string(buf);
+    };
+    const json queries[] = {
+        {{"timestamp", {{"$gte", stamp(n - n / 100)}}}},
+        {{"seq", {{"$gte", n / 2}, {"$lt", n / 2 + 500}}}},
+        {{"session", "s" + std::to_string(n / 3)}},
+        {{"hostname", "web-01"}, {"session", "s" + std::to_string(n / 4)}}};
+    std::string dir = "/tmp/nosql_bench_prune";
+    std::filesystem::remove_all(dir);
+    {
+        Collection coll(dir, "events");
+        coll.set_checkpoint_wal_bytes((size_t)1 << 40);
+        for (size_t i = 0; i < n; ++i) {
+            json e = make_event(i);
+            e["timestamp"] = stamp(i);
+            e["seq"] = i;
+            e["session"] = "s" + std::to_string(i);
+            coll.insert(e);
+        }
+        coll.commit();
+
+        auto run = [&](const json &query, size_t &found) {
+            size_t count = 0;
+            auto start = Clock::now();
+            do {
+                found = coll.find(query).size();
+                ++count;
+            } while (std::chrono::duration<double>(Clock::now() - start).count() < 0.5);
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / count;
+        };
+
+        const size_t count = sizeof(queries) / sizeof(queries[0]);
+        double scan_ms[count], block_ms[count];
+        size_t scan_found[count], block_found[count];
+        for (size_t q = 0; q < count; ++q) scan_ms[q] = run(queries[q], scan_found[q]);
+        for (const char *name : {"zonemap:timestamp", "zonemap:seq", "bloom:session"}) coll.create_index(name);
+        for (size_t q = 0; q < count; ++q) block_ms[q] = run(queries[q], block_found[q]);
+
+        std::cout << "Unindexed queries over " << n << " documents: ms per query" << std::endl;
+        std::cout << "  " << std::left << std::setw(24) << "query" << std::right << std::setw(12) << "matches"
+                  << std::setw(12) << "full scan" << std::setw(12) << "blocks" << std::endl;
+        for (size_t q = 0; q < count; ++q) {
+            if (scan_found[q] != block_found[q]) std::cerr << "result mismatch for " << queries[q] << std::endl;
+            std::cout << "  " << std::left << std::setw(24) << labels[q] << std::right
+                      << std::setw(12) << scan_found[q] << std::fixed << std::setprecision(2)
+                      << std::setw(12) << scan_ms[q] << std::setw(12) << block_ms[q] << std::endl;
+        }
+        std::cout << "  " << coll.stats()["block_index"].dump() << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <benchmark> [args...]\n";
+        std::cerr << "Benchmarks:\n  load [documents]\n"
+                  << "  group_commit [batch] [seconds] [max_delay_us] [db_server binary]\n"
+                  << "  ingest [document|paged|lsm] [documents] [checkpoint_wal_mb]\n"
+                  << "  range [max_index_keys]\n"
+                  << "  btree [max_index_keys] [fanout...]\n"
+                  << "  btree_build [keys]\n"
+                  << "  index_insert [documents]\n"
+                  << "  like [documents]\n"
+                  << "  text [documents]\n"
+                  << "  planner [documents]\n"
+                  << "  count [documents]\n"
+                  << "  prune [documents]\n";
+        return 1;
+    }
+    std::string name = argv[1];
+    try {
+        if (name == "load") {
+            return bench_load(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "group_commit") {
+            return bench_group_commit(argc > 2 ? std::stoul(argv[2]) : 10,
+                                      argc > 3 ? std::stod(argv[3]) : 2.0,
+                                      argc > 4 ? std::stol(argv[4]) : 0,
+                                      argc > 5 ? argv[5] : "./db_server");
+        } else if (name == "ingest") {
+            return bench_ingest(argc > 2 ? argv[2] : "lsm",
+                                argc > 3 ? std::stoul(argv[3]) : 500000,
+                                argc > 4 ? std::stoul(argv[4]) : 16);
+        } else if (name == "range") {
+            return bench_range(argc > 2 ? std::stoul(argv[2]) : 1000000);
+        } else if (name == "btree") {
+            std::vector<int> fanouts;
+            for (int i = 3; i < argc; ++i) fanouts.push_back(std::stoi(argv[i]));
+            if (fanouts.empty()) fanouts = {5, 16, 32, 64, 128, 256};
+            return bench_btree(argc > 2 ? std::stoul(argv[2]) : 1000000, fanouts);
+        } else if (name == "btree_build") {
+            return bench_btree_build(argc > 2 ? std::stoul(argv[2]) : 10000000);
+        } else if (name == "index_insert") {
+            return bench_index_insert(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "like") {
+            return bench_like(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "text") {
+            return bench_text(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "planner") {
+            return bench_planner(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "count") {
+            return bench_count(argc > 2 ? std::stoul(argv[2]) : 200000);
+        } else if (name == "prune") {
+            return bench_prune(argc > 2 ? std::stoul(argv[2]) : 200000);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+    std::cerr << "Unknown benchmark: " << name << "\n";
+    return 1;
+}
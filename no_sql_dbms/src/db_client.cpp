@@ -128,7 +128,7 @@ public:
 
     void interactive_mode() {
         std::cout << "NoSQL DB Client Interactive Mode" << std::endl;
-        std::cout << "Commands: INSERT, FIND, DELETE, QUIT" << std::endl;
+        std::cout << "Commands: INSERT, FIND, DELETE, CREATE_INDEX, QUIT" << std::endl;
         std::cout << "Example: INSERT users {\"name\": \"Alice\", \"age\": 25}" << std::endl;
         std::cout << "Type 'QUIT' to exit" << std::endl;
 
@@ -208,9 +208,21 @@ private:
                 std::cerr << "Invalid JSON query: " << e.what() << std::endl;
                 return;
             }
+        } else if (operation == "CREATE_INDEX") {
+            // CREATE_INDEX coll field [{filter}] makes a partial index.
+            size_t space3 = json_str.find(' ');
+            request["field"] = json_str.substr(0, space3);
+            if (space3 != std::string::npos) {
+                try {
+                    request["filter"] = json::parse(json_str.substr(space3 + 1));
+                } catch (const std::exception& e) {
+                    std::cerr << "Invalid JSON filter: " << e.what() << std::endl;
+                    return;
+                }
+            }
         } else {
             std::cerr << "Unknown operation: " << operation << std::endl;
-            std::cerr << "Supported operations: INSERT, FIND, DELETE" << std::endl;
+            std::cerr << "Supported operations: INSERT, FIND, DELETE, CREATE_INDEX" << std::endl;
             return;
         }
 
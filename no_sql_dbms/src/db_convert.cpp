@@ -0,0 +1,126 @@
+#include "../include/collection.hpp"
+#include <iostream>
+#include <filesystem>
+
+// Moves every file of a collection in the default layout into <name>.backup/.
+static void move_aside(const std::string &dbdir, const std::string &name) {
+    std::string backup = dbdir + "/" + name + ".backup";
+    std::filesystem::create_directories(backup + "/indexes");
+    std::string prefix = name + ".";
+    for (const std::string &sub : {std::string(), std::string("/indexes")}) {
+        if (!std::filesystem::exists(dbdir + sub)) continue;
+        for (auto &p : std::filesystem::directory_iterator(dbdir + sub)) {
+            std::string fname = p.path().filename().string();
+            if (!p.is_regular_file() || fname.rfind(prefix, 0) != 0) continue;
+            std::filesystem::rename(p.path(), backup + sub + "/" + fname);
+        }
+    }
+}
+
+static void migrate_collection(const std::string &dbdir, const std::string &name, const CollectionOptions &options) {
+    if (std::filesystem::exists(dbdir + "/" + name + ".meta.json")) {
+        std::cerr << "Skipping '" << name << "': collection options already set\n";
+        return;
+    }
+
+    Vector<json> docs;
+    Vector<std::string> fields;
+    Vector<json> filters;
+    {
+        Collection plain(dbdir, name);
+        docs = plain.find(json::object());
+        fields = plain.index_fields();
+        for (const auto &f : fields) filters.push_back(plain.index_filter(f));
+        plain.discard();
+    }
+    move_aside(dbdir, name);
+
+    Collection migrated(dbdir, name, options);
+    for (size_t i = 0; i < fields.size(); ++i) migrated.create_index(fields[i], filters[i]);
+    for (const auto &doc : docs) migrated.restore(doc);
+    std::cout << "Migrated '" << name << "': " << docs.size() << " documents, old files kept in "
+              << dbdir << "/" << name << ".backup\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <database_dir> [--partition <field>[:hour|day|month[:<retention_days>]]]"
+                  << " [--columns <field>=dict|number|blob[,...]] [--engine document|paged|lsm] [collection...]\n";
+        std::cerr << "Converts <collection>.json files into the binary .seg format.\n";
+        std::cerr << "With --partition, splits the named collections into time partitions.\n";
+        std::cerr << "With --columns or --engine, moves the named collections to another storage engine.\n";
+        return 1;
+    }
+    std::string dbdir = argv[1];
+
+    Vector<std::string> names;
+    CollectionOptions options;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--partition" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t pos = spec.find(':');
+            options.partition_field = spec.substr(0, pos);
+            if (pos != std::string::npos) {
+                std::string rest = spec.substr(pos + 1);
+                size_t pos2 = rest.find(':');
+                options.partition_granularity = rest.substr(0, pos2);
+                if (pos2 != std::string::npos) options.retention_days = std::stoi(rest.substr(pos2 + 1));
+            }
+        } else if (arg == "--columns" && i + 1 < argc) {
+            try {
+                options.columns = ColumnStore::parse_schema(argv[++i]);
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << "\n";
+                return 1;
+            }
+            options.engine = "columnar";
+        } else if (arg == "--engine" && i + 1 < argc) {
+            options.engine = argv[++i];
+            if (options.engine != "document" && options.engine != "paged" && options.engine != "lsm") {
+                std::cerr << "Unknown engine: " << options.engine << "\n";
+                return 1;
+            }
+        } else {
+            names.push_back(arg);
+        }
+    }
+
+    if (!options.to_json().empty()) {
+        if (names.empty()) {
+            std::cerr << "--partition, --columns and --engine require at least one collection name\n";
+            return 1;
+        }
+        try {
+            for (auto &name : names) migrate_collection(dbdir, name, options);
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 2;
+        }
+        return 0;
+    }
+
+    if (names.empty()) {
+        for (auto &p : std::filesystem::directory_iterator(dbdir)) {
+            std::string fname = p.path().filename().string();
+            if (p.path().extension() == ".json" && fname.find(".meta.json") == std::string::npos) {
+                names.push_back(p.path().stem().string());
+            }
+        }
+    }
+
+    try {
+        for (auto &name : names) {
+            if (!std::filesystem::exists(dbdir + "/" + name + ".json")) {
+                std::cerr << "Skipping '" << name << "': no legacy JSON file\n";
+                continue;
+            }
+            Collection coll(dbdir, name);
+            std::cout << "Converted '" << name << "'\n";
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+    return 0;
+}
@@ -11,6 +11,8 @@
 #include <cstring>
 #include <chrono>
 #include <atomic>
+#include <ctime>
+#include <algorithm>
 
 using json = nlohmann::json;
 
@@ -27,15 +29,34 @@ private:
     int port;
     std::string db_dir;
     HashMap<Collection*> collections;
-    HashMap<std::shared_mutex*> db_mutexes;
+    HashMap<std::shared_timed_mutex*> db_mutexes;
     std::mutex collections_mutex;
     std::atomic<int> client_count{0};
 
     HashMap<ClientInfo*> connected_clients;
     std::mutex clients_mutex;
 
+    std::chrono::microseconds commit_delay;
+    size_t checkpoint_wal_bytes;
+    HashMap<CollectionOptions> collection_options;
+    size_t cache_bytes;
+
+    std::chrono::milliseconds ttl_interval;
+    std::chrono::milliseconds ttl_budget;
+    size_t ttl_batch;
+
 public:
-    DBServer(int p, const std::string& dir) : port(p), db_dir(dir), client_count(0) {}
+    DBServer(int p, const std::string& dir,
+             std::chrono::microseconds delay = std::chrono::microseconds(0),
+             size_t checkpoint_bytes = 64 * 1024 * 1024,
+             const HashMap<CollectionOptions>& options = HashMap<CollectionOptions>(),
+             size_t cache = 64 * 1024 * 1024,
+             std::chrono::milliseconds reap_interval = std::chrono::milliseconds(1000),
+             std::chrono::milliseconds reap_budget = std::chrono::milliseconds(50),
+             size_t reap_batch = 512)
+    : port(p), db_dir(dir), client_count(0), commit_delay(delay), checkpoint_wal_bytes(checkpoint_bytes),
+      collection_options(options), cache_bytes(cache), ttl_interval(reap_interval), ttl_budget(reap_budget),
+      ttl_batch(reap_batch) {}
 
     ~DBServer() {
         std::cout << "Saving all collections and cleaning up..." << std::endl;
@@ -97,6 +118,8 @@ public:
         std::cout << "DB Server listening on port " << port << std::endl;
         std::cout << "Database directory: " << db_dir << std::endl;
 
+        std::thread(&DBServer::run_ttl_reaper, this).detach();
+
         while (true) {
             int client_socket = accept(server_fd, nullptr, nullptr);
             if (client_socket < 0) {
@@ -247,35 +270,44 @@ private:
             return {{"status", "error"}, {"message", "Failed to create or access collection"}};
         }
 
-        std::shared_mutex* db_mutex = get_db_mutex(db_name);
+        std::shared_timed_mutex* db_mutex = get_db_mutex(db_name);
         if (!db_mutex) {
             return {{"status", "error"}, {"message", "Failed to get database mutex"}};
         }
 
         try {
             if (operation == "insert" || operation == "delete") {
-                auto start = std::chrono::steady_clock::now();
-                bool locked = false;
-
-                while (std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
-                    if (db_mutex->try_lock()) {
-                        locked = true;
-                        break;
-                    }
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                }
-
-                if (!locked) {
+                // Writers queue on the lock instead of polling it, so one that
+                // arrives just after another only waits for that write.
+                std::unique_lock<std::shared_timed_mutex> write_lock(*db_mutex, std::chrono::seconds(5));
+                if (!write_lock.owns_lock()) {
                     return {{"status", "error"}, {"message", "Database lock timeout"}};
                 }
 
-                std::lock_guard<std::shared_mutex> write_lock(*db_mutex, std::adopt_lock);
-                return execute_write_operation(coll, request, operation);
+                json response = execute_write_operation(coll, request, operation);
+                uint64_t lsn = coll->last_lsn();
+                coll->checkpoint_if_needed();
+                write_lock.unlock();
+
+                // Acknowledge only once the group containing this request is on disk.
+                coll->wait_durable(lsn);
+                return response;
 
             } else if (operation == "find") {
-                std::shared_lock<std::shared_mutex> read_lock(*db_mutex);
+                std::shared_lock<std::shared_timed_mutex> read_lock(*db_mutex);
                 return execute_read_operation(coll, request);
 
+            } else if (operation == "count") {
+                std::shared_lock<std::shared_timed_mutex> read_lock(*db_mutex);
+                return execute_count_operation(coll, request);
+
+            } else if (operation == "create_index") {
+                return execute_create_index(coll, *db_mutex, request);
+
+            } else if (operation == "stats") {
+                std::shared_lock<std::shared_timed_mutex> read_lock(*db_mutex);
+                return {{"status", "success"}, {"data", coll->stats()}};
+
             } else {
                 return {{"status", "error"}, {"message", "Unknown operation: " + operation}};
             }
@@ -304,8 +336,6 @@ private:
                 }
             }
 
-            coll->save();
-
             return {
                 {"status", "success"},
                 {"message", "Inserted " + std::to_string(inserted_ids.size()) + " documents"},
@@ -321,10 +351,6 @@ private:
             try {
                 int deleted_count = coll->remove(request["query"]);
 
-                if (deleted_count > 0) {
-                    coll->save();
-                }
-
                 return {
                     {"status", "success"},
                     {"message", "Deleted " + std::to_string(deleted_count) + " documents"},
@@ -361,22 +387,195 @@ private:
         }
     }
 
+    json execute_count_operation(Collection* coll, const json& request) {
+        if (!request.contains("query")) {
+            return {{"status", "error"}, {"message", "Count operation requires query"}};
+        }
+
+        try {
+            std::string group_by = request.value("group_by", "");
+            std::string bucket = request.value("bucket", "");
+            json counts = coll->count(request["query"], group_by, bucket);
+            uint64_t total = 0;
+            for (const auto& c : counts) total += c.get<uint64_t>();
+            if (group_by.empty()) counts = total;
+
+            return {
+                {"status", "success"},
+                {"message", "Counted " + std::to_string(total) + " documents"},
+                {"data", counts},
+                {"count", total}
+            };
+        } catch (const std::exception& e) {
+            return {{"status", "error"}, {"message", std::string("Count failed: ") + e.what()}};
+        }
+    }
+
+    // Totals over the collections an index is built in.
+    struct IndexBuildTimes {
+        size_t documents = 0;
+        size_t caught_up = 0;
+        std::chrono::steady_clock::duration build{0};
+        std::chrono::steady_clock::duration publish{0};
+    };
+
+    // Builds the index from a snapshot without holding the lock, so inserts
+    // keep going; the lock is taken again only to start the build and to
+    // catch up on the writes made meanwhile and publish the index. A
+    // partitioned collection builds it one partition at a time this way.
+    json execute_create_index(Collection* coll, std::shared_timed_mutex& db_mutex, const json& request) {
+        if (!request.contains("field") || !request["field"].is_string()) {
+            return {{"status", "error"}, {"message", "Create index operation requires field"}};
+        }
+        std::string spec = request["field"];
+        // An optional "filter" query makes a partial index.
+        json filter = request.value("filter", json());
+
+        Vector<Collection*> targets;
+        Vector<std::shared_ptr<Collection>> parts;
+        if (coll->partitioned()) {
+            {
+                std::unique_lock<std::shared_timed_mutex> write_lock(db_mutex);
+                parts = coll->add_partition_index(spec, filter);
+            }
+            for (auto& part : parts) targets.push_back(part.get());
+        } else {
+            targets.push_back(coll);
+        }
+
+        IndexBuildTimes times;
+        for (Collection* target : targets) build_index_online(target, db_mutex, spec, filter, times);
+
+        auto ms = [](std::chrono::steady_clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+        };
+        json response = {
+            {"status", "success"},
+            {"message", "Index created on '" + spec + "'"},
+            {"documents", times.documents},
+            {"caught_up", times.caught_up},
+            {"build_ms", ms(times.build)},
+            {"publish_ms", ms(times.publish)}
+        };
+        if (coll->partitioned()) response["partitions"] = targets.size();
+        return response;
+    }
+
+    void build_index_online(Collection* coll, std::shared_timed_mutex& db_mutex, const std::string& spec,
+                            const json& filter, IndexBuildTimes& times) {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<IndexBuild> build;
+        {
+            std::unique_lock<std::shared_timed_mutex> write_lock(db_mutex);
+            // A partition dropped by retention meanwhile needs no index.
+            if (coll->is_discarded()) return;
+            build = coll->start_index_build(spec, filter);
+        }
+        times.documents += build->snap->size();
+        try {
+            Collection::run_index_build(*build);
+        } catch (...) {
+            std::unique_lock<std::shared_timed_mutex> write_lock(db_mutex);
+            coll->abort_index_build(build);
+            throw;
+        }
+        auto built = std::chrono::steady_clock::now();
+
+        uint64_t lsn;
+        {
+            std::unique_lock<std::shared_timed_mutex> write_lock(db_mutex);
+            if (coll->is_discarded()) {
+                coll->abort_index_build(build);
+                return;
+            }
+            times.caught_up += build->before.size();
+            try {
+                coll->finish_index_build(build);
+            } catch (...) {
+                coll->abort_index_build(build);
+                throw;
+            }
+            lsn = coll->last_lsn();
+            coll->checkpoint_if_needed();
+        }
+        coll->wait_durable(lsn);
+        times.build += built - start;
+        times.publish += std::chrono::steady_clock::now() - built;
+    }
+
+    // Every ttl_interval, deletes the expired documents of collections with
+    // TTL indexes. The deletes run in batches of ttl_batch, each under the
+    // write lock on its own, and a cycle stops once ttl_budget is spent, so
+    // inserts never wait long; what is left goes in the next cycle. The
+    // deletes are not waited on: if lost in a crash they are redone.
+    void run_ttl_reaper() {
+        while (true) {
+            std::this_thread::sleep_for(ttl_interval);
+            auto deadline = std::chrono::steady_clock::now() + ttl_budget;
+            Vector<HashMap<Collection*>::Pair> targets;
+            {
+                std::lock_guard<std::mutex> lock(collections_mutex);
+                targets = collections.items();
+            }
+            for (const auto& item : targets) {
+                if (std::chrono::steady_clock::now() >= deadline) break;
+                try {
+                    reap_collection(item.first, item.second, deadline);
+                } catch (const std::exception& e) {
+                    std::cerr << "TTL pass on '" << item.first << "' failed: " << e.what() << std::endl;
+                }
+            }
+        }
+    }
+
+    void reap_collection(const std::string& db_name, Collection* coll, std::chrono::steady_clock::time_point deadline) {
+        std::shared_timed_mutex* db_mutex = get_db_mutex(db_name);
+        {
+            std::shared_lock<std::shared_timed_mutex> read_lock(*db_mutex);
+            if (!coll->expires_documents()) return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        int64_t now = std::time(nullptr);
+        size_t deleted = 0;
+        while (true) {
+            std::unique_lock<std::shared_timed_mutex> write_lock(*db_mutex);
+            size_t batch = coll->remove_expired(now, ttl_batch);
+            deleted += batch;
+            coll->checkpoint_if_needed();
+            if (batch == ttl_batch && std::chrono::steady_clock::now() < deadline) continue;
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            coll->record_ttl_pass(deleted, ms);
+            if (deleted > 0) {
+                std::cout << "TTL pass on '" << db_name << "': deleted " << deleted << " documents in "
+                          << ms << " ms" << std::endl;
+            }
+            return;
+        }
+    }
+
     Collection* get_collection(const std::string& db_name) {
         std::lock_guard<std::mutex> lock(collections_mutex);
 
         Collection* coll = nullptr;
         if (!collections.get(db_name, coll)) {
             std::cout << "Creating new collection: " << db_name << std::endl;
-            coll = new Collection(db_dir, db_name);
+            CollectionOptions options;
+            collection_options.get(db_name, options);
+            options.cache_bytes = cache_bytes;
+            coll = new Collection(db_dir, db_name, options);
+            coll->set_commit_delay(commit_delay);
+            coll->set_checkpoint_wal_bytes(checkpoint_wal_bytes);
             collections.put(db_name, coll);
         }
         return coll;
     }
 
-    std::shared_mutex* get_db_mutex(const std::string& db_name) {
-        std::shared_mutex* mutex = nullptr;
+    std::shared_timed_mutex* get_db_mutex(const std::string& db_name) {
+        std::lock_guard<std::mutex> lock(collections_mutex);
+        std::shared_timed_mutex* mutex = nullptr;
         if (!db_mutexes.get(db_name, mutex)) {
-            mutex = new std::shared_mutex();
+            mutex = new std::shared_timed_mutex();
             db_mutexes.put(db_name, mutex);
         }
         return mutex;
@@ -384,18 +583,103 @@ private:
 };
 
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <port> <database_directory>" << std::endl;
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <port> <database_directory>"
+                  << " [--commit-delay-us <microseconds>] [--checkpoint-wal-mb <megabytes>]"
+                  << " [--partition <collection>:<field>[:hour|day|month[:<retention_days>]]]..."
+                  << " [--columns <collection>:<field>=dict|number|blob[,...]]..."
+                  << " [--engine <collection>:document|paged|lsm]... [--cache-mb <megabytes per paged collection>]"
+                  << " [--ttl-interval-ms <ms>] [--ttl-budget-ms <ms>] [--ttl-batch <documents>]" << std::endl;
         return 1;
     }
 
     int port = std::stoi(argv[1]);
     std::string db_dir = argv[2];
+    std::chrono::microseconds commit_delay(0);
+    size_t checkpoint_wal_bytes = 64 * 1024 * 1024;
+    size_t cache_bytes = 64 * 1024 * 1024;
+    HashMap<CollectionOptions> collection_options;
+    std::chrono::milliseconds ttl_interval(1000), ttl_budget(50);
+    size_t ttl_batch = 512;
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--commit-delay-us" && i + 1 < argc) {
+            commit_delay = std::chrono::microseconds(std::stol(argv[++i]));
+        } else if (arg == "--checkpoint-wal-mb" && i + 1 < argc) {
+            checkpoint_wal_bytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cache_bytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--ttl-interval-ms" && i + 1 < argc) {
+            ttl_interval = std::chrono::milliseconds(std::stol(argv[++i]));
+        } else if (arg == "--ttl-budget-ms" && i + 1 < argc) {
+            ttl_budget = std::chrono::milliseconds(std::stol(argv[++i]));
+        } else if (arg == "--ttl-batch" && i + 1 < argc) {
+            ttl_batch = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t pos = spec.find(':');
+            std::string engine = pos == std::string::npos ? "" : spec.substr(pos + 1);
+            if (pos == 0 || (engine != "document" && engine != "paged" && engine != "lsm")) {
+                std::cerr << "Invalid engine spec: " << spec << std::endl;
+                return 1;
+            }
+            CollectionOptions options;
+            collection_options.get(spec.substr(0, pos), options);
+            options.engine = engine;
+            collection_options.put(spec.substr(0, pos), options);
+        } else if (arg == "--partition" && i + 1 < argc) {
+            Vector<std::string> parts;
+            std::string spec = argv[++i];
+            size_t start = 0, pos;
+            while ((pos = spec.find(':', start)) != std::string::npos) {
+                parts.push_back(spec.substr(start, pos - start));
+                start = pos + 1;
+            }
+            parts.push_back(spec.substr(start));
+            if (parts.size() < 2 || parts.size() > 4 || parts[0].empty() || parts[1].empty()) {
+                std::cerr << "Invalid partition spec: " << spec << std::endl;
+                return 1;
+            }
+            CollectionOptions options;
+            collection_options.get(parts[0], options);
+            options.partition_field = parts[1];
+            if (parts.size() > 2) options.partition_granularity = parts[2];
+            if (parts.size() > 3) options.retention_days = std::stoi(parts[3]);
+            if (!PartitionSet::valid_granularity(options.partition_granularity)) {
+                std::cerr << "Invalid partition granularity: " << options.partition_granularity << std::endl;
+                return 1;
+            }
+            collection_options.put(parts[0], options);
+        } else if (arg == "--columns" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t pos = spec.find(':');
+            if (pos == std::string::npos || pos == 0) {
+                std::cerr << "Invalid columns spec: " << spec << std::endl;
+                return 1;
+            }
+            CollectionOptions options;
+            collection_options.get(spec.substr(0, pos), options);
+            try {
+                options.columns = ColumnStore::parse_schema(spec.substr(pos + 1));
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            options.engine = "columnar";
+            collection_options.put(spec.substr(0, pos), options);
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
 
     std::cout << "Starting DB Server on port " << port << " with data directory: " << db_dir << std::endl;
+    std::cout << "Group commit delay: " << commit_delay.count() << " us" << std::endl;
 
     try {
-        DBServer server(port, db_dir);
+        DBServer server(port, db_dir, commit_delay, checkpoint_wal_bytes, collection_options, cache_bytes,
+                        ttl_interval, ttl_budget, ttl_batch);
         server.start();
     } catch (const std::exception& e) {
         std::cerr << "Server fatal error: " << e.what() << std::endl;
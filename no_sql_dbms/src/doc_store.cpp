@@ -0,0 +1,176 @@
+#include "../include/doc_store.hpp"
+
+DocStore::DocStore() { clear(); }
+
+size_t DocStore::bucket_count(const Table &t) {
+    return t.chunks.size() * CHUNK_BUCKETS;
+}
+
+size_t DocStore::bucket_index(const Table &t, const std::string &id) {
+    return std::hash<std::string>{}(id) % bucket_count(t);
+}
+
+const Vector<DocStore::Entry>& DocStore::bucket(const Table &t, size_t idx) {
+    return t.chunks[idx / CHUNK_BUCKETS]->buckets[idx % CHUNK_BUCKETS];
+}
+
+const DocStore::Entry* DocStore::find(const std::string &id) const {
+    for (const auto &e : bucket(*table, bucket_index(*table, id))) {
+        if (e.id == id) return &e;
+    }
+    return nullptr;
+}
+
+Vector<DocStore::Entry>& DocStore::writable_bucket(size_t idx) {
+    if (table.use_count() > 1) table = std::make_shared<Table>(*table);
+    auto &chunk = table->chunks[idx / CHUNK_BUCKETS];
+    if (chunk.use_count() > 1) chunk = std::make_shared<Chunk>(*chunk);
+    return chunk->buckets[idx % CHUNK_BUCKETS];
+}
+
+void DocStore::insert_entry(Entry e) {
+    if ((double)(table->size + 1) / bucket_count(*table) > 0.75) {
+        rehash(table->chunks.size() * 2);
+    }
+    auto &b = writable_bucket(bucket_index(*table, e.id));
+    for (auto &cur : b) {
+        if (cur.id == e.id) { cur = std::move(e); return; }
+    }
+    b.push_back(std::move(e));
+    ++table->size;
+}
+
+void DocStore::rehash(size_t chunk_count) {
+    auto fresh = std::make_shared<Table>();
+    for (size_t i = 0; i < chunk_count; ++i) fresh->chunks.push_back(std::make_shared<Chunk>());
+    fresh->size = table->size;
+    for (const auto &chunk : table->chunks) {
+        for (const auto &b : chunk->buckets) {
+            for (const auto &e : b) {
+                size_t idx = bucket_index(*fresh, e.id);
+                fresh->chunks[idx / CHUNK_BUCKETS]->buckets[idx % CHUNK_BUCKETS].push_back(e);
+            }
+        }
+    }
+    table = fresh;
+}
+
+void DocStore::put(const std::string &id, const json &doc) {
+    Entry e;
+    e.id = id;
+    e.doc = std::make_shared<const json>(doc);
+    insert_entry(std::move(e));
+}
+
+bool DocStore::get(const std::string &id, json &out) const {
+    const Entry *e = find(id);
+    if (!e) return false;
+    out = e->slot >= 0 ? segment->document((size_t)e->slot) : *e->doc;
+    return true;
+}
+
+bool DocStore::contains(const std::string &id) const {
+    return find(id) != nullptr;
+}
+
+bool DocStore::remove(const std::string &id) {
+    if (!find(id)) return false;
+    auto &b = writable_bucket(bucket_index(*table, id));
+    for (size_t i = 0; i < b.size(); ++i) {
+        if (b[i].id == id) {
+            b.erase(i);
+            --table->size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DocStore::visit(const Table &t, const Segment *seg, const Visitor &fn) {
+    for (const auto &chunk : t.chunks) {
+        for (const auto &b : chunk->buckets) {
+            for (const auto &e : b) {
+                if (e.slot >= 0) fn(e.id, seg->document((size_t)e.slot));
+                else fn(e.id, *e.doc);
+            }
+        }
+    }
+}
+
+Vector<DocStore::Pair> DocStore::items() const {
+    Vector<Pair> res;
+    for_each([&](const std::string &id, const json &doc) { res.emplace_back(id, doc); });
+    return res;
+}
+
+void DocStore::for_each(const Visitor &fn) const {
+    visit(*table, segment.get(), fn);
+}
+
+size_t DocStore::size() const { return table->size; }
+
+void DocStore::clear() {
+    table = std::make_shared<Table>();
+    table->chunks.push_back(std::make_shared<Chunk>());
+    segment.reset();
+}
+
+std::shared_ptr<StorageSnapshot> DocStore::snapshot() const {
+    auto s = std::make_shared<Snapshot>();
+    s->table = table;
+    s->segment = segment;
+    return s;
+}
+
+void DocStore::load(const std::string &path) {
+    load_segment(path);
+}
+
+std::string DocStore::file_extension() const { return ".seg"; }
+
+void DocStore::load_segment(const std::string &path) {
+    clear();
+    segment = std::make_shared<Segment>(path);
+    size_t n = segment->count();
+    size_t chunks = 1;
+    while (chunks * CHUNK_BUCKETS * 0.75 < n) chunks *= 2;
+    rehash(chunks);
+    for (size_t i = 0; i < n; ++i) {
+        Entry e;
+        e.id = segment->id(i);
+        e.slot = (int64_t)i;
+        insert_entry(std::move(e));
+    }
+}
+
+uint64_t DocStore::checkpoint_lsn() const {
+    return segment ? segment->lsn() : 0;
+}
+
+void DocStore::write_segment(const std::string &path, uint64_t lsn) const {
+    snapshot()->write(path, lsn);
+}
+
+size_t DocStore::Snapshot::size() const { return table->size; }
+
+void DocStore::Snapshot::for_each(const Visitor &fn) const {
+    visit(*table, segment.get(), fn);
+}
+
+void DocStore::Snapshot::write(const std::string &path, uint64_t lsn) const {
+    SegmentWriter writer(path, lsn);
+    for (const auto &chunk : table->chunks) {
+        for (const auto &b : chunk->buckets) {
+            for (const auto &e : b) {
+                if (e.slot >= 0) {
+                    size_t len;
+                    const uint8_t *body = segment->raw_document((size_t)e.slot, len);
+                    writer.add_raw(e.id, body, len);
+                } else {
+                    writer.add(e.id, *e.doc);
+                }
+            }
+        }
+    }
+    writer.finish();
+}
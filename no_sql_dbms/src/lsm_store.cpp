@@ -0,0 +1,554 @@
+#include "../include/lsm_store.hpp"
+#include "../include/bloom_filter.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+const size_t LsmStore::LEVELS;
+
+static const size_t L0_COMPACTION_TRIGGER = 4;
+static const size_t LEVEL1_BYTES = 64ull << 20;
+static const size_t LEVEL_MULTIPLIER = 10;
+static const size_t RUN_TARGET_BYTES = 16ull << 20;
+static const size_t MEMTABLE_ENTRY_OVERHEAD = 64;
+
+static size_t level_bytes(const Vector<std::shared_ptr<SortedRun>> &runs) {
+    size_t total = 0;
+    for (const auto &r : runs) total += r->bytes();
+    return total;
+}
+
+static size_t level_budget(size_t level) {
+    size_t budget = LEVEL1_BYTES;
+    for (size_t l = 1; l < level; ++l) budget *= LEVEL_MULTIPLIER;
+    return budget;
+}
+
+// Parses "<seq>.run" (or "<seq>.run.tmp" when tmp is set) after the
+// collection prefix.
+static bool parse_run_name(const std::string &rest, uint64_t &seq, bool &tmp) {
+    size_t dot = rest.find('.');
+    if (dot == 0 || dot == std::string::npos) return false;
+    for (size_t i = 0; i < dot; ++i) {
+        if (rest[i] < '0' || rest[i] > '9') return false;
+    }
+    std::string suffix = rest.substr(dot);
+    if (suffix != ".run" && suffix != ".run.tmp") return false;
+    seq = std::stoull(rest.substr(0, dot));
+    tmp = suffix == ".run.tmp";
+    return true;
+}
+
+LsmStore::LsmStore(const std::string &base_path)
+: tree(std::make_shared<Tree>()), active(std::make_shared<Memtable>()), count(0), active_bytes(0), loaded_lsn(0) {
+    tree->base = base_path;
+    tree->version = std::make_shared<Version>();
+    // Without a manifest no run belongs to the collection yet.
+    if (!fs::exists(base_path + file_extension())) remove_unlisted(base_path, Vector<uint64_t>());
+    compactor = std::thread(compaction_loop, tree);
+}
+
+LsmStore::~LsmStore() {
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        tree->stop = true;
+    }
+    tree->cv.notify_all();
+    if (compactor.joinable()) compactor.join();
+}
+
+std::string LsmStore::Tree::run_path(uint64_t seq) const {
+    return base + "." + std::to_string(seq) + ".run";
+}
+
+void LsmStore::Tree::write_manifest(const std::string &path, const Version &v, uint64_t next) const {
+    json levels = json::array();
+    for (size_t l = 0; l < LEVELS; ++l) {
+        json seqs = json::array();
+        for (const auto &r : v.levels[l]) seqs.push_back(r->seq());
+        levels.push_back(seqs);
+    }
+    json manifest = {
+        {"lsn", durable_lsn},
+        {"count", durable_count},
+        {"next_run", next},
+        {"levels", levels}
+    };
+    write_file_atomic(path, manifest.dump());
+}
+
+void LsmStore::remove_unlisted(const std::string &base, const Vector<uint64_t> &keep) {
+    fs::path dir = fs::path(base).parent_path();
+    std::string prefix = fs::path(base).filename().string() + ".";
+    if (!fs::exists(dir)) return;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) != 0) continue;
+        uint64_t seq;
+        bool tmp;
+        if (!parse_run_name(name.substr(prefix.size()), seq, tmp)) continue;
+        if (!tmp && std::find(keep.begin(), keep.end(), seq) != keep.end()) continue;
+        fs::remove(entry.path());
+    }
+}
+
+// ---- reads and writes ----
+
+bool LsmStore::lookup(const std::string &id, Value &out) const {
+    auto it = active->find(id);
+    if (it != active->end()) {
+        out = it->second;
+        return true;
+    }
+
+    Vector<std::shared_ptr<const Memtable>> frozen;
+    std::shared_ptr<const Version> v;
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        frozen = tree->frozen;
+        v = tree->version;
+    }
+    for (size_t i = frozen.size(); i-- > 0;) {
+        auto f = frozen[i]->find(id);
+        if (f != frozen[i]->end()) {
+            out = f->second;
+            return true;
+        }
+    }
+
+    uint64_t h = BloomFilter::hash(id);
+    const auto &l0 = v->levels[0];
+    for (size_t i = l0.size(); i-- > 0;) {
+        if (l0[i]->get(id, h, out.deleted, out.body)) return true;
+    }
+    for (size_t l = 1; l < LEVELS; ++l) {
+        const auto &runs = v->levels[l];
+        size_t lo = 0, hi = runs.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (runs[mid]->max_key() < id) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < runs.size() && runs[lo]->get(id, h, out.deleted, out.body)) return true;
+    }
+    return false;
+}
+
+void LsmStore::put(const std::string &id, const json &doc) {
+    Value old;
+    bool existed = lookup(id, old) && !old.deleted;
+    auto body = json::to_msgpack(doc);
+    Value &v = (*active)[id];
+    v.deleted = false;
+    v.body.assign(body.begin(), body.end());
+    active_bytes += id.size() + body.size() + MEMTABLE_ENTRY_OVERHEAD;
+    if (!existed) ++count;
+}
+
+bool LsmStore::get(const std::string &id, json &out) const {
+    Value v;
+    if (!lookup(id, v) || v.deleted) return false;
+    out = json::from_msgpack(v.body);
+    return true;
+}
+
+bool LsmStore::contains(const std::string &id) const {
+    Value v;
+    return lookup(id, v) && !v.deleted;
+}
+
+bool LsmStore::remove(const std::string &id) {
+    if (!contains(id)) return false;
+    Value &v = (*active)[id];
+    v.deleted = true;
+    v.body.clear();
+    active_bytes += id.size() + MEMTABLE_ENTRY_OVERHEAD;
+    --count;
+    return true;
+}
+
+Vector<Vector<LsmStore::RunPtr>> LsmStore::groups_of(const Version &v) {
+    Vector<Vector<RunPtr>> groups;
+    for (size_t i = v.levels[0].size(); i-- > 0;) {
+        Vector<RunPtr> one;
+        one.push_back(v.levels[0][i]);
+        groups.push_back(one);
+    }
+    for (size_t l = 1; l < LEVELS; ++l) {
+        if (!v.levels[l].empty()) groups.push_back(v.levels[l]);
+    }
+    return groups;
+}
+
+void LsmStore::merge(const Vector<const Memtable*> &memtables, const Vector<Vector<RunPtr>> &groups,
+                     bool keep_deleted, const RecordFn &fn) {
+    struct Source {
+        const Memtable *mem = nullptr;
+        Memtable::const_iterator it;
+        const Vector<RunPtr> *runs = nullptr;
+        size_t run = 0;
+        std::unique_ptr<SortedRun::Cursor> cursor;
+
+        void skip_empty_runs() {
+            while (!cursor->valid() && ++run < runs->size()) cursor.reset(new SortedRun::Cursor(*(*runs)[run]));
+        }
+        bool valid() const { return mem ? it != mem->end() : cursor->valid(); }
+        const std::string& id() const { return mem ? it->first : cursor->id(); }
+        void next() {
+            if (mem) {
+                ++it;
+                return;
+            }
+            cursor->next();
+            skip_empty_runs();
+        }
+    };
+
+    std::vector<Source> sources(memtables.size() + groups.size());
+    for (size_t i = 0; i < memtables.size(); ++i) {
+        sources[i].mem = memtables[i];
+        sources[i].it = memtables[i]->begin();
+    }
+    for (size_t i = 0; i < groups.size(); ++i) {
+        Source &s = sources[memtables.size() + i];
+        s.runs = &groups[i];
+        s.cursor.reset(new SortedRun::Cursor(*groups[i][0]));
+        s.skip_empty_runs();
+    }
+
+    while (true) {
+        size_t best = sources.size();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            if (!sources[i].valid()) continue;
+            if (best == sources.size() || sources[i].id() < sources[best].id()) best = i;
+        }
+        if (best == sources.size()) break;
+
+        // Earlier sources are newer, so the first one holding the id wins.
+        std::string id = sources[best].id();
+        const Source &s = sources[best];
+        if (s.mem) {
+            const Value &v = s.it->second;
+            if (!v.deleted || keep_deleted) {
+                fn(id, v.deleted, reinterpret_cast<const uint8_t*>(v.body.data()), v.body.size());
+            }
+        } else if (!s.cursor->deleted() || keep_deleted) {
+            fn(id, s.cursor->deleted(), s.cursor->body(), s.cursor->body_len());
+        }
+        for (size_t i = best; i < sources.size(); ++i) {
+            if (sources[i].valid() && sources[i].id() == id) sources[i].next();
+        }
+    }
+}
+
+void LsmStore::for_each(const Visitor &fn) const {
+    Vector<std::shared_ptr<const Memtable>> frozen;
+    std::shared_ptr<const Version> v;
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        frozen = tree->frozen;
+        v = tree->version;
+    }
+    Vector<const Memtable*> memtables;
+    memtables.push_back(active.get());
+    for (size_t i = frozen.size(); i-- > 0;) memtables.push_back(frozen[i].get());
+    merge(memtables, groups_of(*v), false, [&](const std::string &id, bool, const uint8_t *body, size_t len) {
+        fn(id, json::from_msgpack(body, body + len));
+    });
+}
+
+size_t LsmStore::size() const { return count; }
+
+// ---- checkpoint ----
+
+std::shared_ptr<StorageSnapshot> LsmStore::snapshot() const {
+    auto snap = std::make_shared<Snapshot>();
+    snap->tree = tree;
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        if (!active->empty()) {
+            tree->frozen.push_back(active);
+            active = std::make_shared<Memtable>();
+            active_bytes = 0;
+        }
+        snap->frozen = tree->frozen;
+        snap->version = tree->version;
+    }
+    snap->count = count;
+    return snap;
+}
+
+size_t LsmStore::Snapshot::size() const { return count; }
+
+void LsmStore::Snapshot::for_each(const Visitor &fn) const {
+    Vector<const Memtable*> memtables;
+    for (size_t i = frozen.size(); i-- > 0;) memtables.push_back(frozen[i].get());
+    merge(memtables, groups_of(*version), false, [&](const std::string &id, bool, const uint8_t *body, size_t len) {
+        fn(id, json::from_msgpack(body, body + len));
+    });
+}
+
+// Flushes the frozen memtables into one level 0 run, keeping deletions so
+// they still shadow older runs, and then publishes the manifest.
+void LsmStore::Snapshot::write(const std::string &path, uint64_t lsn) const {
+    RunPtr run;
+    if (!frozen.empty()) {
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(tree->mtx);
+            seq = tree->next_run++;
+        }
+        std::string run_file = tree->run_path(seq);
+        SortedRunWriter writer(run_file);
+        Vector<const Memtable*> memtables;
+        for (size_t i = frozen.size(); i-- > 0;) memtables.push_back(frozen[i].get());
+        merge(memtables, Vector<Vector<RunPtr>>(), true, [&](const std::string &id, bool deleted, const uint8_t *body, size_t len) {
+            writer.add(id, deleted, body, len);
+        });
+        writer.finish();
+        run = std::make_shared<SortedRun>(run_file, seq);
+    }
+
+    std::lock_guard<std::mutex> mlock(tree->manifest_mtx);
+    std::shared_ptr<Version> next;
+    uint64_t next_run;
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        next = std::make_shared<Version>(*tree->version);
+        if (run) {
+            next->levels[0].push_back(run);
+            ++tree->flushes;
+            tree->bytes_flushed += run->bytes();
+        }
+        Vector<std::shared_ptr<const Memtable>> remaining;
+        for (const auto &m : tree->frozen) {
+            if (std::find(frozen.begin(), frozen.end(), m) == frozen.end()) remaining.push_back(m);
+        }
+        tree->frozen = remaining;
+        tree->version = next;
+        tree->work = true;
+        next_run = tree->next_run;
+    }
+    tree->cv.notify_all();
+    tree->durable_lsn = lsn;
+    tree->durable_count = count;
+    tree->write_manifest(path, *next, next_run);
+}
+
+void LsmStore::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Cannot open LSM manifest " + path);
+    json manifest;
+    try {
+        in >> manifest;
+    } catch (const std::exception &e) {
+        throw std::runtime_error("Invalid LSM manifest " + path + ": " + e.what());
+    }
+
+    auto v = std::make_shared<Version>();
+    Vector<uint64_t> listed;
+    const json &levels = manifest.at("levels");
+    if (levels.size() > LEVELS) throw std::runtime_error("Too many levels in LSM manifest " + path);
+    for (size_t l = 0; l < levels.size(); ++l) {
+        for (const auto &seq : levels[l]) {
+            uint64_t s = seq.get<uint64_t>();
+            v->levels[l].push_back(std::make_shared<SortedRun>(tree->run_path(s), s));
+            listed.push_back(s);
+        }
+    }
+    remove_unlisted(tree->base, listed);
+
+    uint64_t lsn = manifest.at("lsn").get<uint64_t>();
+    uint64_t n = manifest.at("count").get<uint64_t>();
+    {
+        std::lock_guard<std::mutex> lock(tree->mtx);
+        tree->version = v;
+        tree->frozen = Vector<std::shared_ptr<const Memtable>>();
+        tree->next_run = manifest.at("next_run").get<uint64_t>();
+        tree->durable_lsn = lsn;
+        tree->durable_count = n;
+        tree->work = true;
+    }
+    tree->cv.notify_all();
+    active = std::make_shared<Memtable>();
+    active_bytes = 0;
+    count = (size_t)n;
+    loaded_lsn = lsn;
+}
+
+uint64_t LsmStore::checkpoint_lsn() const { return loaded_lsn; }
+
+std::string LsmStore::file_extension() const { return ".lsm"; }
+
+json LsmStore::stats() const {
+    std::lock_guard<std::mutex> lock(tree->mtx);
+    json levels = json::array();
+    for (size_t l = 0; l < LEVELS; ++l) {
+        uint64_t records = 0;
+        for (const auto &r : tree->version->levels[l]) records += r->count();
+        levels.push_back({
+            {"runs", tree->version->levels[l].size()},
+            {"bytes", level_bytes(tree->version->levels[l])},
+            {"records", records}
+        });
+    }
+    return {
+        {"engine", "lsm"},
+        {"memtable", {
+            {"entries", active->size()},
+            {"bytes", active_bytes}
+        }},
+        {"frozen_memtables", tree->frozen.size()},
+        {"levels", levels},
+        {"flushes", tree->flushes},
+        {"compactions", tree->compactions},
+        {"bytes_flushed", tree->bytes_flushed},
+        {"bytes_compacted", tree->bytes_compacted}
+    };
+}
+
+// ---- compaction ----
+
+void LsmStore::compaction_loop(std::shared_ptr<Tree> tree) {
+    std::unique_lock<std::mutex> lock(tree->mtx);
+    while (!tree->stop) {
+        tree->work = false;
+        lock.unlock();
+        bool worked = false, failed = false;
+        try {
+            worked = compact_once(*tree);
+        } catch (const std::exception &e) {
+            std::cerr << "Compaction of " << tree->base << " failed: " << e.what() << std::endl;
+            failed = true;
+        }
+        lock.lock();
+        if (worked) continue;
+        if (failed) tree->cv.wait_for(lock, std::chrono::seconds(5), [&] { return tree->stop; });
+        else tree->cv.wait(lock, [&] { return tree->stop || tree->work; });
+    }
+}
+
+// Merges one level into the next: all of level 0 once it has enough runs,
+// otherwise one run of the first level over budget, picked round-robin by
+// key. Runs of the next level overlapping the input are rewritten with it.
+bool LsmStore::compact_once(Tree &tree) {
+    std::shared_ptr<const Version> v;
+    {
+        std::lock_guard<std::mutex> lock(tree.mtx);
+        v = tree.version;
+    }
+
+    size_t level = LEVELS;
+    if (v->levels[0].size() >= L0_COMPACTION_TRIGGER) {
+        level = 0;
+    } else {
+        for (size_t l = 1; l + 1 < LEVELS; ++l) {
+            if (level_bytes(v->levels[l]) > level_budget(l)) {
+                level = l;
+                break;
+            }
+        }
+    }
+    if (level == LEVELS) return false;
+
+    Vector<RunPtr> upper, lower;
+    if (level == 0) {
+        upper = v->levels[0];
+    } else {
+        const auto &runs = v->levels[level];
+        size_t pick = 0;
+        while (pick < runs.size() && runs[pick]->min_key() <= tree.compact_pointer[level]) ++pick;
+        if (pick == runs.size()) pick = 0;
+        upper.push_back(runs[pick]);
+        tree.compact_pointer[level] = runs[pick]->max_key();
+    }
+    std::string lo = upper[0]->min_key(), hi = upper[0]->max_key();
+    for (const auto &r : upper) {
+        lo = std::min(lo, r->min_key());
+        hi = std::max(hi, r->max_key());
+    }
+    for (const auto &r : v->levels[level + 1]) {
+        if (!(r->max_key() < lo || r->min_key() > hi)) lower.push_back(r);
+    }
+
+    // Deletions only need to survive while an older level may still hold
+    // the id.
+    bool bottom = true;
+    for (size_t l = level + 2; l < LEVELS; ++l) {
+        if (!v->levels[l].empty()) bottom = false;
+    }
+
+    Vector<Vector<RunPtr>> groups;
+    for (size_t i = upper.size(); i-- > 0;) {
+        Vector<RunPtr> one;
+        one.push_back(upper[i]);
+        groups.push_back(one);
+    }
+    if (!lower.empty()) groups.push_back(lower);
+
+    Vector<RunPtr> outputs;
+    std::unique_ptr<SortedRunWriter> writer;
+    std::string run_file;
+    uint64_t seq = 0;
+    auto finish_run = [&] {
+        writer->finish();
+        writer.reset();
+        outputs.push_back(std::make_shared<SortedRun>(run_file, seq));
+    };
+    merge(Vector<const Memtable*>(), groups, !bottom, [&](const std::string &id, bool deleted, const uint8_t *body, size_t len) {
+        if (!writer) {
+            {
+                std::lock_guard<std::mutex> lock(tree.mtx);
+                seq = tree.next_run++;
+            }
+            run_file = tree.run_path(seq);
+            writer.reset(new SortedRunWriter(run_file));
+        }
+        writer->add(id, deleted, body, len);
+        if (writer->bytes() >= RUN_TARGET_BYTES) finish_run();
+    });
+    if (writer) finish_run();
+
+    std::lock_guard<std::mutex> mlock(tree.manifest_mtx);
+    std::shared_ptr<Version> next;
+    uint64_t next_run;
+    {
+        std::lock_guard<std::mutex> lock(tree.mtx);
+        next = std::make_shared<Version>(*tree.version);
+        auto drop = [](Vector<RunPtr> &runs, const Vector<RunPtr> &gone) {
+            Vector<RunPtr> kept;
+            for (const auto &r : runs) {
+                if (std::find(gone.begin(), gone.end(), r) == gone.end()) kept.push_back(r);
+            }
+            runs = kept;
+        };
+        drop(next->levels[level], upper);
+        drop(next->levels[level + 1], lower);
+
+        std::vector<RunPtr> merged(next->levels[level + 1].begin(), next->levels[level + 1].end());
+        merged.insert(merged.end(), outputs.begin(), outputs.end());
+        std::sort(merged.begin(), merged.end(), [](const RunPtr &a, const RunPtr &b) {
+            return a->min_key() < b->min_key();
+        });
+        next->levels[level + 1] = Vector<RunPtr>();
+        for (const auto &r : merged) next->levels[level + 1].push_back(r);
+
+        tree.version = next;
+        next_run = tree.next_run;
+        ++tree.compactions;
+        tree.bytes_compacted += level_bytes(outputs);
+    }
+    tree.write_manifest(tree.base + ".lsm", *next, next_run);
+    // Input files go away once no reader or snapshot holds them.
+    for (const auto &r : upper) r->mark_obsolete();
+    for (const auto &r : lower) r->mark_obsolete();
+    return true;
+}
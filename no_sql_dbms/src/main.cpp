@@ -11,7 +11,7 @@ void print_json_array(const Vector<json>& v) {
 int main(int argc, char** argv) {
     if (argc < 4) {
         std::cerr << "Usage: ./no_sql_dbms <database_dir> <command> <args...>\n";
-        std::cerr << "Commands:\n  insert '<json_doc>'\n  find '<json_query>'\n  delete '<json_query>'\n  create_index <field>\n";
+        std::cerr << "Commands:\n  insert '<json_doc>'\n  find '<json_query>'\n  delete '<json_query>'\n  create_index <field>[,<field>...] | hash:<field> | ordered:<field> | trigram:<field> | text:<field> | bitmap:<field> | btree:<field>[:<fanout>] | ttl:<field>:<seconds> | zonemap:<field> | bloom:<field> ['<json_filter>']\n";
         return 1;
     }
     std::string dbdir = argv[1];
@@ -40,7 +40,7 @@ int main(int argc, char** argv) {
         } else if (cmd == "create_index") {
             if (argc < 4) { std::cerr<<"create_index needs a field name\n"; return 1; }
             std::string field = argv[3];
-            coll.create_index(field);
+            coll.create_index(field, argc > 4 ? json::parse(argv[4]) : json());
             std::cout << "Index on '" << field << "' created.\n";
         } else {
             std::cerr << "Unknown command\n"; return 1;
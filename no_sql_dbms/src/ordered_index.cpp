@@ -0,0 +1,239 @@
+#include "../include/ordered_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+static const char TAG_MISSING = 0x01;
+static const char TAG_NULL = 0x02;
+static const char TAG_BOOL = 0x03;
+static const char TAG_NUMBER = 0x04;
+static const char TAG_STRING = 0x05;
+static const char TAG_OTHER = 0x06;
+
+// Zero bytes are escaped as 00 FF and the string ends with 00 00, so a
+// string sorts before every longer string it is a prefix of.
+static void encode_bytes(const std::string &s, std::string &out) {
+    for (char c : s) {
+        out.push_back(c);
+        if (c == '\0') out.push_back('\xff');
+    }
+    out.append(2, '\0');
+}
+
+OrderedIndex::OrderedIndex() {}
+
+OrderedIndex::OrderedIndex(const std::string &spec) : fields_spec(spec) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == std::string::npos) comma = spec.size();
+        std::string field = spec.substr(start, comma - start);
+        if (field.empty()) throw std::runtime_error("Invalid index field list: " + spec);
+        fields.push_back(field);
+        start = comma + 1;
+    }
+}
+
+const std::string& OrderedIndex::spec() const { return fields_spec; }
+
+void OrderedIndex::encode(const json &value, std::string &out) {
+    if (value.is_null()) {
+        out.push_back(TAG_NULL);
+    } else if (value.is_boolean()) {
+        out.push_back(TAG_BOOL);
+        out.push_back(value.get<bool>() ? 1 : 0);
+    } else if (value.is_number()) {
+        out.push_back(TAG_NUMBER);
+        double d = value.get<double>();
+        if (d == 0) d = 0;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        bits = (bits & 0x8000000000000000ULL) ? ~bits : bits | 0x8000000000000000ULL;
+        for (int shift = 56; shift >= 0; shift -= 8) out.push_back((char)(bits >> shift));
+    } else if (value.is_string()) {
+        out.push_back(TAG_STRING);
+        encode_bytes(value.get_ref<const std::string&>(), out);
+    } else {
+        out.push_back(TAG_OTHER);
+        encode_bytes(value.dump(), out);
+    }
+}
+
+// Documents without the first field cannot match any query the index
+// serves and are left out; later missing fields sort first.
+bool OrderedIndex::key_for(const json &doc, std::string &key) const {
+    if (!doc.contains(fields[0])) return false;
+    for (const auto &field : fields) {
+        if (doc.contains(field)) encode(doc[field], key);
+        else key.push_back(TAG_MISSING);
+    }
+    return true;
+}
+
+void OrderedIndex::insert(const json &doc, const std::string &id) {
+    std::string key;
+    if (key_for(doc, key)) entries[key].push_back(id);
+}
+
+void OrderedIndex::remove(const json &doc, const std::string &id) {
+    std::string key;
+    if (!key_for(doc, key)) return;
+    auto it = entries.find(key);
+    if (it == entries.end()) return;
+    Vector<std::string> &ids = it->second;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] == id) {
+            ids.erase(i);
+            break;
+        }
+    }
+    if (ids.empty()) entries.erase(it);
+}
+
+static bool has_range(const json &cond) {
+    return cond.contains("$gt") || cond.contains("$gte") || cond.contains("$lt") || cond.contains("$lte")
+        || cond.contains("$prefix") || cond.contains("$in");
+}
+
+// Equality conditions on the leading fields form the key prefix; a range,
+// $prefix or $in condition on the following field is returned in `range`.
+size_t OrderedIndex::plan(const json &query, std::string &prefix, const json *&range) const {
+    range = nullptr;
+    if (!query.is_object() || query.contains("$or") || query.contains("$and")) return 0;
+    size_t used = 0;
+    for (const auto &field : fields) {
+        auto it = query.find(field);
+        if (it == query.end()) break;
+        const json &cond = *it;
+        if (!cond.is_object()) {
+            encode(cond, prefix);
+            ++used;
+            continue;
+        }
+        if (cond.contains("$eq")) {
+            encode(cond["$eq"], prefix);
+            ++used;
+            continue;
+        }
+        if (has_range(cond)) {
+            range = &cond;
+            ++used;
+        }
+        break;
+    }
+    return used;
+}
+
+size_t OrderedIndex::usable_fields(const json &query) const {
+    std::string prefix;
+    const json *range;
+    return plan(query, prefix, range);
+}
+
+// Appends the ids of keys that start with scan_prefix, lie at or after `start`
+// and pass the optional bounds. Keys of one value all start with that
+// value's encoding, which is what makes exclusive and inclusive bounds a
+// prefix test.
+void OrderedIndex::scan(const std::string &scan_prefix, const std::string &start,
+                        const std::string *low, bool include_low,
+                        const std::string *high, bool include_high, Vector<std::string> &ids) const {
+    for (auto it = entries.lower_bound(std::max(start, scan_prefix)); it != entries.end(); ++it) {
+        const std::string &key = it->first;
+        if (key.compare(0, scan_prefix.size(), scan_prefix) != 0) break;
+        if (low && !include_low && key.compare(0, low->size(), *low) == 0) continue;
+        if (high) {
+            bool at_high = key.compare(0, high->size(), *high) == 0;
+            if (at_high ? !include_high : key > *high) break;
+        }
+        for (const auto &id : it->second) ids.push_back(id);
+    }
+}
+
+Vector<std::string> OrderedIndex::lookup(const json &query) const {
+    std::string prefix;
+    const json *range;
+    Vector<std::string> ids;
+    if (plan(query, prefix, range) == 0) return ids;
+    if (!range) {
+        scan(prefix, prefix, nullptr, false, nullptr, false, ids);
+        return ids;
+    }
+    const json &cond = *range;
+
+    if (cond.contains("$in")) {
+        if (!cond["$in"].is_array()) return ids;
+        std::vector<std::string> keys;
+        for (const auto &v : cond["$in"]) {
+            keys.push_back(prefix);
+            encode(v, keys.back());
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for (const auto &key : keys) scan(key, key, nullptr, false, nullptr, false, ids);
+        return ids;
+    }
+
+    // Range operators only compare numbers with numbers and strings with
+    // strings, so the scan stays within one type.
+    const json *low = nullptr, *high = nullptr;
+    bool include_low = false, include_high = false;
+    for (auto op = cond.begin(); op != cond.end(); ++op) {
+        if (op.key() == "$gt" || op.key() == "$gte") {
+            low = &op.value();
+            include_low = op.key() == "$gte";
+        } else if (op.key() == "$lt" || op.key() == "$lte") {
+            high = &op.value();
+            include_high = op.key() == "$lte";
+        }
+    }
+    std::string scan_prefix = prefix;
+    bool is_string;
+    if (cond.contains("$prefix")) {
+        if (!cond["$prefix"].is_string()) return ids;
+        is_string = true;
+        scan_prefix.push_back(TAG_STRING);
+        std::string p;
+        encode_bytes(cond["$prefix"].get<std::string>(), p);
+        scan_prefix.append(p, 0, p.size() - 2);
+    } else {
+        const json &bound = low ? *low : *high;
+        if (!bound.is_number() && !bound.is_string()) return ids;
+        is_string = bound.is_string();
+        scan_prefix.push_back(is_string ? TAG_STRING : TAG_NUMBER);
+    }
+    if ((low && low->is_string() != is_string) || (high && high->is_string() != is_string)) return ids;
+    if ((low && !low->is_number() && !low->is_string()) || (high && !high->is_number() && !high->is_string())) return ids;
+
+    std::string low_key = prefix, high_key = prefix;
+    if (low) encode(*low, low_key);
+    if (high) encode(*high, high_key);
+    scan(scan_prefix, low ? low_key : scan_prefix, low ? &low_key : nullptr, include_low,
+         high ? &high_key : nullptr, include_high, ids);
+    return ids;
+}
+
+size_t OrderedIndex::size() const { return entries.size(); }
+
+json OrderedIndex::to_json() const {
+    json keys = json::array(), ids = json::array();
+    for (const auto &e : entries) {
+        keys.push_back(json::binary(std::vector<std::uint8_t>(e.first.begin(), e.first.end())));
+        json list = json::array();
+        for (const auto &id : e.second) list.push_back(id);
+        ids.push_back(list);
+    }
+    return {{"fields", fields_spec}, {"keys", keys}, {"ids", ids}};
+}
+
+void OrderedIndex::from_json(const json &j) {
+    *this = OrderedIndex(j.at("fields").get<std::string>());
+    const json &keys = j.at("keys");
+    const json &ids = j.at("ids");
+    if (keys.size() != ids.size()) throw std::runtime_error("Corrupt ordered index " + fields_spec);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const auto &bytes = keys[i].get_binary();
+        Vector<std::string> &list = entries[std::string(bytes.begin(), bytes.end())];
+        for (const auto &id : ids[i]) list.push_back(id.get<std::string>());
+    }
+}
@@ -0,0 +1,716 @@
+#include "../include/paged_store.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const size_t PagedStore::PAGE_SIZE;
+const uint32_t PagedStore::NO_PAGE;
+
+static const char MAP_MAGIC[8] = {'N', 'S', 'Q', 'L', 'P', 'G', 'M', '1'};
+static const uint32_t MAP_VERSION = 1;
+static const uint8_t PAGE_FREE = 0;
+static const uint8_t PAGE_DATA = 1;
+static const uint8_t PAGE_OVERFLOW = 2;
+static const uint8_t RECORD_OVERFLOW = 1;
+static const size_t MIN_FRAMES = 16;
+static const size_t MAX_ID_LENGTH = 1024;
+
+struct PageHeader {
+    uint32_t crc;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t next;
+    uint16_t slot_count;
+    uint16_t data_start;
+    uint16_t garbage;
+    uint16_t used;
+    uint32_t reserved2;
+};
+
+struct PageSlot {
+    uint16_t offset;
+    uint16_t length;
+};
+
+static_assert(sizeof(PageHeader) == 24, "page header layout");
+
+static const size_t PAGE_SIZE = PagedStore::PAGE_SIZE;
+static const size_t OVERFLOW_CAPACITY = PAGE_SIZE - sizeof(PageHeader);
+static const size_t INLINE_LIMIT = PAGE_SIZE / 4;
+
+static PageHeader* header_of(uint8_t *p) { return reinterpret_cast<PageHeader*>(p); }
+static const PageHeader* header_of(const uint8_t *p) { return reinterpret_cast<const PageHeader*>(p); }
+static PageSlot* slots_of(uint8_t *p) { return reinterpret_cast<PageSlot*>(p + sizeof(PageHeader)); }
+static const PageSlot* slots_of(const uint8_t *p) { return reinterpret_cast<const PageSlot*>(p + sizeof(PageHeader)); }
+
+static void init_page(uint8_t *p, uint8_t type) {
+    memset(p, 0, PAGE_SIZE);
+    PageHeader *h = header_of(p);
+    h->type = type;
+    h->next = 0xFFFFFFFF;
+    h->data_start = (uint16_t)PAGE_SIZE;
+}
+
+static size_t contiguous_free(const uint8_t *p) {
+    const PageHeader *h = header_of(p);
+    size_t slots_end = sizeof(PageHeader) + h->slot_count * sizeof(PageSlot);
+    return h->data_start > slots_end ? h->data_start - slots_end : 0;
+}
+
+// Bytes available for one more record, counting space of deleted records
+// and the slot a new record may need.
+static size_t usable_free(const uint8_t *p) {
+    size_t total = contiguous_free(p) + header_of(p)->garbage;
+    return total > sizeof(PageSlot) ? total - sizeof(PageSlot) : 0;
+}
+
+static void compact_page(uint8_t *p) {
+    PageHeader *h = header_of(p);
+    PageSlot *slots = slots_of(p);
+    uint8_t tmp[PAGE_SIZE];
+    size_t end = PAGE_SIZE;
+    for (uint16_t i = 0; i < h->slot_count; ++i) {
+        if (slots[i].offset == 0) continue;
+        end -= slots[i].length;
+        memcpy(tmp + end, p + slots[i].offset, slots[i].length);
+        slots[i].offset = (uint16_t)end;
+    }
+    memcpy(p + end, tmp + end, PAGE_SIZE - end);
+    h->data_start = (uint16_t)end;
+    h->garbage = 0;
+}
+
+static int insert_record(uint8_t *p, const std::string &rec) {
+    PageHeader *h = header_of(p);
+    PageSlot *slots = slots_of(p);
+    int slot = -1;
+    for (uint16_t i = 0; i < h->slot_count; ++i) {
+        if (slots[i].offset == 0) { slot = i; break; }
+    }
+    size_t need = rec.size() + (slot < 0 ? sizeof(PageSlot) : 0);
+    if (contiguous_free(p) < need) {
+        if (contiguous_free(p) + h->garbage < need) return -1;
+        compact_page(p);
+    }
+    if (slot < 0) slot = h->slot_count++;
+    h->data_start = (uint16_t)(h->data_start - rec.size());
+    memcpy(p + h->data_start, rec.data(), rec.size());
+    slots[slot].offset = h->data_start;
+    slots[slot].length = (uint16_t)rec.size();
+    return slot;
+}
+
+static void erase_record(uint8_t *p, uint16_t slot) {
+    PageHeader *h = header_of(p);
+    PageSlot *slots = slots_of(p);
+    if (slots[slot].offset == h->data_start) h->data_start = (uint16_t)(h->data_start + slots[slot].length);
+    else h->garbage = (uint16_t)(h->garbage + slots[slot].length);
+    slots[slot].offset = 0;
+    slots[slot].length = 0;
+    while (h->slot_count > 0 && slots[h->slot_count - 1].offset == 0) --h->slot_count;
+}
+
+static void seal_page(uint8_t *p) {
+    header_of(p)->crc = crc32(p + sizeof(uint32_t), PAGE_SIZE - sizeof(uint32_t));
+}
+
+static void read_physical(int fd, uint32_t phys, uint8_t *buf) {
+    size_t done = 0;
+    while (done < PAGE_SIZE) {
+        ssize_t n = ::pread(fd, buf + done, PAGE_SIZE - done, (off_t)phys * PAGE_SIZE + done);
+        if (n <= 0) throw std::runtime_error("Cannot read page " + std::to_string(phys));
+        done += (size_t)n;
+    }
+    if (header_of(buf)->crc != crc32(buf + sizeof(uint32_t), PAGE_SIZE - sizeof(uint32_t))) {
+        throw std::runtime_error("Checksum mismatch in page " + std::to_string(phys));
+    }
+}
+
+static void write_physical(int fd, uint32_t phys, const uint8_t *buf) {
+    size_t done = 0;
+    while (done < PAGE_SIZE) {
+        ssize_t n = ::pwrite(fd, buf + done, PAGE_SIZE - done, (off_t)phys * PAGE_SIZE + done);
+        if (n <= 0) throw std::runtime_error("Cannot write page " + std::to_string(phys));
+        done += (size_t)n;
+    }
+}
+
+static uint64_t location(uint32_t page, uint16_t slot) { return ((uint64_t)page << 16) | slot; }
+
+// Splits a record into id and body; the body is a view into the page.
+static std::string record_id(const uint8_t *rec, const uint8_t *&body, size_t &body_len, size_t len) {
+    uint16_t id_len;
+    memcpy(&id_len, rec + 1, sizeof(id_len));
+    body = rec + 3 + id_len;
+    body_len = len - 3 - id_len;
+    return std::string(reinterpret_cast<const char*>(rec + 3), id_len);
+}
+
+// ---- data file space ----
+
+PagedStore::DataFile::~DataFile() {
+    if (fd >= 0) ::close(fd);
+}
+
+uint32_t PagedStore::DataFile::allocate() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!free_pages.empty()) {
+        uint32_t phys = free_pages.back();
+        free_pages.pop_back();
+        return phys;
+    }
+    return end_page++;
+}
+
+void PagedStore::DataFile::release(uint32_t phys) {
+    std::lock_guard<std::mutex> lock(mtx);
+    free_pages.push_back(phys);
+}
+
+void PagedStore::DataFile::retire(uint32_t phys) {
+    std::lock_guard<std::mutex> lock(mtx);
+    retired.push_back({retire_seq++, phys});
+}
+
+uint64_t PagedStore::DataFile::mark() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return retire_seq;
+}
+
+void PagedStore::DataFile::release_retired(uint64_t upto) {
+    std::lock_guard<std::mutex> lock(mtx);
+    Vector<std::pair<uint64_t, uint32_t>> keep;
+    for (const auto &r : retired) {
+        if (r.first < upto) free_pages.push_back(r.second);
+        else keep.push_back(r);
+    }
+    retired = keep;
+}
+
+// ---- buffer pool ----
+
+PagedStore::PagedStore(const std::string &base_path, size_t cache_bytes)
+: data_path(base_path + ".pdata"), file(std::make_shared<DataFile>()), loaded_lsn(0),
+  hand(0), epoch(1), hits(0), misses(0), evictions(0), writebacks(0), fill_page(NO_PAGE) {
+    size_t frame_count = cache_bytes / PAGE_SIZE;
+    if (frame_count < MIN_FRAMES) frame_count = MIN_FRAMES;
+    for (size_t i = 0; i < frame_count; ++i) frames.push_back(Frame());
+    memory.reset(new uint8_t[frame_count * PAGE_SIZE]);
+
+    // Without a map nothing in the data file belongs to a checkpoint.
+    int flags = O_RDWR | O_CREAT;
+    if (!std::filesystem::exists(base_path + file_extension())) flags |= O_TRUNC;
+    file->fd = ::open(data_path.c_str(), flags, 0644);
+    if (file->fd < 0) throw std::runtime_error("Cannot open data file " + data_path);
+}
+
+PagedStore::~PagedStore() = default;
+
+uint8_t* PagedStore::frame_data(size_t f) const {
+    return memory.get() + f * PAGE_SIZE;
+}
+
+size_t PagedStore::pin(uint32_t page, bool fresh) const {
+    uint32_t f = frame_of[page];
+    if (f != NO_PAGE) {
+        ++hits;
+        frames[f].pins++;
+        frames[f].referenced = true;
+        return f;
+    }
+    f = (uint32_t)victim();
+    uint8_t *buf = frame_data(f);
+    if (fresh || page_map[page] == NO_PAGE) {
+        memset(buf, 0, PAGE_SIZE);
+    } else {
+        ++misses;
+        read_physical(file->fd, page_map[page], buf);
+    }
+    frames[f].page = page;
+    frames[f].pins = 1;
+    frames[f].dirty = false;
+    frames[f].referenced = true;
+    frame_of[page] = f;
+    return f;
+}
+
+void PagedStore::unpin(size_t f, bool dirty) const {
+    frames[f].pins--;
+    if (dirty) frames[f].dirty = true;
+}
+
+size_t PagedStore::victim() const {
+    for (size_t scanned = 0; scanned < 2 * frames.size(); ++scanned) {
+        size_t f = hand;
+        hand = (hand + 1) % frames.size();
+        Frame &fr = frames[f];
+        if (fr.page == NO_PAGE) return f;
+        if (fr.pins > 0) continue;
+        if (fr.referenced) {
+            fr.referenced = false;
+            continue;
+        }
+        if (fr.dirty) write_back(f);
+        frame_of[fr.page] = NO_PAGE;
+        fr.page = NO_PAGE;
+        ++evictions;
+        return f;
+    }
+    throw std::runtime_error("Buffer pool exhausted: every page is pinned");
+}
+
+// Pages already written since the last snapshot are overwritten in place;
+// anything older may belong to a checkpoint and moves to a new page.
+void PagedStore::write_back(size_t f) const {
+    uint32_t page = frames[f].page;
+    uint32_t phys = page_map[page];
+    if (phys == NO_PAGE || page_epoch[page] != epoch) {
+        uint32_t fresh = file->allocate();
+        if (phys != NO_PAGE) file->retire(phys);
+        phys = fresh;
+        page_map[page] = phys;
+        page_epoch[page] = epoch;
+    }
+    uint8_t *buf = frame_data(f);
+    seal_page(buf);
+    write_physical(file->fd, phys, buf);
+    frames[f].dirty = false;
+    ++writebacks;
+}
+
+void PagedStore::flush_all() const {
+    for (size_t f = 0; f < frames.size(); ++f) {
+        if (frames[f].page != NO_PAGE && frames[f].dirty) write_back(f);
+    }
+}
+
+void PagedStore::reset_pool() {
+    for (auto &fr : frames) fr = Frame();
+    frame_of = Vector<uint32_t>();
+    page_map = Vector<uint32_t>();
+    page_epoch = Vector<uint32_t>();
+    page_kind = Vector<uint8_t>();
+    free_space = Vector<uint16_t>();
+    free_logical = Vector<uint32_t>();
+    candidates = Vector<uint32_t>();
+    fill_page = NO_PAGE;
+    directory = HashMap<uint64_t>();
+}
+
+// ---- pages ----
+
+uint32_t PagedStore::new_page(uint8_t kind) {
+    uint32_t page;
+    if (!free_logical.empty()) {
+        page = free_logical.back();
+        free_logical.pop_back();
+    } else {
+        page = (uint32_t)page_map.size();
+        page_map.push_back(NO_PAGE);
+        page_epoch.push_back(0);
+        page_kind.push_back(PAGE_FREE);
+        free_space.push_back(0);
+        frame_of.push_back(NO_PAGE);
+    }
+    page_kind[page] = kind;
+    size_t f = pin(page, true);
+    init_page(frame_data(f), kind);
+    update_free_space(page, frame_data(f));
+    unpin(f, true);
+    return page;
+}
+
+void PagedStore::free_page(uint32_t page) {
+    uint32_t f = frame_of[page];
+    if (f != NO_PAGE) {
+        frames[f] = Frame();
+        frame_of[page] = NO_PAGE;
+    }
+    uint32_t phys = page_map[page];
+    if (phys != NO_PAGE) {
+        if (page_epoch[page] == epoch) file->release(phys);
+        else file->retire(phys);
+    }
+    page_map[page] = NO_PAGE;
+    page_kind[page] = PAGE_FREE;
+    free_space[page] = 0;
+    free_logical.push_back(page);
+}
+
+void PagedStore::update_free_space(uint32_t page, const uint8_t *p) {
+    uint16_t before = free_space[page];
+    free_space[page] = (uint16_t)usable_free(p);
+    if (before < INLINE_LIMIT && free_space[page] >= INLINE_LIMIT && page != fill_page) {
+        candidates.push_back(page);
+    }
+}
+
+uint32_t PagedStore::page_for(size_t len) {
+    if (fill_page != NO_PAGE && free_space[fill_page] >= len) return fill_page;
+    while (!candidates.empty()) {
+        uint32_t page = candidates.back();
+        candidates.pop_back();
+        if (page_kind[page] == PAGE_DATA && free_space[page] >= len) {
+            fill_page = page;
+            return page;
+        }
+    }
+    fill_page = new_page(PAGE_DATA);
+    return fill_page;
+}
+
+std::string PagedStore::read_body(const uint8_t *rec, size_t len) const {
+    const uint8_t *body;
+    size_t body_len;
+    record_id(rec, body, body_len, len);
+    if (!(rec[0] & RECORD_OVERFLOW)) return std::string(reinterpret_cast<const char*>(body), body_len);
+
+    uint32_t page, total;
+    memcpy(&page, body, sizeof(page));
+    memcpy(&total, body + sizeof(page), sizeof(total));
+    std::string out;
+    out.reserve(total);
+    while (page != NO_PAGE && out.size() < total) {
+        size_t f = pin(page);
+        const uint8_t *p = frame_data(f);
+        out.append(reinterpret_cast<const char*>(p + sizeof(PageHeader)), header_of(p)->used);
+        uint32_t next = header_of(p)->next;
+        unpin(f, false);
+        page = next;
+    }
+    if (out.size() != total) throw std::runtime_error("Truncated overflow chain in " + data_path);
+    return out;
+}
+
+void PagedStore::erase_locked(uint64_t loc) {
+    uint32_t page = (uint32_t)(loc >> 16);
+    uint16_t slot = (uint16_t)(loc & 0xFFFF);
+    size_t f = pin(page);
+    uint8_t *p = frame_data(f);
+    const PageSlot &s = slots_of(p)[slot];
+    const uint8_t *rec = p + s.offset;
+    if (rec[0] & RECORD_OVERFLOW) {
+        const uint8_t *body;
+        size_t body_len;
+        record_id(rec, body, body_len, s.length);
+        uint32_t next;
+        memcpy(&next, body, sizeof(next));
+        while (next != NO_PAGE) {
+            size_t of = pin(next);
+            uint32_t after = header_of(frame_data(of))->next;
+            unpin(of, false);
+            free_page(next);
+            next = after;
+        }
+    }
+    erase_record(p, slot);
+    update_free_space(page, p);
+    unpin(f, true);
+}
+
+// ---- StorageEngine ----
+
+void PagedStore::put(const std::string &id, const json &doc) {
+    if (id.size() > MAX_ID_LENGTH) throw std::runtime_error("Document id too long: " + id.substr(0, 64));
+    auto body = json::to_msgpack(doc);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t old;
+    if (directory.get(id, old)) erase_locked(old);
+
+    std::string rec;
+    uint8_t flags = 0;
+    uint16_t id_len = (uint16_t)id.size();
+    if (3 + id.size() + body.size() > INLINE_LIMIT) {
+        flags = RECORD_OVERFLOW;
+        size_t count = (body.size() + OVERFLOW_CAPACITY - 1) / OVERFLOW_CAPACITY;
+        Vector<uint32_t> chain;
+        for (size_t i = 0; i < count; ++i) chain.push_back(new_page(PAGE_OVERFLOW));
+        for (size_t i = 0; i < count; ++i) {
+            size_t f = pin(chain[i]);
+            uint8_t *p = frame_data(f);
+            size_t off = i * OVERFLOW_CAPACITY;
+            size_t n = std::min(OVERFLOW_CAPACITY, body.size() - off);
+            memcpy(p + sizeof(PageHeader), body.data() + off, n);
+            header_of(p)->used = (uint16_t)n;
+            header_of(p)->next = i + 1 < count ? chain[i + 1] : NO_PAGE;
+            unpin(f, true);
+        }
+        uint32_t first = chain[0], total = (uint32_t)body.size();
+        rec.append(reinterpret_cast<const char*>(&flags), 1);
+        rec.append(reinterpret_cast<const char*>(&id_len), sizeof(id_len));
+        rec.append(id);
+        rec.append(reinterpret_cast<const char*>(&first), sizeof(first));
+        rec.append(reinterpret_cast<const char*>(&total), sizeof(total));
+    } else {
+        rec.append(reinterpret_cast<const char*>(&flags), 1);
+        rec.append(reinterpret_cast<const char*>(&id_len), sizeof(id_len));
+        rec.append(id);
+        rec.append(reinterpret_cast<const char*>(body.data()), body.size());
+    }
+
+    uint32_t page = page_for(rec.size());
+    size_t f = pin(page);
+    uint8_t *p = frame_data(f);
+    int slot = insert_record(p, rec);
+    update_free_space(page, p);
+    unpin(f, true);
+    if (slot < 0) throw std::runtime_error("Page " + std::to_string(page) + " has no room for record");
+    directory.put(id, location(page, (uint16_t)slot));
+}
+
+bool PagedStore::get(const std::string &id, json &out) const {
+    uint64_t loc;
+    if (!directory.get(id, loc)) return false;
+    std::string body;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t f = pin((uint32_t)(loc >> 16));
+        const uint8_t *p = frame_data(f);
+        const PageSlot &s = slots_of(p)[loc & 0xFFFF];
+        try {
+            body = read_body(p + s.offset, s.length);
+        } catch (...) {
+            unpin(f, false);
+            throw;
+        }
+        unpin(f, false);
+    }
+    out = json::from_msgpack(body);
+    return true;
+}
+
+bool PagedStore::contains(const std::string &id) const {
+    uint64_t loc;
+    return directory.get(id, loc);
+}
+
+bool PagedStore::remove(const std::string &id) {
+    uint64_t loc;
+    if (!directory.get(id, loc)) return false;
+    std::lock_guard<std::mutex> lock(mtx);
+    erase_locked(loc);
+    directory.remove(id);
+    return true;
+}
+
+// Pages are visited one at a time: the records of a page are copied out
+// under the pool lock and decoded after it is released.
+void PagedStore::for_each(const Visitor &fn) const {
+    size_t page_count;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        page_count = page_map.size();
+    }
+    Vector<std::pair<std::string, std::string>> records;
+    for (uint32_t page = 0; page < page_count; ++page) {
+        if (page_kind[page] != PAGE_DATA) continue;
+        records = Vector<std::pair<std::string, std::string>>();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            size_t f = pin(page);
+            const uint8_t *p = frame_data(f);
+            const PageSlot *slots = slots_of(p);
+            try {
+                for (uint16_t i = 0; i < header_of(p)->slot_count; ++i) {
+                    if (slots[i].offset == 0) continue;
+                    const uint8_t *body;
+                    size_t body_len;
+                    std::string id = record_id(p + slots[i].offset, body, body_len, slots[i].length);
+                    records.push_back({id, read_body(p + slots[i].offset, slots[i].length)});
+                }
+            } catch (...) {
+                unpin(f, false);
+                throw;
+            }
+            unpin(f, false);
+        }
+        for (const auto &r : records) fn(r.first, json::from_msgpack(r.second));
+    }
+}
+
+size_t PagedStore::size() const { return directory.size(); }
+
+std::shared_ptr<StorageSnapshot> PagedStore::snapshot() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    flush_all();
+    auto snap = std::make_shared<Snapshot>();
+    snap->file = file;
+    snap->map = page_map;
+    snap->kinds = page_kind;
+    snap->count = directory.size();
+    snap->release_upto = file->mark();
+    ++epoch;
+    return snap;
+}
+
+void PagedStore::load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open page map " + path);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t fixed = 8 + 4 + 4 + 8 + 8 + 4;
+    if (data.size() < fixed + 4 || memcmp(data.data(), MAP_MAGIC, sizeof(MAP_MAGIC)) != 0) {
+        throw std::runtime_error("Invalid page map " + path);
+    }
+    uint32_t version, page_size, pages, crc;
+    uint64_t lsn, count;
+    memcpy(&version, data.data() + 8, 4);
+    memcpy(&page_size, data.data() + 12, 4);
+    memcpy(&lsn, data.data() + 16, 8);
+    memcpy(&count, data.data() + 24, 8);
+    memcpy(&pages, data.data() + 32, 4);
+    if (version != MAP_VERSION || page_size != PAGE_SIZE || data.size() != fixed + (size_t)pages * 5 + 4) {
+        throw std::runtime_error("Unsupported page map " + path);
+    }
+    memcpy(&crc, data.data() + data.size() - 4, 4);
+    if (crc != crc32(data.data(), data.size() - 4)) throw std::runtime_error("Checksum mismatch in page map " + path);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    reset_pool();
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) throw std::runtime_error("Cannot stat data file " + data_path);
+    uint32_t end_page = (uint32_t)((size_t)st.st_size / PAGE_SIZE);
+
+    Vector<uint8_t> used;
+    for (uint32_t i = 0; i < end_page; ++i) used.push_back(0);
+    const char *entries = data.data() + fixed;
+    for (uint32_t i = 0; i < pages; ++i) {
+        uint32_t phys;
+        memcpy(&phys, entries + (size_t)i * 4, 4);
+        uint8_t kind = (uint8_t)entries[(size_t)pages * 4 + i];
+        if (phys != NO_PAGE && phys >= end_page) throw std::runtime_error("Page map points past the end of " + data_path);
+        if (phys != NO_PAGE) used[phys] = 1;
+        page_map.push_back(phys);
+        page_epoch.push_back(0);
+        page_kind.push_back(kind);
+        free_space.push_back(0);
+        frame_of.push_back(NO_PAGE);
+        if (kind == PAGE_FREE) free_logical.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> flock(file->mtx);
+        file->end_page = end_page;
+        file->free_pages = Vector<uint32_t>();
+        file->retired = Vector<std::pair<uint64_t, uint32_t>>();
+        for (uint32_t i = 0; i < end_page; ++i) {
+            if (!used[i]) file->free_pages.push_back(i);
+        }
+    }
+
+    for (uint32_t page = 0; page < pages; ++page) {
+        if (page_kind[page] != PAGE_DATA) continue;
+        size_t f = pin(page);
+        const uint8_t *p = frame_data(f);
+        const PageSlot *slots = slots_of(p);
+        for (uint16_t i = 0; i < header_of(p)->slot_count; ++i) {
+            if (slots[i].offset == 0) continue;
+            const uint8_t *body;
+            size_t body_len;
+            directory.put(record_id(p + slots[i].offset, body, body_len, slots[i].length), location(page, i));
+        }
+        update_free_space(page, p);
+        unpin(f, false);
+    }
+    if (directory.size() != count) throw std::runtime_error("Page map document count mismatch in " + path);
+    loaded_lsn = lsn;
+}
+
+uint64_t PagedStore::checkpoint_lsn() const { return loaded_lsn; }
+
+std::string PagedStore::file_extension() const { return ".pmap"; }
+
+json PagedStore::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t resident = 0, dirty = 0;
+    for (const auto &fr : frames) {
+        if (fr.page == NO_PAGE) continue;
+        ++resident;
+        if (fr.dirty) ++dirty;
+    }
+    uint64_t lookups = hits + misses;
+    return {
+        {"engine", "paged"},
+        {"page_size", PAGE_SIZE},
+        {"pages", page_map.size() - free_logical.size()},
+        {"cache", {
+            {"frames", frames.size()},
+            {"resident", resident},
+            {"dirty", dirty},
+            {"hits", hits},
+            {"misses", misses},
+            {"hit_ratio", lookups ? (double)hits / lookups : 0.0},
+            {"evictions", evictions},
+            {"writebacks", writebacks}
+        }}
+    };
+}
+
+// ---- snapshot ----
+
+size_t PagedStore::Snapshot::size() const { return count; }
+
+std::string PagedStore::Snapshot::read_overflow(uint32_t first, uint32_t total) const {
+    uint8_t buf[PAGE_SIZE];
+    std::string out;
+    out.reserve(total);
+    for (uint32_t page = first; page != NO_PAGE && out.size() < total; page = header_of(buf)->next) {
+        read_physical(file->fd, map[page], buf);
+        out.append(reinterpret_cast<const char*>(buf + sizeof(PageHeader)), header_of(buf)->used);
+    }
+    if (out.size() != total) throw std::runtime_error("Truncated overflow chain");
+    return out;
+}
+
+// Reads the snapshot's own physical pages, which are not reused before the
+// next checkpoint map is durable, so no store lock is needed.
+void PagedStore::Snapshot::for_each(const Visitor &fn) const {
+    uint8_t buf[PAGE_SIZE];
+    for (size_t page = 0; page < map.size(); ++page) {
+        if (kinds[page] != PAGE_DATA || map[page] == NO_PAGE) continue;
+        read_physical(file->fd, map[page], buf);
+        const PageSlot *slots = slots_of(buf);
+        for (uint16_t i = 0; i < header_of(buf)->slot_count; ++i) {
+            if (slots[i].offset == 0) continue;
+            const uint8_t *rec = buf + slots[i].offset;
+            const uint8_t *body;
+            size_t body_len;
+            std::string id = record_id(rec, body, body_len, slots[i].length);
+            if (rec[0] & RECORD_OVERFLOW) {
+                uint32_t first, total;
+                memcpy(&first, body, sizeof(first));
+                memcpy(&total, body + sizeof(first), sizeof(total));
+                std::string bytes = read_overflow(first, total);
+                fn(id, json::from_msgpack(bytes));
+            } else {
+                fn(id, json::from_msgpack(body, body + body_len));
+            }
+        }
+    }
+}
+
+void PagedStore::Snapshot::write(const std::string &path, uint64_t lsn) const {
+    if (::fdatasync(file->fd) != 0) throw std::runtime_error("Cannot sync data file for " + path);
+
+    uint32_t version = MAP_VERSION, page_size = PAGE_SIZE, pages = (uint32_t)map.size();
+    uint64_t n = count;
+    std::string data(MAP_MAGIC, sizeof(MAP_MAGIC));
+    data.append(reinterpret_cast<const char*>(&version), 4);
+    data.append(reinterpret_cast<const char*>(&page_size), 4);
+    data.append(reinterpret_cast<const char*>(&lsn), 8);
+    data.append(reinterpret_cast<const char*>(&n), 8);
+    data.append(reinterpret_cast<const char*>(&pages), 4);
+    for (size_t i = 0; i < map.size(); ++i) data.append(reinterpret_cast<const char*>(&map[i]), 4);
+    for (size_t i = 0; i < kinds.size(); ++i) data.push_back((char)kinds[i]);
+    uint32_t crc = crc32(data.data(), data.size());
+    data.append(reinterpret_cast<const char*>(&crc), 4);
+    write_file_atomic(path, data);
+
+    file->release_retired(release_upto);
+}
@@ -0,0 +1,359 @@
+#include "../include/partition_set.hpp"
+#include "../include/collection.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <stdexcept>
+
+PartitionSet::PartitionSet(const std::string &db_path, const std::string &name, const CollectionOptions &options)
+: dbpath(db_path), collname(name), field(options.partition_field),
+  granularity(options.partition_granularity), retention_days(options.retention_days),
+  checkpoint_wal_bytes(64 * 1024 * 1024) {
+    if (!valid_granularity(granularity)) {
+        throw std::runtime_error("Unknown partition granularity: " + granularity);
+    }
+    child_options = std::make_unique<CollectionOptions>(options);
+    child_options->partition_field.clear();
+    partsdir = dbpath + "/" + collname + ".parts";
+    indexfile = partsdir + "/indexes.json";
+    std::filesystem::create_directories(partsdir);
+
+    if (std::filesystem::exists(indexfile)) {
+        std::ifstream ifs(indexfile);
+        json fields; ifs >> fields;
+        for (const auto &f : fields) {
+            if (!f.is_object()) {
+                indexed_fields.push_back(f.get<std::string>());
+                continue;
+            }
+            indexed_fields.push_back(f.at("spec").get<std::string>());
+            index_filters.put(indexed_fields.back(), f.at("filter"));
+        }
+    }
+    for (auto &p : std::filesystem::directory_iterator(partsdir)) {
+        if (p.is_directory()) keys.push_back(p.path().filename().string());
+    }
+    std::sort(keys.begin(), keys.end());
+    last_retention = std::chrono::steady_clock::now();
+    drop_expired_locked();
+
+    std::cout << "Collection '" << collname << "' is partitioned by '" << field << "' (" << granularity
+              << "), " << keys.size() << " partitions" << std::endl;
+}
+
+PartitionSet::~PartitionSet() = default;
+
+const char *const PartitionSet::UNDATED = "undated";
+
+bool PartitionSet::valid_granularity(const std::string &g) {
+    return g == "hour" || g == "day" || g == "month";
+}
+
+size_t PartitionSet::key_length() const {
+    if (granularity == "hour") return 13;
+    if (granularity == "month") return 7;
+    return 10;
+}
+
+std::string PartitionSet::key_for_time(std::time_t t) const {
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H", &tm);
+    return std::string(buf).substr(0, key_length());
+}
+
+// The key is the value's "YYYY-MM-DDTHH" prefix cut to the granularity.
+// Documents without such a value go to the undated partition: filing them
+// under the current time would hide them from range queries.
+std::string PartitionSet::key_for(const json &doc) const {
+    size_t len = key_length();
+    if (doc.contains(field) && doc[field].is_string()) {
+        const std::string &value = doc[field].get_ref<const std::string&>();
+        bool valid = value.size() >= len;
+        for (size_t i = 0; valid && i < len; ++i) {
+            char c = value[i];
+            valid = i == 4 || i == 7 ? c == '-' : i == 10 ? c == 'T' : c >= '0' && c <= '9';
+        }
+        if (valid) return value.substr(0, len);
+    }
+    return UNDATED;
+}
+
+// Partitions that may hold matches for the query. Only conditions on the
+// partition field itself narrow the set; anything else scans all of them.
+Vector<std::string> PartitionSet::keys_for_query(const json &query) const {
+    bool has_low = false, has_high = false;
+    std::string low, high;
+    if (query.is_object() && query.contains(field)) {
+        const json &cond = query[field];
+        if (cond.is_string()) {
+            low = high = cond.get<std::string>();
+            has_low = has_high = true;
+        } else if (cond.is_object()) {
+            for (auto it = cond.begin(); it != cond.end(); ++it) {
+                if (!it.value().is_string()) continue;
+                const std::string &op = it.key();
+                if (op == "$eq" || op == "$gt" || op == "$gte") {
+                    low = it.value().get<std::string>();
+                    has_low = true;
+                }
+                if (op == "$eq" || op == "$lt" || op == "$lte") {
+                    high = it.value().get<std::string>();
+                    has_high = true;
+                }
+            }
+        }
+    }
+
+    size_t len = key_length();
+    Vector<std::string> result;
+    for (const auto &k : keys) {
+        if (k == UNDATED) {
+            result.push_back(k);
+            continue;
+        }
+        if (has_low && k < low.substr(0, len)) continue;
+        if (has_high && k > high.substr(0, len)) continue;
+        result.push_back(k);
+    }
+    return result;
+}
+
+std::shared_ptr<Collection> PartitionSet::partition(const std::string &key, bool create) {
+    std::shared_ptr<Collection> coll;
+    if (open_partitions.get(key, coll)) return coll;
+
+    std::string dir = partsdir + "/" + key;
+    bool exists = std::filesystem::exists(dir);
+    if (!exists && !create) return nullptr;
+
+    if (!exists) drop_expired_locked();
+    coll = std::make_shared<Collection>(dir, collname, *child_options);
+    coll->set_commit_delay(commit_delay);
+    coll->set_checkpoint_wal_bytes(checkpoint_wal_bytes);
+    open_partitions.put(key, coll);
+    if (!exists) {
+        for (const auto &f : indexed_fields) {
+            json filter;
+            index_filters.get(f, filter);
+            coll->create_index(f, filter);
+        }
+        keys.push_back(key);
+        std::sort(keys.begin(), keys.end());
+    }
+    return coll;
+}
+
+Vector<std::shared_ptr<Collection>> PartitionSet::opened() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    Vector<std::shared_ptr<Collection>> result;
+    for (const auto &item : open_partitions.items()) result.push_back(item.second);
+    return result;
+}
+
+std::string PartitionSet::insert(json doc) {
+    if (!doc.is_object()) throw std::runtime_error("Document must be an object");
+    std::shared_ptr<Collection> coll;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        coll = partition(key_for(doc), true);
+    }
+    return coll->insert(doc);
+}
+
+void PartitionSet::restore(const json &doc) {
+    if (!doc.is_object()) throw std::runtime_error("Document must be an object");
+    std::shared_ptr<Collection> coll;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        coll = partition(key_for(doc), true);
+    }
+    coll->restore(doc);
+}
+
+Vector<json> PartitionSet::find(const json &query) {
+    Vector<std::shared_ptr<Collection>> targets;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto &k : keys_for_query(query)) {
+            auto coll = partition(k, false);
+            if (coll) targets.push_back(coll);
+        }
+    }
+    Vector<json> res;
+    for (auto &coll : targets) {
+        for (auto &doc : coll->find(query)) res.push_back(doc);
+    }
+    return res;
+}
+
+json PartitionSet::count(const json &query, const std::string &group_by, const std::string &bucket) {
+    Vector<std::shared_ptr<Collection>> targets;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto &k : keys_for_query(query)) {
+            auto coll = partition(k, false);
+            if (coll) targets.push_back(coll);
+        }
+    }
+    json res = json::object();
+    for (auto &coll : targets) {
+        json part = coll->count(query, group_by, bucket);
+        for (auto it = part.begin(); it != part.end(); ++it) {
+            res[it.key()] = res.value(it.key(), (uint64_t)0) + it.value().get<uint64_t>();
+        }
+    }
+    return res;
+}
+
+int PartitionSet::remove(const json &query) {
+    Vector<std::shared_ptr<Collection>> targets;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto &k : keys_for_query(query)) {
+            auto coll = partition(k, false);
+            if (coll) targets.push_back(coll);
+        }
+    }
+    int cnt = 0;
+    for (auto &coll : targets) cnt += coll->remove(query);
+    return cnt;
+}
+
+// Partitions created after this get the index on creation; the existing
+// ones are returned for the caller to build it in.
+Vector<std::shared_ptr<Collection>> PartitionSet::add_index(const std::string &f, const json &filter) {
+    std::lock_guard<std::mutex> lock(mtx);
+    bool known = false;
+    for (const auto &existing : indexed_fields) {
+        if (existing == f) known = true;
+    }
+    json previous;
+    index_filters.get(f, previous);
+    if (!known || previous != filter) {
+        if (!known) indexed_fields.push_back(f);
+        if (filter.is_null()) index_filters.remove(f);
+        else index_filters.put(f, filter);
+        save_index_fields();
+    }
+    Vector<std::shared_ptr<Collection>> existing;
+    for (const auto &k : keys) {
+        auto coll = partition(k, false);
+        if (coll) existing.push_back(coll);
+    }
+    return existing;
+}
+
+Vector<std::string> PartitionSet::index_fields() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return indexed_fields;
+}
+
+json PartitionSet::index_filter(const std::string &f) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    json filter;
+    index_filters.get(f, filter);
+    return filter;
+}
+
+void PartitionSet::save_index_fields() const {
+    json fields = json::array();
+    for (const auto &f : indexed_fields) {
+        const json *filter = index_filters.find(f);
+        if (filter) fields.push_back({{"spec", f}, {"filter", *filter}});
+        else fields.push_back(f);
+    }
+    write_file_atomic(indexfile, fields.dump() + "\n");
+}
+
+void PartitionSet::commit() {
+    for (auto &coll : opened()) coll->commit();
+}
+
+void PartitionSet::wait_durable() {
+    for (auto &coll : opened()) coll->wait_durable(coll->last_lsn());
+}
+
+// Also applies retention, at most once a minute, so that a long-running
+// server drops expired partitions without waiting for a new one.
+void PartitionSet::checkpoint_if_needed() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = std::chrono::steady_clock::now();
+        if (retention_days > 0 && now - last_retention >= std::chrono::minutes(1)) {
+            last_retention = now;
+            drop_expired_locked();
+        }
+    }
+    for (auto &coll : opened()) coll->checkpoint_if_needed();
+}
+
+void PartitionSet::set_commit_delay(std::chrono::microseconds delay) {
+    std::lock_guard<std::mutex> lock(mtx);
+    commit_delay = delay;
+    for (const auto &item : open_partitions.items()) item.second->set_commit_delay(delay);
+}
+
+void PartitionSet::set_checkpoint_wal_bytes(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    checkpoint_wal_bytes = bytes;
+    for (const auto &item : open_partitions.items()) item.second->set_checkpoint_wal_bytes(bytes);
+}
+
+void PartitionSet::save() {
+    for (auto &coll : opened()) coll->save();
+}
+
+json PartitionSet::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    json parts = json::array();
+    size_t open_count = 0;
+    for (const auto &k : keys) {
+        json entry = {{"key", k}, {"open", false}};
+        std::shared_ptr<Collection> coll;
+        if (open_partitions.get(k, coll)) {
+            entry["open"] = true;
+            entry["documents"] = coll->stats()["documents"];
+            ++open_count;
+        }
+        parts.push_back(entry);
+    }
+    return {
+        {"partition", {
+            {"field", field},
+            {"granularity", granularity},
+            {"retention_days", retention_days}
+        }},
+        {"open_partitions", open_count},
+        {"partitions", parts}
+    };
+}
+
+// Retention works on whole partitions: a partition is deleted once every
+// timestamp it can hold is older than the retention window.
+size_t PartitionSet::drop_expired_locked() {
+    if (retention_days <= 0) return 0;
+    std::string cutoff = key_for_time(std::time(nullptr) - (std::time_t)retention_days * 24 * 3600);
+
+    Vector<std::string> kept;
+    size_t dropped = 0;
+    for (const auto &k : keys) {
+        if (k >= cutoff || k == UNDATED) {
+            kept.push_back(k);
+            continue;
+        }
+        std::shared_ptr<Collection> coll;
+        if (open_partitions.get(k, coll)) {
+            coll->discard();
+            open_partitions.remove(k);
+        }
+        std::filesystem::remove_all(partsdir + "/" + k);
+        std::cout << "Dropped expired partition " << collname << "/" << k << std::endl;
+        ++dropped;
+    }
+    keys = kept;
+    return dropped;
+}
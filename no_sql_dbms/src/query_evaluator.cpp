@@ -1,22 +1,95 @@
 #include "../include/query_evaluator.hpp"
-#include <regex>
-#include <cstring>
 
+static char fold_case(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Matches value[v, v_end) against pattern[p, p_end), neither of which
+// holds a line break. On a mismatch the last '%' absorbs one more character.
+static bool match_like_line(const std::string &value, size_t v, size_t v_end,
+                            const std::string &pattern, size_t p, size_t p_end) {
+    size_t star = std::string::npos, resume = 0;
+    while (v < v_end) {
+        if (p < p_end && pattern[p] == '%') {
+            star = p++;
+            resume = v;
+        } else if (p < p_end && (pattern[p] == '_' || fold_case(pattern[p]) == fold_case(value[v]))) {
+            ++p;
+            ++v;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            v = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < p_end && pattern[p] == '%') ++p;
+    return p == p_end;
+}
+
+// SQL LIKE, ignoring ASCII case: '%' matches any run of characters and '_'
+// exactly one, but, as with the regex '.' this replaced, neither matches
+// '\n' or '\r'. Each line break in the value must therefore meet the same
+// one in the pattern, and the lines between them are matched on their own.
 bool match_like(const std::string &value, const std::string &pattern) {
-    std::string re = "^";
-    for (size_t i=0;i<pattern.size();++i) {
-        char c = pattern[i];
-        if (c == '%') re += ".*";
-        else if (c == '_') re += ".";
-        else if (strchr("^.[]{}()\\+*?|$", c)) {
-            re += '\\'; re += c;
-        } else re += c;
-    }
-    re += "$";
-    try {
-        std::regex r(re, std::regex::ECMAScript | std::regex::icase);
-        return std::regex_match(value, r);
-    } catch(...) { return false; }
+    size_t v = 0, p = 0;
+    while (true) {
+        size_t v_end = value.find_first_of("\r\n", v), p_end = pattern.find_first_of("\r\n", p);
+        if (v_end == std::string::npos) v_end = value.size();
+        if (p_end == std::string::npos) p_end = pattern.size();
+        if (!match_like_line(value, v, v_end, pattern, p, p_end)) return false;
+        if (v_end == value.size() || p_end == pattern.size()) return v_end == value.size() && p_end == pattern.size();
+        if (value[v_end] != pattern[p_end]) return false;
+        v = v_end + 1;
+        p = p_end + 1;
+    }
+}
+
+static bool is_token_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '.' || c == '_' || c == '-' || c == '@' || (unsigned char)c >= 0x80;
+}
+
+// Splits text into lower-cased tokens. Dots, dashes, underscores and '@'
+// stay inside a token so that IPs, hostnames and user names are one term;
+// a trailing dot ends a sentence and is dropped.
+void text_tokens(const std::string &text, Vector<std::string> &tokens) {
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!is_token_char(text[i])) { ++i; continue; }
+        size_t start = i;
+        while (i < text.size() && is_token_char(text[i])) ++i;
+        size_t end = i;
+        while (end > start && text[end - 1] == '.') --end;
+        if (end == start) continue;
+        std::string token;
+        for (size_t k = start; k < end; ++k) token.push_back(fold_case(text[k]));
+        tokens.push_back(token);
+    }
+}
+
+// $text takes a string whose terms must all occur, or an array of such
+// strings of which at least one must match.
+bool match_text(const std::string &value, const json &terms) {
+    if (terms.is_array()) {
+        for (const auto &alt : terms) {
+            if (alt.is_string() && match_text(value, alt)) return true;
+        }
+        return false;
+    }
+    if (!terms.is_string()) return false;
+    Vector<std::string> wanted, present;
+    text_tokens(terms.get_ref<const std::string&>(), wanted);
+    if (wanted.empty()) return false;
+    text_tokens(value, present);
+    for (const auto &w : wanted) {
+        bool found = false;
+        for (const auto &p : present) {
+            if (p == w) { found = true; break; }
+        }
+        if (!found) return false;
+    }
+    return true;
 }
 
 bool value_eq(const json &a, const json &b) {
@@ -24,6 +97,20 @@ bool value_eq(const json &a, const json &b) {
     return a == b;
 }
 
+// Orders two strings or two numbers; other pairs are not comparable.
+static bool compare_values(const json &a, const json &b, int &cmp) {
+    if (a.is_string() && b.is_string()) {
+        cmp = a.get_ref<const std::string&>().compare(b.get_ref<const std::string&>());
+        return true;
+    }
+    if (a.is_number() && b.is_number()) {
+        double x = a.get<double>(), y = b.get<double>();
+        cmp = x < y ? -1 : (x > y ? 1 : 0);
+        return true;
+    }
+    return false;
+}
+
 bool evaluate_condition_on_field(const json &doc, const std::string &field, const json &cond) {
     if (!doc.contains(field)) return false;
     const json &val = doc[field];
@@ -37,14 +124,25 @@ bool evaluate_condition_on_field(const json &doc, const std::string &field, cons
         const json &arg = it.value();
         if (op == "$eq") {
             if (!value_eq(val, arg)) return false;
-        } else if (op == "$gt") {
-            if (!(val.is_number() && arg.is_number() && val.get<double>() > arg.get<double>())) return false;
-        } else if (op == "$lt") {
-            if (!(val.is_number() && arg.is_number() && val.get<double>() < arg.get<double>())) return false;
+        } else if (op == "$ne") {
+            if (value_eq(val, arg)) return false;
+        } else if (op == "$gt" || op == "$gte" || op == "$lt" || op == "$lte") {
+            int cmp;
+            if (!compare_values(val, arg, cmp)) return false;
+            if (op == "$gt" && !(cmp > 0)) return false;
+            if (op == "$gte" && !(cmp >= 0)) return false;
+            if (op == "$lt" && !(cmp < 0)) return false;
+            if (op == "$lte" && !(cmp <= 0)) return false;
+        } else if (op == "$prefix") {
+            if (!val.is_string() || !arg.is_string()) return false;
+            const std::string &s = val.get_ref<const std::string&>(), &p = arg.get_ref<const std::string&>();
+            if (s.compare(0, p.size(), p) != 0) return false;
         } else if (op == "$like") {
             if (!val.is_string()) return false;
             if (!arg.is_string()) return false;
             if (!match_like(val.get<std::string>(), arg.get<std::string>())) return false;
+        } else if (op == "$text") {
+            if (!val.is_string() || !match_text(val.get_ref<const std::string&>(), arg)) return false;
         } else if (op == "$in") {
             if (!arg.is_array()) return false;
             bool any=false;
@@ -52,6 +150,11 @@ bool evaluate_condition_on_field(const json &doc, const std::string &field, cons
                 if (value_eq(val, x)) { any=true; break; }
             }
             if (!any) return false;
+        } else if (op == "$nin") {
+            if (!arg.is_array()) return false;
+            for (const auto &x : arg) {
+                if (value_eq(val, x)) return false;
+            }
         } else {
             return false;
         }
@@ -87,3 +190,135 @@ bool evaluate_query(const json &doc, const json &query) {
     }
     return true;
 }
+
+// Values a condition restricts the field to, when it is an equality or $in.
+static bool condition_values(const json &cond, Vector<const json*> &values) {
+    if (!cond.is_object()) {
+        values.push_back(&cond);
+        return true;
+    }
+    if (cond.size() != 1) return false;
+    if (cond.contains("$eq")) {
+        values.push_back(&cond["$eq"]);
+        return true;
+    }
+    if (cond.contains("$in") && cond["$in"].is_array()) {
+        for (const auto &v : cond["$in"]) values.push_back(&v);
+        return true;
+    }
+    return false;
+}
+
+// Whether one operator of a filter condition follows from the operators of
+// a query condition on the same field.
+static bool operator_implied(const json &query_cond, const std::string &op, const json &arg) {
+    for (auto it = query_cond.begin(); it != query_cond.end(); ++it) {
+        const std::string &qop = it.key();
+        const json &qarg = it.value();
+        if (qop == op && qarg == arg) return true;
+        int cmp;
+        bool lower = op == "$gt" || op == "$gte", upper = op == "$lt" || op == "$lte";
+        if (lower && (qop == "$gt" || qop == "$gte") && compare_values(qarg, arg, cmp)) {
+            if (cmp > 0 || (cmp == 0 && (op == "$gte" || qop == "$gt"))) return true;
+        }
+        if (upper && (qop == "$lt" || qop == "$lte") && compare_values(qarg, arg, cmp)) {
+            if (cmp < 0 || (cmp == 0 && (op == "$lte" || qop == "$lt"))) return true;
+        }
+        if (op == "$prefix" && qop == "$prefix" && arg.is_string() && qarg.is_string()
+            && qarg.get_ref<const std::string&>().rfind(arg.get_ref<const std::string&>(), 0) == 0) {
+            return true;
+        }
+    }
+    if (op == "$ne" || op == "$nin") {
+        // Every excluded value must be excluded by the query as well.
+        Vector<const json*> excluded;
+        if (op == "$ne") excluded.push_back(&arg);
+        else if (arg.is_array()) for (const auto &v : arg) excluded.push_back(&v);
+        else return false;
+        for (const json *x : excluded) {
+            bool found = false;
+            for (auto it = query_cond.begin(); it != query_cond.end() && !found; ++it) {
+                if (it.key() == "$ne") found = value_eq(it.value(), *x);
+                else if (it.key() == "$nin" && it.value().is_array()) {
+                    for (const auto &v : it.value()) found = found || value_eq(v, *x);
+                }
+            }
+            if (!found) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool condition_implies(const std::string &field, const json &query_cond, const json &filter_cond) {
+    if (query_cond == filter_cond) return true;
+    Vector<const json*> values;
+    if (condition_values(query_cond, values)) {
+        for (const json *v : values) {
+            if (!evaluate_condition_on_field(json{{field, *v}}, field, filter_cond)) return false;
+        }
+        return true;
+    }
+    if (!query_cond.is_object() || !filter_cond.is_object()) return false;
+    for (auto it = filter_cond.begin(); it != filter_cond.end(); ++it) {
+        if (!operator_implied(query_cond, it.key(), it.value())) return false;
+    }
+    return true;
+}
+
+static bool field_implied(const json &query, const std::string &field, const json &filter_cond) {
+    if (query.contains("$or")) {
+        const json &branches = query["$or"];
+        if (!branches.is_array()) return false;
+        for (const auto &branch : branches) {
+            if (!branch.is_object() || !field_implied(branch, field, filter_cond)) return false;
+        }
+        return true;
+    }
+    if (query.contains("$and")) {
+        const json &parts = query["$and"];
+        if (!parts.is_array()) return false;
+        for (const auto &part : parts) {
+            if (part.is_object() && field_implied(part, field, filter_cond)) return true;
+        }
+        return false;
+    }
+    auto it = query.find(field);
+    return it != query.end() && condition_implies(field, *it, filter_cond);
+}
+
+bool query_implies(const json &query, const json &filter) {
+    if (!query.is_object() || !filter.is_object()) return false;
+    if (filter.contains("$or")) {
+        const json &branches = filter["$or"];
+        if (!branches.is_array()) return false;
+        for (const auto &branch : branches) {
+            if (query_implies(query, branch)) return true;
+        }
+        return false;
+    }
+    if (filter.contains("$and")) {
+        const json &parts = filter["$and"];
+        if (!parts.is_array()) return false;
+        for (const auto &part : parts) {
+            if (!query_implies(query, part)) return false;
+        }
+        return true;
+    }
+    for (auto it = filter.begin(); it != filter.end(); ++it) {
+        if (!field_implied(query, it.key(), it.value())) return false;
+    }
+    return true;
+}
+
+// Key used by grouped counts: strings as-is, other values as JSON text.
+// "hour", "day" and "month" truncate ISO-8601 timestamps.
+std::string group_key(const json &value, const std::string &bucket) {
+    std::string key = value.is_string() ? value.get<std::string>() : value.dump();
+    size_t len = 0;
+    if (bucket == "hour") len = 13;
+    else if (bucket == "day") len = 10;
+    else if (bucket == "month") len = 7;
+    if (len > 0 && key.size() > len) key.resize(len);
+    return key;
+}
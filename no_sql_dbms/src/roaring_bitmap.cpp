@@ -0,0 +1,309 @@
+#include "../include/roaring_bitmap.hpp"
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t ARRAY_MAX = 4096;
+static const size_t BITSET_WORDS = 1024;
+
+size_t RoaringBitmap::find_container(uint16_t key) const {
+    size_t lo = 0, hi = containers.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (containers[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void RoaringBitmap::to_bitset(Container &c) {
+    c.bits = Vector<uint64_t>(BITSET_WORDS, 0);
+    for (uint16_t low : c.array) c.bits[low >> 6] |= 1ULL << (low & 63);
+    c.array = Vector<uint16_t>();
+}
+
+// Turns a bitset that has become sparse back into an array.
+void RoaringBitmap::normalize(Container &c) {
+    if (c.bits.empty() || c.card > ARRAY_MAX) return;
+    Vector<uint16_t> array;
+    array.reserve(c.card);
+    for (size_t w = 0; w < BITSET_WORDS; ++w) {
+        uint64_t word = c.bits[w];
+        while (word) {
+            array.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+    c.array = std::move(array);
+    c.bits = Vector<uint64_t>();
+}
+
+bool RoaringBitmap::test(const Container &c, uint16_t low) {
+    if (!c.bits.empty()) return (c.bits[low >> 6] >> (low & 63)) & 1;
+    size_t lo = 0, hi = c.array.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (c.array[mid] < low) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < c.array.size() && c.array[lo] == low;
+}
+
+void RoaringBitmap::add(uint32_t row) {
+    uint16_t key = row >> 16, low = row & 0xffff;
+    size_t i = find_container(key);
+    if (i == containers.size() || containers[i].key != key) {
+        Container c;
+        c.key = key;
+        containers.insert(i, c);
+    }
+    Container &c = containers[i];
+    if (!c.bits.empty()) {
+        uint64_t &word = c.bits[low >> 6];
+        uint64_t bit = 1ULL << (low & 63);
+        if (!(word & bit)) {
+            word |= bit;
+            ++c.card;
+        }
+        return;
+    }
+    size_t lo = 0, hi = c.array.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (c.array[mid] < low) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < c.array.size() && c.array[lo] == low) return;
+    if (lo == c.array.size()) c.array.push_back(low);
+    else c.array.insert(lo, low);
+    if (++c.card > ARRAY_MAX) to_bitset(c);
+}
+
+void RoaringBitmap::remove(uint32_t row) {
+    uint16_t key = row >> 16, low = row & 0xffff;
+    size_t i = find_container(key);
+    if (i == containers.size() || containers[i].key != key) return;
+    Container &c = containers[i];
+    if (!test(c, low)) return;
+    if (!c.bits.empty()) {
+        c.bits[low >> 6] &= ~(1ULL << (low & 63));
+        --c.card;
+        normalize(c);
+    } else {
+        for (size_t k = 0; k < c.array.size(); ++k) {
+            if (c.array[k] == low) {
+                c.array.erase(k);
+                break;
+            }
+        }
+        --c.card;
+    }
+    if (c.card == 0) containers.erase(i);
+}
+
+bool RoaringBitmap::contains(uint32_t row) const {
+    size_t i = find_container(row >> 16);
+    return i < containers.size() && containers[i].key == (row >> 16) && test(containers[i], row & 0xffff);
+}
+
+bool RoaringBitmap::empty() const { return containers.empty(); }
+
+uint64_t RoaringBitmap::cardinality() const {
+    uint64_t total = 0;
+    for (const auto &c : containers) total += c.card;
+    return total;
+}
+
+uint32_t RoaringBitmap::and_count(const Container &a, const Container &b) {
+    uint32_t count = 0;
+    if (!a.bits.empty() && !b.bits.empty()) {
+        for (size_t w = 0; w < BITSET_WORDS; ++w) count += __builtin_popcountll(a.bits[w] & b.bits[w]);
+    } else if (a.bits.empty() && b.bits.empty()) {
+        size_t i = 0, j = 0;
+        while (i < a.array.size() && j < b.array.size()) {
+            if (a.array[i] < b.array[j]) ++i;
+            else if (b.array[j] < a.array[i]) ++j;
+            else { ++count; ++i; ++j; }
+        }
+    } else {
+        const Container &array = a.bits.empty() ? a : b;
+        const Container &bitset = a.bits.empty() ? b : a;
+        for (uint16_t low : array.array) count += test(bitset, low);
+    }
+    return count;
+}
+
+RoaringBitmap::Container RoaringBitmap::and_of(const Container &a, const Container &b) {
+    Container r;
+    r.key = a.key;
+    if (!a.bits.empty() && !b.bits.empty()) {
+        r.bits = Vector<uint64_t>(BITSET_WORDS, 0);
+        for (size_t w = 0; w < BITSET_WORDS; ++w) {
+            r.bits[w] = a.bits[w] & b.bits[w];
+            r.card += __builtin_popcountll(r.bits[w]);
+        }
+        normalize(r);
+    } else if (a.bits.empty() && b.bits.empty()) {
+        size_t i = 0, j = 0;
+        while (i < a.array.size() && j < b.array.size()) {
+            if (a.array[i] < b.array[j]) ++i;
+            else if (b.array[j] < a.array[i]) ++j;
+            else { r.array.push_back(a.array[i]); ++i; ++j; }
+        }
+        r.card = r.array.size();
+    } else {
+        const Container &array = a.bits.empty() ? a : b;
+        const Container &bitset = a.bits.empty() ? b : a;
+        for (uint16_t low : array.array) {
+            if (test(bitset, low)) r.array.push_back(low);
+        }
+        r.card = r.array.size();
+    }
+    return r;
+}
+
+RoaringBitmap::Container RoaringBitmap::or_of(const Container &a, const Container &b) {
+    Container r;
+    r.key = a.key;
+    if (a.bits.empty() && b.bits.empty()) {
+        size_t i = 0, j = 0;
+        while (i < a.array.size() || j < b.array.size()) {
+            if (j == b.array.size() || (i < a.array.size() && a.array[i] < b.array[j])) r.array.push_back(a.array[i++]);
+            else if (i == a.array.size() || b.array[j] < a.array[i]) r.array.push_back(b.array[j++]);
+            else { r.array.push_back(a.array[i]); ++i; ++j; }
+        }
+        r.card = r.array.size();
+        if (r.card > ARRAY_MAX) to_bitset(r);
+        return r;
+    }
+    r.bits = Vector<uint64_t>(BITSET_WORDS, 0);
+    for (const Container *c : {&a, &b}) {
+        if (c->bits.empty()) {
+            for (uint16_t low : c->array) r.bits[low >> 6] |= 1ULL << (low & 63);
+        } else {
+            for (size_t w = 0; w < BITSET_WORDS; ++w) r.bits[w] |= c->bits[w];
+        }
+    }
+    for (size_t w = 0; w < BITSET_WORDS; ++w) r.card += __builtin_popcountll(r.bits[w]);
+    return r;
+}
+
+RoaringBitmap::Container RoaringBitmap::andnot_of(const Container &a, const Container &b) {
+    Container r;
+    r.key = a.key;
+    if (a.bits.empty()) {
+        for (uint16_t low : a.array) {
+            if (!test(b, low)) r.array.push_back(low);
+        }
+        r.card = r.array.size();
+        return r;
+    }
+    r.bits = a.bits;
+    if (b.bits.empty()) {
+        for (uint16_t low : b.array) r.bits[low >> 6] &= ~(1ULL << (low & 63));
+    } else {
+        for (size_t w = 0; w < BITSET_WORDS; ++w) r.bits[w] &= ~b.bits[w];
+    }
+    for (size_t w = 0; w < BITSET_WORDS; ++w) r.card += __builtin_popcountll(r.bits[w]);
+    normalize(r);
+    return r;
+}
+
+uint64_t RoaringBitmap::and_cardinality(const RoaringBitmap &other) const {
+    uint64_t total = 0;
+    size_t i = 0, j = 0;
+    while (i < containers.size() && j < other.containers.size()) {
+        if (containers[i].key < other.containers[j].key) ++i;
+        else if (other.containers[j].key < containers[i].key) ++j;
+        else total += and_count(containers[i++], other.containers[j++]);
+    }
+    return total;
+}
+
+RoaringBitmap& RoaringBitmap::operator&=(const RoaringBitmap &other) {
+    Vector<Container> result;
+    size_t i = 0, j = 0;
+    while (i < containers.size() && j < other.containers.size()) {
+        if (containers[i].key < other.containers[j].key) ++i;
+        else if (other.containers[j].key < containers[i].key) ++j;
+        else {
+            Container c = and_of(containers[i++], other.containers[j++]);
+            if (c.card > 0) result.push_back(std::move(c));
+        }
+    }
+    containers = std::move(result);
+    return *this;
+}
+
+RoaringBitmap& RoaringBitmap::operator|=(const RoaringBitmap &other) {
+    Vector<Container> result;
+    size_t i = 0, j = 0;
+    while (i < containers.size() || j < other.containers.size()) {
+        if (j == other.containers.size() || (i < containers.size() && containers[i].key < other.containers[j].key)) {
+            result.push_back(std::move(containers[i++]));
+        } else if (i == containers.size() || other.containers[j].key < containers[i].key) {
+            result.push_back(other.containers[j++]);
+        } else {
+            result.push_back(or_of(containers[i++], other.containers[j++]));
+        }
+    }
+    containers = std::move(result);
+    return *this;
+}
+
+RoaringBitmap& RoaringBitmap::operator-=(const RoaringBitmap &other) {
+    Vector<Container> result;
+    size_t j = 0;
+    for (size_t i = 0; i < containers.size(); ++i) {
+        while (j < other.containers.size() && other.containers[j].key < containers[i].key) ++j;
+        if (j < other.containers.size() && other.containers[j].key == containers[i].key) {
+            Container c = andnot_of(containers[i], other.containers[j]);
+            if (c.card > 0) result.push_back(std::move(c));
+        } else {
+            result.push_back(std::move(containers[i]));
+        }
+    }
+    containers = std::move(result);
+    return *this;
+}
+
+// Per container: key (2 bytes), kind (1), cardinality (4), then the array
+// or the 1024 words of the bitset, all little-endian.
+void RoaringBitmap::serialize(std::string &out) const {
+    uint32_t count = containers.size();
+    out.append((const char*)&count, 4);
+    for (const auto &c : containers) {
+        out.append((const char*)&c.key, 2);
+        out.push_back(c.bits.empty() ? 0 : 1);
+        out.append((const char*)&c.card, 4);
+        if (c.bits.empty()) out.append((const char*)c.array.data(), c.array.size() * 2);
+        else out.append((const char*)c.bits.data(), BITSET_WORDS * 8);
+    }
+}
+
+void RoaringBitmap::deserialize(const std::string &in) {
+    containers = Vector<Container>();
+    size_t pos = 0;
+    auto take = [&](void *dst, size_t n) {
+        if (pos + n > in.size()) throw std::runtime_error("Truncated bitmap");
+        memcpy(dst, in.data() + pos, n);
+        pos += n;
+    };
+    uint32_t count;
+    take(&count, 4);
+    for (uint32_t k = 0; k < count; ++k) {
+        Container c;
+        char kind;
+        take(&c.key, 2);
+        take(&kind, 1);
+        take(&c.card, 4);
+        if (kind == 0) {
+            if (c.card > ARRAY_MAX) throw std::runtime_error("Corrupt bitmap container");
+            c.array.resize(c.card);
+            take(c.array.data(), c.card * 2);
+        } else {
+            c.bits.resize(BITSET_WORDS);
+            take(c.bits.data(), BITSET_WORDS * 8);
+        }
+        containers.push_back(std::move(c));
+    }
+}
@@ -0,0 +1,167 @@
+#include "../include/segment.hpp"
+#include "../include/utils.hpp"
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SEGMENT_MAGIC[8] = {'N', 'S', 'Q', 'L', 'S', 'E', 'G', '1'};
+static const uint32_t SEGMENT_VERSION = 1;
+static const size_t SEGMENT_WRITE_CHUNK = 1 << 20;
+
+Segment::Segment(const std::string &path)
+: path(path), base(nullptr), length(0), header(nullptr), table(nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open segment " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat segment " + path);
+    }
+    length = (size_t)st.st_size;
+    if (length < sizeof(SegmentHeader) + sizeof(uint32_t)) {
+        ::close(fd);
+        throw std::runtime_error("Segment too small: " + path);
+    }
+
+    void *m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) throw std::runtime_error("Cannot mmap segment " + path);
+    base = static_cast<const uint8_t*>(m);
+    header = reinterpret_cast<const SegmentHeader*>(base);
+
+    if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Invalid segment header: " + path);
+    }
+    if (header->version != SEGMENT_VERSION) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Unsupported segment version in " + path);
+    }
+
+    size_t table_bytes = header->count * sizeof(uint64_t);
+    if (header->table_offset + table_bytes + sizeof(uint32_t) > length) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Truncated segment: " + path);
+    }
+    table = reinterpret_cast<const uint64_t*>(base + header->table_offset);
+    uint32_t stored_crc;
+    memcpy(&stored_crc, base + header->table_offset + table_bytes, sizeof(stored_crc));
+    if (crc32(table, table_bytes) != stored_crc) {
+        munmap((void*)base, length);
+        throw std::runtime_error("Segment offset table checksum mismatch: " + path);
+    }
+    madvise((void*)base, length, MADV_RANDOM);
+}
+
+Segment::~Segment() {
+    if (base) munmap((void*)base, length);
+}
+
+size_t Segment::count() const { return (size_t)header->count; }
+
+uint64_t Segment::lsn() const { return header->lsn; }
+
+const uint8_t* Segment::record(size_t slot) const {
+    if (slot >= header->count) throw std::out_of_range("Segment slot out of range");
+    return base + table[slot];
+}
+
+std::string Segment::id(size_t slot) const {
+    const uint8_t *p = record(slot);
+    uint32_t id_len;
+    memcpy(&id_len, p, sizeof(id_len));
+    return std::string(reinterpret_cast<const char*>(p + sizeof(id_len)), id_len);
+}
+
+const uint8_t* Segment::raw_document(size_t slot, size_t &len) const {
+    const uint8_t *p = record(slot);
+    uint32_t id_len, body_len;
+    memcpy(&id_len, p, sizeof(id_len));
+    p += sizeof(id_len) + id_len;
+    memcpy(&body_len, p, sizeof(body_len));
+    len = body_len;
+    return p + sizeof(body_len);
+}
+
+json Segment::document(size_t slot) const {
+    size_t len;
+    const uint8_t *body = raw_document(slot, len);
+    return json::from_msgpack(body, body + len);
+}
+
+SegmentWriter::SegmentWriter(const std::string &path, uint64_t lsn)
+: path(path), tmp_path(path + ".tmp"), fd(-1), lsn(lsn), offset(sizeof(SegmentHeader)), count(0) {
+    fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot create segment " + tmp_path);
+    buffer.assign(sizeof(SegmentHeader), '\0');
+}
+
+SegmentWriter::~SegmentWriter() {
+    if (fd >= 0) {
+        ::close(fd);
+        std::remove(tmp_path.c_str());
+    }
+}
+
+void SegmentWriter::add(const std::string &id, const json &doc) {
+    auto body = json::to_msgpack(doc);
+    add_raw(id, body.data(), body.size());
+}
+
+void SegmentWriter::add_raw(const std::string &id, const uint8_t *body, size_t len) {
+    uint64_t record_offset = offset;
+    table.append(reinterpret_cast<const char*>(&record_offset), sizeof(record_offset));
+
+    uint32_t id_len = (uint32_t)id.size();
+    uint32_t body_len = (uint32_t)len;
+    buffer.append(reinterpret_cast<const char*>(&id_len), sizeof(id_len));
+    buffer.append(id);
+    buffer.append(reinterpret_cast<const char*>(&body_len), sizeof(body_len));
+    buffer.append(reinterpret_cast<const char*>(body), len);
+    offset += sizeof(id_len) + id_len + sizeof(body_len) + len;
+    ++count;
+
+    if (buffer.size() >= SEGMENT_WRITE_CHUNK) flush_buffer();
+}
+
+void SegmentWriter::flush_buffer() {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n <= 0) throw std::runtime_error("Segment write failed: " + tmp_path);
+        written += (size_t)n;
+    }
+    buffer.clear();
+}
+
+void SegmentWriter::finish() {
+    uint64_t table_offset = offset;
+    uint32_t crc = crc32(table.data(), table.size());
+    buffer.append(table);
+    buffer.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    flush_buffer();
+
+    SegmentHeader h;
+    memcpy(h.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    h.version = SEGMENT_VERSION;
+    h.reserved = 0;
+    h.count = count;
+    h.lsn = lsn;
+    h.table_offset = table_offset;
+    if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        throw std::runtime_error("Segment header write failed: " + tmp_path);
+    }
+
+    ::fsync(fd);
+    ::close(fd);
+    fd = -1;
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename " + tmp_path + " to " + path);
+    }
+    fsync_directory(std::filesystem::path(path).parent_path().string());
+}
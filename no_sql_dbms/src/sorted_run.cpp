@@ -0,0 +1,244 @@
+#include "../include/sorted_run.hpp"
+#include "../include/bloom_filter.hpp"
+#include "../include/utils.hpp"
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char RUN_MAGIC[8] = {'N', 'S', 'Q', 'L', 'R', 'U', 'N', '1'};
+static const uint32_t RUN_VERSION = 1;
+static const size_t RUN_WRITE_CHUNK = 1 << 20;
+static const uint64_t RUN_INDEX_INTERVAL = 16;
+static const size_t RUN_BLOOM_BITS_PER_KEY = 10;
+static const uint8_t RUN_DELETED = 1;
+
+SortedRun::SortedRun(const std::string &path, uint64_t seq)
+: path(path), run_seq(seq), base(nullptr), length(0), header(nullptr), obsolete(false) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open run " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat run " + path);
+    }
+    length = (size_t)st.st_size;
+    if (length < sizeof(RunHeader) + sizeof(uint32_t)) {
+        ::close(fd);
+        throw std::runtime_error("Run too small: " + path);
+    }
+
+    void *m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) throw std::runtime_error("Cannot mmap run " + path);
+    base = static_cast<const uint8_t*>(m);
+    header = reinterpret_cast<const RunHeader*>(base);
+
+    auto fail = [&](const std::string &msg) {
+        munmap((void*)base, length);
+        base = nullptr;
+        throw std::runtime_error(msg + path);
+    };
+    if (memcmp(header->magic, RUN_MAGIC, sizeof(RUN_MAGIC)) != 0) fail("Invalid run header: ");
+    if (header->version != RUN_VERSION) fail("Unsupported run version in ");
+    if (header->index_offset < sizeof(RunHeader) || header->index_offset > header->bloom_offset
+        || header->bloom_offset + header->bloom_bits / 8 + sizeof(uint32_t) != length) {
+        fail("Truncated run: ");
+    }
+    uint32_t stored_crc;
+    memcpy(&stored_crc, base + length - sizeof(uint32_t), sizeof(stored_crc));
+    if (crc32(base + header->index_offset, length - sizeof(uint32_t) - header->index_offset) != stored_crc) {
+        fail("Run index checksum mismatch: ");
+    }
+
+    const uint8_t *p = base + header->index_offset;
+    const uint8_t *end = base + header->bloom_offset;
+    while (p < end) {
+        uint32_t id_len;
+        uint64_t offset;
+        memcpy(&id_len, p, sizeof(id_len));
+        p += sizeof(id_len);
+        std::string id(reinterpret_cast<const char*>(p), id_len);
+        p += id_len;
+        memcpy(&offset, p, sizeof(offset));
+        p += sizeof(offset);
+        index.push_back({id, offset});
+    }
+
+    if (header->count > 0) {
+        first = index[0].first;
+        // Only the records after the last index entry are read.
+        for (Cursor c(*this, index.back().second); c.valid(); c.next()) last = c.id();
+    }
+    madvise((void*)base, length, MADV_RANDOM);
+}
+
+SortedRun::~SortedRun() {
+    if (base) munmap((void*)base, length);
+    if (obsolete) std::remove(path.c_str());
+}
+
+SortedRun::Cursor::Cursor(const SortedRun &run, uint64_t start)
+: run(&run), offset(start ? start : sizeof(RunHeader)), cur_deleted(false), cur_body(nullptr), cur_len(0) {
+    read();
+}
+
+bool SortedRun::Cursor::valid() const { return offset < run->header->index_offset; }
+
+void SortedRun::Cursor::read() {
+    if (!valid()) return;
+    const uint8_t *p = run->base + offset;
+    uint32_t id_len, body_len;
+    memcpy(&id_len, p, sizeof(id_len));
+    p += sizeof(id_len);
+    cur_id.assign(reinterpret_cast<const char*>(p), id_len);
+    p += id_len;
+    cur_deleted = (*p & RUN_DELETED) != 0;
+    p += 1;
+    memcpy(&body_len, p, sizeof(body_len));
+    p += sizeof(body_len);
+    cur_body = p;
+    cur_len = body_len;
+}
+
+void SortedRun::Cursor::next() {
+    offset += sizeof(uint32_t) + cur_id.size() + 1 + sizeof(uint32_t) + cur_len;
+    read();
+}
+
+const std::string& SortedRun::Cursor::id() const { return cur_id; }
+
+bool SortedRun::Cursor::deleted() const { return cur_deleted; }
+
+const uint8_t* SortedRun::Cursor::body() const { return cur_body; }
+
+size_t SortedRun::Cursor::body_len() const { return cur_len; }
+
+bool SortedRun::get(const std::string &id, uint64_t hash, bool &deleted, std::string &body) const {
+    if (header->count == 0 || id < first || id > last) return false;
+    if (!BloomFilter::probe(base + header->bloom_offset, header->bloom_bits, header->bloom_hashes, hash)) return false;
+
+    size_t lo = 0, hi = index.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].first <= id) lo = mid;
+        else hi = mid;
+    }
+    uint64_t offset = index[lo].second;
+    uint64_t end = lo + 1 < index.size() ? index[lo + 1].second : header->index_offset;
+    while (offset < end) {
+        const uint8_t *p = base + offset;
+        uint32_t id_len, body_len;
+        memcpy(&id_len, p, sizeof(id_len));
+        int cmp = id.compare(0, std::string::npos, reinterpret_cast<const char*>(p + sizeof(id_len)), id_len);
+        const uint8_t *flags = p + sizeof(id_len) + id_len;
+        memcpy(&body_len, flags + 1, sizeof(body_len));
+        if (cmp == 0) {
+            deleted = (*flags & RUN_DELETED) != 0;
+            body.assign(reinterpret_cast<const char*>(flags + 1 + sizeof(body_len)), body_len);
+            return true;
+        }
+        if (cmp < 0) return false;
+        offset += sizeof(id_len) + id_len + 1 + sizeof(body_len) + body_len;
+    }
+    return false;
+}
+
+uint64_t SortedRun::seq() const { return run_seq; }
+
+uint64_t SortedRun::count() const { return header->count; }
+
+size_t SortedRun::bytes() const { return length; }
+
+const std::string& SortedRun::min_key() const { return first; }
+
+const std::string& SortedRun::max_key() const { return last; }
+
+void SortedRun::mark_obsolete() { obsolete = true; }
+
+SortedRunWriter::SortedRunWriter(const std::string &path)
+: path(path), tmp_path(path + ".tmp"), fd(-1), offset(sizeof(RunHeader)), records(0) {
+    fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot create run " + tmp_path);
+    buffer.assign(sizeof(RunHeader), '\0');
+}
+
+SortedRunWriter::~SortedRunWriter() {
+    if (fd >= 0) {
+        ::close(fd);
+        std::remove(tmp_path.c_str());
+    }
+}
+
+void SortedRunWriter::add(const std::string &id, bool deleted, const uint8_t *body, size_t len) {
+    if (records % RUN_INDEX_INTERVAL == 0) {
+        uint32_t id_len = (uint32_t)id.size();
+        index.append(reinterpret_cast<const char*>(&id_len), sizeof(id_len));
+        index.append(id);
+        index.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    }
+    hashes.push_back(BloomFilter::hash(id));
+
+    uint32_t id_len = (uint32_t)id.size();
+    uint32_t body_len = (uint32_t)len;
+    uint8_t flags = deleted ? RUN_DELETED : 0;
+    buffer.append(reinterpret_cast<const char*>(&id_len), sizeof(id_len));
+    buffer.append(id);
+    buffer.append(reinterpret_cast<const char*>(&flags), 1);
+    buffer.append(reinterpret_cast<const char*>(&body_len), sizeof(body_len));
+    if (len) buffer.append(reinterpret_cast<const char*>(body), len);
+    offset += sizeof(id_len) + id_len + 1 + sizeof(body_len) + len;
+    ++records;
+
+    if (buffer.size() >= RUN_WRITE_CHUNK) flush_buffer();
+}
+
+void SortedRunWriter::flush_buffer() {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n <= 0) throw std::runtime_error("Run write failed: " + tmp_path);
+        written += (size_t)n;
+    }
+    buffer.clear();
+}
+
+void SortedRunWriter::finish() {
+    BloomFilter bloom(hashes.size(), RUN_BLOOM_BITS_PER_KEY);
+    for (uint64_t h : hashes) bloom.add(h);
+
+    RunHeader h;
+    memcpy(h.magic, RUN_MAGIC, sizeof(RUN_MAGIC));
+    h.version = RUN_VERSION;
+    h.bloom_hashes = bloom.hash_count();
+    h.count = records;
+    h.index_offset = offset;
+    h.bloom_offset = offset + index.size();
+    h.bloom_bits = bloom.bit_count();
+
+    std::string tail = index + bloom.data();
+    uint32_t crc = crc32(tail.data(), tail.size());
+    buffer.append(tail);
+    buffer.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    offset += tail.size() + sizeof(crc);
+    flush_buffer();
+    if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        throw std::runtime_error("Run header write failed: " + tmp_path);
+    }
+
+    ::fsync(fd);
+    ::close(fd);
+    fd = -1;
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename " + tmp_path + " to " + path);
+    }
+    fsync_directory(std::filesystem::path(path).parent_path().string());
+}
+
+size_t SortedRunWriter::bytes() const { return (size_t)offset; }
+
+uint64_t SortedRunWriter::count() const { return records; }
@@ -0,0 +1,203 @@
+#include "../include/text_index.hpp"
+#include "../include/query_evaluator.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static void sort_unique(Vector<std::string> &v) {
+    std::sort(v.begin(), v.end());
+    v.resize(std::unique(v.begin(), v.end()) - v.begin());
+}
+
+TextIndex::TextIndex() {}
+
+TextIndex::TextIndex(const std::string &field) : field_name(field) {}
+
+const std::string& TextIndex::field() const { return field_name; }
+
+// Slots arrive in increasing order, so every entry is stored as its gap to
+// the previous one, seven bits per byte with the high bit marking that more
+// bytes follow.
+void TextIndex::append(Posting &posting, uint32_t slot) {
+    uint32_t gap = posting.count == 0 ? slot : slot - posting.last;
+    while (gap >= 0x80) {
+        posting.bytes.push_back((char)(gap | 0x80));
+        gap >>= 7;
+    }
+    posting.bytes.push_back((char)gap);
+    posting.last = slot;
+    ++posting.count;
+}
+
+void TextIndex::decode(const Posting &posting, Vector<uint32_t> &out) {
+    out.reserve(out.size() + posting.count);
+    uint32_t slot = 0, gap = 0;
+    int shift = 0;
+    for (char c : posting.bytes) {
+        gap |= (uint32_t)(c & 0x7f) << shift;
+        if (c & 0x80) {
+            shift += 7;
+            continue;
+        }
+        slot += gap;
+        out.push_back(slot);
+        gap = 0;
+        shift = 0;
+    }
+}
+
+void TextIndex::insert(const json &doc, const std::string &id) {
+    if (!doc.contains(field_name) || !doc[field_name].is_string()) return;
+    Vector<std::string> terms;
+    text_tokens(doc[field_name].get_ref<const std::string&>(), terms);
+    sort_unique(terms);
+
+    uint32_t slot = (uint32_t)ids.size();
+    ids.push_back(id);
+    dead.push_back(0);
+    slots[id] = slot;
+    for (const auto &term : terms) append(postings[term], slot);
+}
+
+void TextIndex::remove(const json &, const std::string &id) {
+    auto it = slots.find(id);
+    if (it == slots.end()) return;
+    dead[it->second] = 1;
+    ids[it->second].clear();
+    ++dead_count;
+    slots.erase(it);
+    if (dead_count > 1024 && dead_count * 2 > ids.size()) compact();
+}
+
+// Drops removed slots from every list and renumbers the rest.
+void TextIndex::compact() {
+    Vector<uint32_t> remap(ids.size());
+    Vector<std::string> live;
+    for (size_t slot = 0; slot < ids.size(); ++slot) {
+        if (dead[slot]) continue;
+        remap[slot] = (uint32_t)live.size();
+        slots[ids[slot]] = (uint32_t)live.size();
+        live.push_back(ids[slot]);
+    }
+
+    for (auto it = postings.begin(); it != postings.end();) {
+        Vector<uint32_t> old_slots;
+        decode(it->second, old_slots);
+        Posting rebuilt;
+        for (uint32_t slot : old_slots) {
+            if (!dead[slot]) append(rebuilt, remap[slot]);
+        }
+        if (rebuilt.count == 0) {
+            it = postings.erase(it);
+        } else {
+            it->second = std::move(rebuilt);
+            ++it;
+        }
+    }
+
+    ids = std::move(live);
+    dead = Vector<char>(ids.size(), 0);
+    dead_count = 0;
+}
+
+bool TextIndex::usable(const json &query) const {
+    if (!query.is_object() || query.contains("$or") || query.contains("$and")) return false;
+    auto it = query.find(field_name);
+    return it != query.end() && it->is_object() && it->contains("$text");
+}
+
+// Slots containing every term of the string, in slot order.
+void TextIndex::match_all(const std::string &text, Vector<uint32_t> &out) const {
+    Vector<std::string> terms;
+    text_tokens(text, terms);
+    sort_unique(terms);
+    if (terms.empty()) return;
+
+    Vector<const Posting*> lists;
+    for (const auto &term : terms) {
+        auto p = postings.find(term);
+        if (p == postings.end()) return;
+        lists.push_back(&p->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const Posting *a, const Posting *b) { return a->count < b->count; });
+
+    Vector<uint32_t> current;
+    decode(*lists[0], current);
+    for (size_t l = 1; l < lists.size() && !current.empty(); ++l) {
+        Vector<uint32_t> other, next;
+        decode(*lists[l], other);
+        size_t a = 0, b = 0;
+        while (a < current.size() && b < other.size()) {
+            if (current[a] < other[b]) ++a;
+            else if (other[b] < current[a]) ++b;
+            else { next.push_back(current[a]); ++a; ++b; }
+        }
+        current = std::move(next);
+    }
+    for (uint32_t slot : current) out.push_back(slot);
+}
+
+Vector<std::string> TextIndex::lookup(const json &query) const {
+    Vector<std::string> result;
+    if (!usable(query)) return result;
+    const json &terms = query[field_name]["$text"];
+
+    Vector<uint32_t> matched;
+    if (terms.is_string()) {
+        match_all(terms.get_ref<const std::string&>(), matched);
+    } else if (terms.is_array()) {
+        for (const auto &alt : terms) {
+            if (alt.is_string()) match_all(alt.get_ref<const std::string&>(), matched);
+        }
+        std::sort(matched.begin(), matched.end());
+        matched.resize(std::unique(matched.begin(), matched.end()) - matched.begin());
+    }
+    for (uint32_t slot : matched) {
+        if (!dead[slot]) result.push_back(ids[slot]);
+    }
+    return result;
+}
+
+size_t TextIndex::size() const { return slots.size(); }
+
+size_t TextIndex::posting_bytes() const {
+    size_t bytes = 0;
+    for (const auto &p : postings) bytes += p.second.bytes.size();
+    return bytes;
+}
+
+json TextIndex::to_json() const {
+    json id_list = json::array(), terms = json::array(), lists = json::array();
+    for (const auto &id : ids) id_list.push_back(id);
+    for (const auto &p : postings) {
+        terms.push_back(p.first);
+        lists.push_back(json::binary(std::vector<std::uint8_t>(p.second.bytes.begin(), p.second.bytes.end())));
+    }
+    return {{"field", field_name}, {"ids", id_list}, {"terms", terms}, {"postings", lists}};
+}
+
+void TextIndex::from_json(const json &j) {
+    *this = TextIndex(j.at("field").get<std::string>());
+    for (const auto &id : j.at("ids")) {
+        uint32_t slot = (uint32_t)ids.size();
+        ids.push_back(id.get<std::string>());
+        dead.push_back(ids.back().empty() ? 1 : 0);
+        if (ids.back().empty()) ++dead_count;
+        else slots[ids.back()] = slot;
+    }
+    const json &terms = j.at("terms");
+    const json &lists = j.at("postings");
+    if (terms.size() != lists.size()) throw std::runtime_error("Corrupt text index " + field_name);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const auto &bytes = lists[i].get_binary();
+        Posting &posting = postings[terms[i].get<std::string>()];
+        posting.bytes.assign(bytes.begin(), bytes.end());
+        Vector<uint32_t> decoded;
+        decode(posting, decoded);
+        for (uint32_t slot : decoded) {
+            if (slot >= ids.size()) throw std::runtime_error("Corrupt text index " + field_name);
+        }
+        posting.count = (uint32_t)decoded.size();
+        posting.last = decoded.empty() ? 0 : decoded.back();
+    }
+}
@@ -0,0 +1,180 @@
+#include "../include/trigram_index.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// $like ignores ASCII case, so trigrams are taken from the lower-cased text.
+static unsigned char lower(char c) {
+    unsigned char u = (unsigned char)c;
+    return (u >= 'A' && u <= 'Z') ? u + ('a' - 'A') : u;
+}
+
+static void add_run(const std::string &s, size_t begin, size_t end, Vector<uint32_t> &out) {
+    for (size_t i = begin; i + 3 <= end; ++i) {
+        out.push_back((uint32_t)lower(s[i]) << 16 | (uint32_t)lower(s[i + 1]) << 8 | lower(s[i + 2]));
+    }
+}
+
+static void sort_unique(Vector<uint32_t> &v) {
+    std::sort(v.begin(), v.end());
+    v.resize(std::unique(v.begin(), v.end()) - v.begin());
+}
+
+TrigramIndex::TrigramIndex() {}
+
+TrigramIndex::TrigramIndex(const std::string &field) : field_name(field) {}
+
+const std::string& TrigramIndex::field() const { return field_name; }
+
+void TrigramIndex::trigrams_of(const std::string &value, Vector<uint32_t> &out) {
+    add_run(value, 0, value.size(), out);
+    sort_unique(out);
+}
+
+// Only the literal runs between wildcards are known to occur in a match.
+void TrigramIndex::pattern_trigrams(const std::string &pattern, Vector<uint32_t> &out) {
+    size_t start = 0;
+    for (size_t i = 0; i <= pattern.size(); ++i) {
+        if (i == pattern.size() || pattern[i] == '%' || pattern[i] == '_') {
+            add_run(pattern, start, i, out);
+            start = i + 1;
+        }
+    }
+    sort_unique(out);
+}
+
+void TrigramIndex::insert(const json &doc, const std::string &id) {
+    if (!doc.contains(field_name) || !doc[field_name].is_string()) return;
+    uint32_t slot = (uint32_t)ids.size();
+    ids.push_back(id);
+    slots[id] = slot;
+    Vector<uint32_t> grams;
+    trigrams_of(doc[field_name].get_ref<const std::string&>(), grams);
+    for (uint32_t g : grams) postings[g].push_back(slot);
+}
+
+void TrigramIndex::remove(const json &doc, const std::string &id) {
+    auto it = slots.find(id);
+    if (it == slots.end()) return;
+    uint32_t slot = it->second;
+    Vector<uint32_t> grams;
+    if (doc.contains(field_name) && doc[field_name].is_string()) {
+        trigrams_of(doc[field_name].get_ref<const std::string&>(), grams);
+    }
+    for (uint32_t g : grams) {
+        auto p = postings.find(g);
+        if (p == postings.end()) continue;
+        Vector<uint32_t> &list = p->second;
+        uint32_t *pos = std::lower_bound(list.begin(), list.end(), slot);
+        if (pos != list.end() && *pos == slot) list.erase(pos - list.begin());
+        if (list.empty()) postings.erase(p);
+    }
+    ids[slot].clear();
+    ++dead_count;
+    slots.erase(it);
+    if (dead_count > 1024 && dead_count * 2 > ids.size()) compact();
+}
+
+// Renumbers the live slots. remove() already took the dead ones out of the
+// lists, and the renumbering keeps the order, so the lists stay sorted.
+void TrigramIndex::compact() {
+    Vector<uint32_t> remap(ids.size());
+    Vector<std::string> live;
+    for (size_t slot = 0; slot < ids.size(); ++slot) {
+        if (ids[slot].empty()) continue;
+        remap[slot] = (uint32_t)live.size();
+        slots[ids[slot]] = (uint32_t)live.size();
+        live.push_back(std::move(ids[slot]));
+    }
+    for (auto &p : postings) {
+        for (uint32_t &slot : p.second) slot = remap[slot];
+    }
+    ids = std::move(live);
+    dead_count = 0;
+}
+
+const std::string* TrigramIndex::pattern_of(const json &query) const {
+    if (!query.is_object()) return nullptr;
+    auto it = query.find(field_name);
+    if (it == query.end() || !it->is_object()) return nullptr;
+    auto like = it->find("$like");
+    if (like == it->end() || !like->is_string()) return nullptr;
+    return &like->get_ref<const std::string&>();
+}
+
+bool TrigramIndex::usable(const json &query) const {
+    if (query.contains("$or") || query.contains("$and")) return false;
+    const std::string *pattern = pattern_of(query);
+    if (!pattern) return false;
+    Vector<uint32_t> grams;
+    pattern_trigrams(*pattern, grams);
+    return !grams.empty();
+}
+
+// Intersects the posting lists starting from the shortest one.
+Vector<std::string> TrigramIndex::lookup(const json &query) const {
+    Vector<std::string> result;
+    const std::string *pattern = pattern_of(query);
+    if (!pattern) return result;
+    Vector<uint32_t> grams;
+    pattern_trigrams(*pattern, grams);
+    if (grams.empty()) return result;
+
+    Vector<const Vector<uint32_t>*> lists;
+    for (uint32_t g : grams) {
+        auto p = postings.find(g);
+        if (p == postings.end()) return result;
+        lists.push_back(&p->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const Vector<uint32_t> *a, const Vector<uint32_t> *b) { return a->size() < b->size(); });
+
+    Vector<uint32_t> current = *lists[0];
+    for (size_t l = 1; l < lists.size() && !current.empty(); ++l) {
+        const Vector<uint32_t> &other = *lists[l];
+        Vector<uint32_t> next;
+        size_t a = 0, b = 0;
+        while (a < current.size() && b < other.size()) {
+            if (current[a] < other[b]) ++a;
+            else if (other[b] < current[a]) ++b;
+            else { next.push_back(current[a]); ++a; ++b; }
+        }
+        current = std::move(next);
+    }
+    for (uint32_t slot : current) result.push_back(ids[slot]);
+    return result;
+}
+
+size_t TrigramIndex::size() const { return slots.size(); }
+
+json TrigramIndex::to_json() const {
+    json id_list = json::array(), grams = json::array(), lists = json::array();
+    for (const auto &id : ids) id_list.push_back(id);
+    for (const auto &p : postings) {
+        grams.push_back(p.first);
+        json list = json::array();
+        for (uint32_t slot : p.second) list.push_back(slot);
+        lists.push_back(list);
+    }
+    return {{"field", field_name}, {"ids", id_list}, {"grams", grams}, {"postings", lists}};
+}
+
+void TrigramIndex::from_json(const json &j) {
+    *this = TrigramIndex(j.at("field").get<std::string>());
+    for (const auto &id : j.at("ids")) {
+        uint32_t slot = (uint32_t)ids.size();
+        ids.push_back(id.get<std::string>());
+        if (ids.back().empty()) ++dead_count;
+        else slots[ids.back()] = slot;
+    }
+    const json &grams = j.at("grams");
+    const json &lists = j.at("postings");
+    if (grams.size() != lists.size()) throw std::runtime_error("Corrupt trigram index " + field_name);
+    for (size_t i = 0; i < grams.size(); ++i) {
+        Vector<uint32_t> &list = postings[grams[i].get<uint32_t>()];
+        for (const auto &slot : lists[i]) {
+            uint32_t s = slot.get<uint32_t>();
+            if (s >= ids.size()) throw std::runtime_error("Corrupt trigram index " + field_name);
+            list.push_back(s);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#include "../include/ttl_index.hpp"
+#include <ctime>
+#include <stdexcept>
+
+TtlIndex::TtlIndex() {}
+
+TtlIndex::TtlIndex(const std::string &field, int64_t expire_after)
+: field_name(field), expire_after_s(expire_after) {}
+
+const std::string& TtlIndex::field() const { return field_name; }
+
+int64_t TtlIndex::expire_after() const { return expire_after_s; }
+
+static bool read_digits(const std::string &s, size_t &pos, size_t n, int &out) {
+    if (pos + n > s.size()) return false;
+    out = 0;
+    for (size_t i = 0; i < n; ++i) {
+        char c = s[pos + i];
+        if (c < '0' || c > '9') return false;
+        out = out * 10 + (c - '0');
+    }
+    pos += n;
+    return true;
+}
+
+// Accepts "YYYY-MM-DD", optionally followed by "THH:MM[:SS[.fff]]" (or a
+// space instead of the T) and "Z" or an offset such as "+03:00".
+bool TtlIndex::parse_time(const json &value, int64_t &seconds) {
+    if (value.is_number()) {
+        seconds = (int64_t)value.get<double>();
+        return true;
+    }
+    if (!value.is_string()) return false;
+    const std::string &s = value.get_ref<const std::string&>();
+    std::tm tm = {};
+    size_t pos = 0;
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    if (!read_digits(s, pos, 4, year) || pos >= s.size() || s[pos++] != '-'
+        || !read_digits(s, pos, 2, month) || pos >= s.size() || s[pos++] != '-'
+        || !read_digits(s, pos, 2, day)) {
+        return false;
+    }
+    if (pos < s.size() && (s[pos] == 'T' || s[pos] == ' ')) {
+        ++pos;
+        if (!read_digits(s, pos, 2, hour) || pos >= s.size() || s[pos++] != ':'
+            || !read_digits(s, pos, 2, minute)) {
+            return false;
+        }
+        if (pos < s.size() && s[pos] == ':') {
+            ++pos;
+            if (!read_digits(s, pos, 2, second)) return false;
+            if (pos < s.size() && s[pos] == '.') {
+                ++pos;
+                while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') ++pos;
+            }
+        }
+    }
+    int64_t offset = 0;
+    if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+        int sign = s[pos++] == '-' ? -1 : 1, oh, om = 0;
+        if (!read_digits(s, pos, 2, oh)) return false;
+        if (pos < s.size() && s[pos] == ':') ++pos;
+        if (pos < s.size() && !read_digits(s, pos, 2, om)) return false;
+        offset = sign * (oh * 3600 + om * 60);
+    } else if (pos < s.size() && s[pos] == 'Z') {
+        ++pos;
+    }
+    if (pos != s.size() || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59
+        || second > 60) {
+        return false;
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    seconds = (int64_t)timegm(&tm) - offset;
+    return true;
+}
+
+bool TtlIndex::expiry_of(const json &doc, int64_t &at) const {
+    auto it = doc.find(field_name);
+    if (it == doc.end() || !parse_time(*it, at)) return false;
+    at += expire_after_s;
+    return true;
+}
+
+void TtlIndex::insert(const json &doc, const std::string &id) {
+    int64_t at;
+    if (expiry_of(doc, at)) entries.emplace(at, id);
+}
+
+void TtlIndex::remove(const json &doc, const std::string &id) {
+    int64_t at;
+    if (expiry_of(doc, at)) entries.erase({at, id});
+}
+
+Vector<std::string> TtlIndex::expired(int64_t now, size_t limit) const {
+    Vector<std::string> ids;
+    for (auto it = entries.begin(); it != entries.end() && it->first <= now && ids.size() < limit; ++it) {
+        ids.push_back(it->second);
+    }
+    return ids;
+}
+
+size_t TtlIndex::size() const { return entries.size(); }
+
+json TtlIndex::stats() const {
+    json s = {{"expire_after_s", expire_after_s}, {"documents", entries.size()}};
+    if (!entries.empty()) s["next_expiry"] = entries.begin()->first;
+    return s;
+}
+
+json TtlIndex::to_json() const {
+    json times = json::array(), ids = json::array();
+    for (const auto &e : entries) {
+        times.push_back(e.first);
+        ids.push_back(e.second);
+    }
+    return {{"field", field_name}, {"expire_after", expire_after_s}, {"times", times}, {"ids", ids}};
+}
+
+void TtlIndex::from_json(const json &j) {
+    *this = TtlIndex(j.at("field").get<std::string>(), j.at("expire_after").get<int64_t>());
+    const json &times = j.at("times");
+    const json &ids = j.at("ids");
+    if (times.size() != ids.size()) throw std::runtime_error("Corrupt TTL index " + field_name);
+    for (size_t i = 0; i < times.size(); ++i) entries.emplace_hint(entries.end(), times[i].get<int64_t>(), ids[i].get<std::string>());
+}
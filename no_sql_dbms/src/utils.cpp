@@ -2,6 +2,11 @@
 #include <random>
 #include <sstream>
 #include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
 
 std::string gen_id() {
     static std::mt19937_64 rng(std::chrono::high_resolution_clock::now().time_since_epoch().count());
@@ -10,3 +15,53 @@ std::string gen_id() {
     oss << std::hex << a;
     return oss.str();
 }
+
+uint32_t crc32(const void *data, size_t len) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)table_ready;
+
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void write_file_atomic(const std::string &path, const std::string &data) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot open " + tmp + " for writing");
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) {
+            ::close(fd);
+            throw std::runtime_error("Write failed for " + tmp);
+        }
+        written += (size_t)n;
+    }
+    ::fsync(fd);
+    ::close(fd);
+
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename " + tmp + " to " + path);
+    }
+    fsync_directory(std::filesystem::path(path).parent_path().string());
+}
+
+void fsync_directory(const std::string &dir) {
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    ::fsync(fd);
+    ::close(fd);
+}
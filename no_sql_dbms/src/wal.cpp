@@ -0,0 +1,313 @@
+#include "../include/wal.hpp"
+#include "../include/utils.hpp"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char WAL_MAGIC[8] = {'N', 'S', 'Q', 'L', 'W', 'A', 'L', '1'};
+static const size_t WAL_HEADER_SIZE = sizeof(WAL_MAGIC) + sizeof(uint64_t);
+static const size_t WAL_RECORD_OVERHEAD = 2 * sizeof(uint32_t);
+static const size_t WAL_BODY_PREFIX = sizeof(uint64_t) + sizeof(uint8_t);
+static const size_t WAL_GROUP_MAX_BYTES = 8 * 1024 * 1024;
+
+static std::string wal_header(uint64_t base_lsn) {
+    std::string header(WAL_MAGIC, sizeof(WAL_MAGIC));
+    header.append(reinterpret_cast<const char*>(&base_lsn), sizeof(base_lsn));
+    return header;
+}
+
+WriteAheadLog::WriteAheadLog(const std::string &path)
+: path(path), fd(-1), next_lsn(1), durable_lsn(0), active_base_lsn(0), file_bytes(0),
+  counters{0, 0, 0}, buffered_records(0), retired_fd(-1), retired_records(0), retired_lsn(0),
+  rotation_pending(false), max_commit_delay(0), flushing(false), stopping(false) {
+    if (!std::filesystem::exists(path)) write_header(0);
+    open_file();
+    committer = std::thread(&WriteAheadLog::committer_loop, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv_work.notify_all();
+    if (committer.joinable()) committer.join();
+    if (fd >= 0) ::close(fd);
+}
+
+void WriteAheadLog::open_file() {
+    if (fd >= 0) ::close(fd);
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) throw std::runtime_error("Cannot open WAL " + path);
+    file_bytes = (size_t)std::filesystem::file_size(path);
+}
+
+void WriteAheadLog::write_header(uint64_t base_lsn) {
+    write_file_atomic(path, wal_header(base_lsn));
+}
+
+bool WriteAheadLog::write_all(int out_fd, const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(out_fd, data.data() + written, data.size() - written);
+        if (n <= 0) return false;
+        written += (size_t)n;
+    }
+    return true;
+}
+
+uint64_t WriteAheadLog::append(uint8_t type, const std::string &payload) {
+    std::string body;
+    body.reserve(WAL_BODY_PREFIX + payload.size());
+    body.append(sizeof(uint64_t), '\0');
+    body.push_back((char)type);
+    body.append(payload);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t lsn = next_lsn++;
+    memcpy(&body[0], &lsn, sizeof(lsn));
+
+    uint32_t len = (uint32_t)body.size();
+    uint32_t crc = crc32(body.data(), body.size());
+    buffer.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    buffer.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    buffer.append(body);
+    ++buffered_records;
+    return lsn;
+}
+
+void WriteAheadLog::committer_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv_work.wait(lock, [this] { return stopping || rotation_pending || !buffer.empty(); });
+        if (!rotation_pending && buffer.empty()) break;
+
+        if (rotation_pending) {
+            std::string group;
+            group.swap(retired_buffer);
+            int out_fd = retired_fd;
+            size_t group_records = retired_records;
+            uint64_t group_lsn = retired_lsn;
+            flushing = true;
+            lock.unlock();
+
+            std::string failure;
+            if (!write_all(out_fd, group)) failure = "WAL write failed: " + path;
+            else if (::fdatasync(out_fd) != 0) failure = "WAL fsync failed: " + path;
+            ::close(out_fd);
+            fsync_directory(std::filesystem::path(path).parent_path().string());
+
+            lock.lock();
+            flushing = false;
+            rotation_pending = false;
+            retired_fd = -1;
+            if (failure.empty()) {
+                if (group_lsn > durable_lsn) durable_lsn = group_lsn;
+                if (!group.empty()) ++counters.commits;
+                counters.records += group_records;
+                counters.bytes += group.size();
+            } else {
+                error = failure;
+            }
+            cv_done.notify_all();
+            continue;
+        }
+
+        if (max_commit_delay.count() > 0 && !stopping) {
+            cv_work.wait_for(lock, max_commit_delay, [this] {
+                return stopping || rotation_pending || buffer.size() >= WAL_GROUP_MAX_BYTES;
+            });
+            if (rotation_pending) continue;
+        }
+
+        std::string group;
+        group.swap(buffer);
+        uint64_t group_lsn = next_lsn - 1;
+        size_t group_records = buffered_records;
+        buffered_records = 0;
+        int out_fd = fd;
+        flushing = true;
+        lock.unlock();
+
+        std::string failure;
+        if (!write_all(out_fd, group)) failure = "WAL write failed: " + path;
+        else if (::fdatasync(out_fd) != 0) failure = "WAL fsync failed: " + path;
+
+        lock.lock();
+        flushing = false;
+        if (failure.empty()) {
+            if (out_fd == fd) file_bytes += group.size();
+            durable_lsn = group_lsn;
+            ++counters.commits;
+            counters.records += group_records;
+            counters.bytes += group.size();
+        } else {
+            error = failure;
+        }
+        cv_done.notify_all();
+    }
+}
+
+void WriteAheadLog::wait_durable(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (durable_lsn >= lsn) return;
+    cv_work.notify_one();
+    cv_done.wait(lock, [&] { return durable_lsn >= lsn || !error.empty(); });
+    if (!error.empty()) throw std::runtime_error(error);
+}
+
+void WriteAheadLog::sync() {
+    wait_durable(last_lsn());
+}
+
+uint64_t WriteAheadLog::rotate() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_done.wait(lock, [this] { return !rotation_pending; });
+    uint64_t lsn = next_lsn - 1;
+    if (lsn == active_base_lsn) return lsn;
+
+    std::string retired_path = path + "." + std::to_string(lsn);
+    if (std::rename(path.c_str(), retired_path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rotate WAL " + path);
+    }
+    int new_fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+    if (new_fd < 0) throw std::runtime_error("Cannot open WAL " + path);
+    std::string header = wal_header(lsn);
+    if (!write_all(new_fd, header)) {
+        ::close(new_fd);
+        throw std::runtime_error("Cannot write WAL header " + path);
+    }
+
+    retired_fd = fd;
+    retired_buffer.swap(buffer);
+    retired_records = buffered_records;
+    retired_lsn = lsn;
+    rotation_pending = true;
+
+    fd = new_fd;
+    buffered_records = 0;
+    file_bytes = header.size();
+    active_base_lsn = lsn;
+    cv_work.notify_one();
+    return lsn;
+}
+
+Vector<std::pair<uint64_t, std::string>> WriteAheadLog::retired_files() const {
+    Vector<std::pair<uint64_t, std::string>> files;
+    std::filesystem::path p(path);
+    std::string prefix = p.filename().string() + ".";
+    std::filesystem::path dir = p.parent_path().empty() ? "." : p.parent_path();
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind(prefix, 0) != 0) continue;
+        std::string suffix = name.substr(prefix.size());
+        if (suffix.empty() || suffix.find_first_not_of("0123456789") != std::string::npos) continue;
+        files.emplace_back(std::stoull(suffix), entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void WriteAheadLog::remove_retired(uint64_t upto_lsn) {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_done.wait(lock, [this] { return !rotation_pending; });
+    }
+    for (auto &f : retired_files()) {
+        if (f.first <= upto_lsn) std::filesystem::remove(f.second);
+    }
+}
+
+void WriteAheadLog::replay_file(const std::string &file, uint64_t after_lsn, uint64_t &last,
+                                const std::function<void(const WalRecord&)> &fn) {
+    std::ifstream ifs(file, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string data = ss.str();
+
+    if (data.size() < WAL_HEADER_SIZE || memcmp(data.data(), WAL_MAGIC, sizeof(WAL_MAGIC)) != 0) {
+        throw std::runtime_error("Invalid WAL header: " + file);
+    }
+
+    uint64_t base_lsn;
+    memcpy(&base_lsn, data.data() + sizeof(WAL_MAGIC), sizeof(base_lsn));
+    if (base_lsn > last) last = base_lsn;
+    if (file == path) active_base_lsn = base_lsn;
+
+    size_t pos = WAL_HEADER_SIZE;
+    size_t replayed = 0;
+    while (pos + WAL_RECORD_OVERHEAD <= data.size()) {
+        uint32_t len, crc;
+        memcpy(&len, data.data() + pos, sizeof(len));
+        memcpy(&crc, data.data() + pos + sizeof(len), sizeof(crc));
+        size_t body_pos = pos + WAL_RECORD_OVERHEAD;
+        if (len < WAL_BODY_PREFIX || body_pos + len > data.size()) break;
+        if (crc32(data.data() + body_pos, len) != crc) break;
+
+        WalRecord rec;
+        memcpy(&rec.lsn, data.data() + body_pos, sizeof(rec.lsn));
+        rec.type = (uint8_t)data[body_pos + sizeof(rec.lsn)];
+        rec.payload.assign(data.data() + body_pos + WAL_BODY_PREFIX, len - WAL_BODY_PREFIX);
+        if (rec.lsn <= last) break;
+
+        if (rec.lsn > after_lsn) {
+            fn(rec);
+            ++replayed;
+        }
+        last = rec.lsn;
+        pos = body_pos + len;
+    }
+
+    if (pos < data.size()) {
+        std::cout << "WAL " << file << ": dropping " << (data.size() - pos)
+                  << " bytes of torn or corrupt tail" << std::endl;
+        if (::truncate(file.c_str(), (off_t)pos) != 0) {
+            throw std::runtime_error("Cannot truncate WAL " + file);
+        }
+    }
+    if (replayed > 0) {
+        std::cout << "WAL " << file << ": replayed " << replayed << " records" << std::endl;
+    }
+}
+
+void WriteAheadLog::replay(uint64_t after_lsn, const std::function<void(const WalRecord&)> &fn) {
+    uint64_t last = 0;
+    for (auto &f : retired_files()) {
+        replay_file(f.second, after_lsn, last, fn);
+    }
+    replay_file(path, after_lsn, last, fn);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    next_lsn = std::max(last, after_lsn) + 1;
+    durable_lsn = next_lsn - 1;
+    buffer.clear();
+    buffered_records = 0;
+    open_file();
+}
+
+void WriteAheadLog::set_max_commit_delay(std::chrono::microseconds delay) {
+    std::lock_guard<std::mutex> lock(mtx);
+    max_commit_delay = delay;
+}
+
+uint64_t WriteAheadLog::last_lsn() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return next_lsn - 1;
+}
+
+size_t WriteAheadLog::size_bytes() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return file_bytes + buffer.size();
+}
+
+WalStats WriteAheadLog::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return counters;
+}